@@ -29,6 +29,7 @@
 #include <simgear/debug/logstream.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_cache.hxx>
 
 #include "global.hxx"
 #include "debug.hxx"
@@ -41,7 +42,7 @@ double tgAverageElevation( const std::string &root, const string_list elev_src,
 {
     bool done = false;
     unsigned int i;
-    tgArray array;
+    tgArrayRef array;
 
     // make a copy so our routine is non-destructive.
     std::vector<SGGeod> points = points_source;
@@ -74,42 +75,50 @@ double tgAverageElevation( const std::string &root, const string_list elev_src,
             std::string base = b.gen_base_path();
 
             // try the various elevation sources
+            array.reset();
             i = 0;
             bool found_file = false;
             while ( !found_file && i < elev_src.size() ) {
                 std::string array_path = root + "/" + elev_src[i] + "/" + base + "/" + b.gen_index_str();
 
-                if ( array.open(array_path) ) {
+                if ( tgArrayCache::instance().get( array_path, b, array ) ) {
                     found_file = true;
                     TG_LOG( SG_GENERAL, SG_DEBUG, "Using array_path = " << array_path );
                 }
                 i++;
             }
 
-            // this will fill in a zero structure if no array data
-            // found/opened
-            array.parse( b );
-
-            // this will do a hasty job of removing voids by inserting
-            // data from the nearest neighbor (sort of)
-            array.remove_voids();
+            // a missing array is zero'd data for the bucket.  With no
+            // elevation sources at all, we still need one
+            if ( !array ) {
+                tgArrayCache::instance().get( root + "/" + base + "/" + b.gen_index_str(), b, array );
+            }
 
             // update all the non-updated elevations that are inside
             // this array file
-            double elev;
+            std::vector<unsigned int> idx;
+            std::vector<double> lon, lat, elev;
             done = true;
             for ( i = 0; i < points.size(); ++i ) {
                 if ( points[i].getElevationM() < -9000.0 ) {
                     done = false;
-                    elev = array.altitude_from_grid( points[i].getLongitudeDeg() * 3600.0,
-                                                     points[i].getLatitudeDeg() * 3600.0 );
-                    if ( elev > -9000 ) {
-                        points[i].setElevationM( elev );
+                    idx.push_back( i );
+                    lon.push_back( points[i].getLongitudeDeg() * 3600.0 );
+                    lat.push_back( points[i].getLatitudeDeg() * 3600.0 );
+                }
+            }
+
+            if ( !idx.empty() ) {
+                elev.resize( idx.size() );
+                array->altitudes_from_grid( idx.size(), &lon[0], &lat[0], &elev[0] );
+
+                for ( i = 0; i < idx.size(); ++i ) {
+                    if ( elev[i] > -9000 ) {
+                        points[idx[i]].setElevationM( elev[i] );
                     }
                 }
             }
 
-            array.close();
         } else {
             done = true;
         }
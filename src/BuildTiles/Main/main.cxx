@@ -34,11 +34,14 @@
 #include <simgear/debug/logstream.hxx>
 #include <Include/version.h>
 
+#include <terragear/tg_array_cache.hxx>
 #include <terragear/tg_mutex.hxx>
+#include <terragear/tg_trace.hxx>
 
 #include "tgconstruct_stage1.hxx"
 #include "tgconstruct_stage2.hxx"
 #include "tgconstruct_stage3.hxx"
+#include "tgconstruct_scheduler.hxx"
 #include "priorities.hxx"
 
 // display usage and exit
@@ -59,6 +62,9 @@ static void usage( const std::string& name ) {
     SG_LOG(SG_GENERAL, SG_ALERT, "  --ignore-landmass");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --threads");
     SG_LOG(SG_GENERAL, SG_ALERT, "  --threads=<numthreads>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --array-cache=<MB>");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --trace=<basename> ( writes <basename>.json and <basename>.trace.json )");
+    SG_LOG(SG_GENERAL, SG_ALERT, "  --profile-locks ( logs lock contention per site at exit )");
     SG_LOG(SG_GENERAL, SG_ALERT, " ]");
     exit(-1);
 }
@@ -139,10 +145,10 @@ void doStage3( int num_threads, std::vector<SGBucket>& bucketList,
     constructs.clear();    
 }
 
-void doStage2( int num_threads, std::vector<SGBucket>& bucketList, 
-               const std::string& priorities_file,
-               const std::string& work_base, const std::string& dem_base, 
-               const std::string& share_base, const std::string& debug_base )
+unsigned int doStage2( int num_threads, std::vector<SGBucket>& bucketList, 
+                       const std::string& priorities_file,
+                       const std::string& work_base, const std::string& dem_base, 
+                       const std::string& share_base, const std::string& debug_base )
 {
     SGLockedQueue<SGBucket> wq;
 
@@ -170,8 +176,10 @@ void doStage2( int num_threads, std::vector<SGBucket>& bucketList,
         tgSleep( 5 );
     }
     // wait for all threads to complete
+    unsigned int numFailed = 0;
     for (unsigned int i=0; i<constructs.size(); i++) {
         constructs[i]->join();
+        numFailed += constructs[i]->getNumFailed();
     }
     
     // delete the stage 1 construct objects
@@ -179,12 +187,14 @@ void doStage2( int num_threads, std::vector<SGBucket>& bucketList,
         delete constructs[i];
     }
     constructs.clear();    
+
+    return numFailed;
 }
 
-void doStage1( int num_threads, std::vector<SGBucket>& bucketList, 
-               const std::string& priorities_file,
-               const std::string& work_base, const std::string& dem_base, 
-               const std::string& share_base, const std::string& debug_base )
+unsigned int doStage1( int num_threads, std::vector<SGBucket>& bucketList, 
+                       const std::string& priorities_file,
+                       const std::string& work_base, const std::string& dem_base, 
+                       const std::string& share_base, const std::string& debug_base )
 {
     SGLockedQueue<SGBucket> wq;
 
@@ -212,8 +222,10 @@ void doStage1( int num_threads, std::vector<SGBucket>& bucketList,
         tgSleep( 5 );
     }
     // wait for all threads to complete
+    unsigned int numFailed = 0;
     for (unsigned int i=0; i<constructs.size(); i++) {
         constructs[i]->join();
+        numFailed += constructs[i]->getNumFailed();
     }
 
     // delete the stage 1 construct objects
@@ -221,6 +233,45 @@ void doStage1( int num_threads, std::vector<SGBucket>& bucketList,
         delete constructs[i];
     }
     constructs.clear();    
+
+    return numFailed;
+}
+
+// run stage 1 and stage 2 together - a bucket moves to stage 2 as soon as
+// it and its neighbours finish stage 1, so no thread idles at a stage barrier
+unsigned int doStage12( int num_threads, std::vector<SGBucket>& bucketList, 
+                        const std::string& priorities_file,
+                        const std::string& work_base, const std::string& dem_base, 
+                        const std::string& share_base, const std::string& debug_base )
+{
+    tgConstructScheduler scheduler( bucketList );
+
+    // now create the worker threads for stage 1 and 2
+    std::vector<tgConstructWorker *> workers;
+    tgMutex filelock;
+
+    for (int i=0; i<num_threads; i++) {
+        tgConstructWorker* worker = new tgConstructWorker( priorities_file, scheduler, &filelock );
+        worker->setPaths( work_base, dem_base, share_base, debug_base );
+        workers.push_back( worker );
+    }
+
+    // start all threads
+    for (unsigned int i=0; i<workers.size(); i++) {
+        workers[i]->start();
+    }
+    // wait for all threads to complete - they exit when the scheduler runs dry
+    for (unsigned int i=0; i<workers.size(); i++) {
+        workers[i]->join();
+    }
+
+    // delete the worker objects
+    for (unsigned int i=0; i<workers.size(); i++) {
+        delete workers[i];
+    }
+    workers.clear();
+
+    return scheduler.getNumFailed();
 }
 
 int main(int argc, char **argv) {
@@ -232,6 +283,7 @@ int main(int argc, char **argv) {
     std::string debug_dir = ".";
     
     std::string priorities_file = DEFAULT_PRIORITIES_FILE;
+    std::string trace_base = "";
     
     SGGeod min, max;
     long   tile_id = -1;
@@ -276,6 +328,13 @@ int main(int argc, char **argv) {
             num_threads = atoi( arg.substr(10).c_str() );
         } else if (arg.find("--threads") == 0) {
             num_threads = boost::thread::hardware_concurrency();
+        } else if (arg.find("--array-cache=") == 0) {
+            tgArrayCache::instance().setBudget( atoi( arg.substr(14).c_str() ) );
+        } else if (arg.find("--trace=") == 0) {
+            trace_base = arg.substr(8);
+            tgTrace::instance().enable( true );
+        } else if (arg == "--profile-locks") {
+            tgMutex::enableProfiling( true );
         } else if (arg.find("--stage=") == 0) {
             start_stage = atoi( arg.substr(8).c_str() );
             end_stage   = start_stage;
@@ -332,13 +391,14 @@ int main(int argc, char **argv) {
     }
 #endif
 
-// STAGE 1
-    if ( ( start_stage <= 1 ) && ( end_stage >= 1 ) ) {
-        doStage1( num_threads, bucketList, priorities_file, work_dir, dem_dir, share_dir, debug_dir );
-    }
-    
-    if ( ( start_stage <= 2 ) && ( end_stage >= 2 ) ) {
-        doStage2( num_threads, bucketList, priorities_file, work_dir, dem_dir, share_dir, debug_dir );
+// STAGE 1 and 2
+    unsigned int numFailed = 0;
+    if ( ( start_stage <= 1 ) && ( end_stage >= 2 ) ) {
+        numFailed = doStage12( num_threads, bucketList, priorities_file, work_dir, dem_dir, share_dir, debug_dir );
+    } else if ( ( start_stage <= 1 ) && ( end_stage >= 1 ) ) {
+        numFailed = doStage1( num_threads, bucketList, priorities_file, work_dir, dem_dir, share_dir, debug_dir );
+    } else if ( ( start_stage <= 2 ) && ( end_stage >= 2 ) ) {
+        numFailed = doStage2( num_threads, bucketList, priorities_file, work_dir, dem_dir, share_dir, debug_dir );
     }
     
 // STAGE 2    
@@ -411,6 +471,17 @@ int main(int argc, char **argv) {
     constructs.clear();
 #endif
 
+    if ( !trace_base.empty() ) {
+        tgTrace::instance().writeJson( trace_base + ".json" );
+        tgTrace::instance().writeChromeTrace( trace_base + ".trace.json" );
+    }
+
+    // the workers are joined - safe to exit
+    if ( numFailed ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "[Finished with " << numFailed << " of " << bucketList.size() << " tiles failed]");
+        return -1;
+    }
+
     SG_LOG(SG_GENERAL, SG_ALERT, "[Finished successfully]");
     return 0;
 }
@@ -25,12 +25,60 @@
 #include <fstream>
 #include <vector>
 #include <map>
+#include <mutex>
 #include <string>
 
 #include <stdlib.h>
 
 #include "priorities.hxx"
 
+TGAreaCategory TGAreaDefinition::toCategory( const std::string& c )
+{
+    if ( c == "other" ) {
+        return AREA_CATEGORY_OTHER;
+    } else if ( c == "hole" ) {
+        return AREA_CATEGORY_HOLE;
+    } else if ( c == "landmass" ) {
+        return AREA_CATEGORY_LANDMASS;
+    } else if ( c == "island" ) {
+        return AREA_CATEGORY_ISLAND;
+    } else if ( c == "road" ) {
+        return AREA_CATEGORY_ROAD;
+    } else if ( c == "ocean" ) {
+        return AREA_CATEGORY_OCEAN;
+    } else if ( c == "lake" ) {
+        return AREA_CATEGORY_LAKE;
+    } else if ( c == "stream" ) {
+        return AREA_CATEGORY_STREAM;
+    }
+
+    return AREA_CATEGORY_UNKNOWN;
+}
+
+TGAreaDefinitionsRef TGAreaDefinitions::load( const std::string& filename )
+{
+    static std::mutex                                   mutex;
+    static std::map<std::string, TGAreaDefinitionsRef>  loaded;
+
+    std::lock_guard<std::mutex> guard( mutex );
+
+    std::map<std::string, TGAreaDefinitionsRef>::iterator it = loaded.find( filename );
+    if ( it != loaded.end() ) {
+        return it->second;
+    }
+
+    TGAreaDefinitions* defs = new TGAreaDefinitions();
+    if ( defs->init( filename ) ) {
+        delete defs;
+        return TGAreaDefinitionsRef();
+    }
+
+    TGAreaDefinitionsRef ref( defs );
+    loaded[filename] = ref;
+
+    return ref;
+}
+
 int TGAreaDefinitions::init( const std::string& filename )
 {
     std::ifstream in ( filename.c_str() );
@@ -38,7 +86,7 @@ int TGAreaDefinitions::init( const std::string& filename )
 
     if ( ! in ) {
         SG_LOG(SG_GENERAL, SG_ALERT, "Unable to open priorities file " << filename);
-        return 0;
+        return -1;
     }
     SG_LOG(SG_GENERAL, SG_DEBUG, "Using priorities file is " << filename);
 
@@ -62,6 +110,7 @@ int TGAreaDefinitions::init( const std::string& filename )
             ocean_area_priority = cur_priority;
         }
 
+        area_index.insert( std::make_pair( name, cur_priority ) );
         area_defs.push_back( TGAreaDefinition( name, category, cur_priority++ ) );
     }
     in.close();
@@ -25,18 +25,34 @@
 #define _PRIORITIES_HXX
 
 #include <map>
+#include <memory>
 #include <string>
 
 #include <simgear/compiler.h>
 
 #include <terragear/tg_polygon.hxx>
 
+// area categories - parsed once from the category string, so the is_*_area
+// queries don't compare strings for every polygon
+typedef enum {
+    AREA_CATEGORY_OTHER,
+    AREA_CATEGORY_HOLE,
+    AREA_CATEGORY_LANDMASS,
+    AREA_CATEGORY_ISLAND,
+    AREA_CATEGORY_ROAD,
+    AREA_CATEGORY_OCEAN,
+    AREA_CATEGORY_LAKE,
+    AREA_CATEGORY_STREAM,
+    AREA_CATEGORY_UNKNOWN
+} TGAreaCategory;
+
 class TGAreaDefinition {
 public:
     TGAreaDefinition( const std::string& n, const std::string& c, unsigned int p ) {
         name     = n;
         category = c;
         priority = p;
+        type     = toCategory( c );
     };
 
     std::string const& GetName() const {
@@ -51,10 +67,17 @@ public:
         return category;
     }
 
+    TGAreaCategory GetCategoryType() const {
+        return type;
+    }
+
 private:
-    std::string  name;
-    unsigned int priority;
-    std::string  category;
+    static TGAreaCategory toCategory( const std::string& c );
+
+    std::string    name;
+    unsigned int   priority;
+    std::string    category;
+    TGAreaCategory type;
 
     // future improvements
     unsigned int smooth_method;
@@ -66,78 +89,58 @@ private:
 typedef std::vector<TGAreaDefinition> area_definition_list;
 typedef area_definition_list::const_iterator area_definition_iterator;
 
+class TGAreaDefinitions;
+typedef std::shared_ptr<const TGAreaDefinitions> TGAreaDefinitionsRef;
+
+// The area definitions never change once the priorities file is parsed.
+// load() parses each file once per process, and every thread shares the
+// same read only copy.  Area names are the material names - get_area_name
+// returns the one shared string, so callers can hold a reference or the
+// area index ( priority ) rather than copying the name around.
 class TGAreaDefinitions {
 public:
     TGAreaDefinitions() {};
     int init( const std::string& filename );
+
+    // the shared definitions for filename - parsed on first use
+    static TGAreaDefinitionsRef load( const std::string& filename );
+
     unsigned int size() const {
         return area_defs.size();
     }
 
     bool is_hole_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "hole" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_HOLE;
     }
 
     bool is_landmass_area( unsigned int p ) const {
-        if (( area_defs[p].GetCategory() == "landmass" ) || 
-	    ( area_defs[p].GetCategory() == "other" )) {
-            return true;
-        } else {
-            return false;
-        }
+        return ( area_defs[p].GetCategoryType() == AREA_CATEGORY_LANDMASS ) ||
+               ( area_defs[p].GetCategoryType() == AREA_CATEGORY_OTHER );
     }
 
     bool is_island_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "island" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_ISLAND;
     }
 
     bool is_road_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "road" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_ROAD;
     }
 
     bool is_water_area( unsigned int p ) const {
-        if ( ( area_defs[p].GetCategory() == "ocean" ) ||
-             ( area_defs[p].GetCategory() == "lake" ) ){
-            return true;
-        } else {
-            return false;
-        }
+        return ( area_defs[p].GetCategoryType() == AREA_CATEGORY_OCEAN ) ||
+               ( area_defs[p].GetCategoryType() == AREA_CATEGORY_LAKE );
     }
 
     bool is_lake_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "lake" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_LAKE;
     }
 
     bool is_stream_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "stream" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_STREAM;
     }
 
     bool is_ocean_area( unsigned int p ) const {
-        if ( area_defs[p].GetCategory() == "ocean" ) {
-            return true;
-        } else {
-            return false;
-        }
+        return area_defs[p].GetCategoryType() == AREA_CATEGORY_OCEAN;
     }
 
     std::string const& get_area_name( unsigned int p ) const {
@@ -145,10 +148,9 @@ public:
     }
 
     unsigned int get_area_priority( const std::string& name ) const {
-        for (unsigned int i=0; i < area_defs.size(); i++) {
-            if ( area_defs[i].GetName() == name ) {
-                return i;
-            }
+        std::map<std::string, unsigned int>::const_iterator it = area_index.find( name );
+        if ( it != area_index.end() ) {
+            return it->second;
         }
 
         SG_LOG(SG_GENERAL, SG_ALERT, "No area named " << name);
@@ -176,6 +178,7 @@ public:
 
 private:
     area_definition_list area_defs;
+    std::map<std::string, unsigned int> area_index;     // name to priority - first definition wins
     std::string  ocean_area_name;
     unsigned int ocean_area_priority;
 };
@@ -227,8 +227,8 @@ int TGConstruct::LoadLandclassPolys( void ) {
             }
 
             string lext = p.complete_lower_extension();
-            if ((lext == "arr") || (lext == "arr.gz") || (lext == "btg.gz") ||
-                (lext == "fit") || (lext == "fit.gz") || (lext == "ind"))
+            if ((lext == "arr") || (lext == "arr.gz") || (lext == "arr.raw") || (lext == "btg.gz") ||
+                (lext == "fit") || (lext == "fit.gz") || (lext == "fit.raw") || (lext == "ind"))
             {
                 // skipped!
             } else {
@@ -0,0 +1,175 @@
+// tgconstruct_scheduler.cxx -- dependency driven stage scheduling
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <algorithm>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tgconstruct_scheduler.hxx"
+
+tgConstructScheduler::tgConstructScheduler( const std::vector<SGBucket>& bucketList )
+{
+    inFlight       = 0;
+    stage1Complete = 0;
+    stage2Complete = 0;
+
+    for (unsigned int i=0; i<bucketList.size(); i++) {
+        buckets[bucketList[i].gen_index()] = bucketList[i];
+    }
+    totalTiles = buckets.size();
+
+    // each bucket waits on itself, and every neighbour we are going to build
+    std::map<long, SGBucket>::const_iterator bit;
+    for ( bit = buckets.begin(); bit != buckets.end(); bit++ ) {
+        std::vector<SGBucket> neighbors;
+        std::vector<long>     deps;
+
+        deps.push_back( bit->first );
+
+        getNeighbors( bit->second, neighbors );
+        for (unsigned int i=0; i<neighbors.size(); i++) {
+            long idx = neighbors[i].gen_index();
+
+            if ( buckets.find( idx ) != buckets.end() &&
+                 std::find( deps.begin(), deps.end(), idx ) == deps.end() ) {
+                deps.push_back( idx );
+            }
+        }
+
+        waitingOn[bit->first] = deps.size();
+        for (unsigned int i=0; i<deps.size(); i++) {
+            dependents[deps[i]].push_back( bit->first );
+        }
+
+        stage1Queue.push( bit->second );
+    }
+
+    SG_LOG(SG_GENERAL, SG_INFO, "tgConstructScheduler: scheduled " << totalTiles << " tiles" );
+}
+
+// the same neighbours tgMeshTriangulation::loadTriangulation reads shared edges from
+void tgConstructScheduler::getNeighbors( const SGBucket& b, std::vector<SGBucket>& neighbors ) const
+{
+    b.siblings( 0,  1, neighbors );
+    b.siblings( 0, -1, neighbors );
+    neighbors.push_back( b.sibling( -1, 0 ) );
+    neighbors.push_back( b.sibling(  1, 0 ) );
+}
+
+bool tgConstructScheduler::getWork( SGBucket& b, unsigned int& stage )
+{
+    std::unique_lock<std::mutex> guard( mutex );
+
+    while ( true ) {
+        // finish tiles first - stage 2 work is only available once
+        // all neighbours have been through stage 1
+        if ( !stage2Queue.empty() ) {
+            b     = stage2Queue.pop();
+            stage = 2;
+            inFlight++;
+
+            SG_LOG(SG_GENERAL, SG_ALERT, b.gen_index_str() << " - Stage 2 Construct in " << b.gen_base_path() << " tile " << stage2Complete+1 << " of " << totalTiles << " using thread " << SGThread::current() );
+            return true;
+        }
+
+        if ( !stage1Queue.empty() ) {
+            b     = stage1Queue.pop();
+            stage = 1;
+            inFlight++;
+
+            SG_LOG(SG_GENERAL, SG_ALERT, b.gen_index_str() << " - Stage1 Construct in " << b.gen_base_path() << " tile " << stage1Complete+1 << " of " << totalTiles << " using thread " << SGThread::current() );
+            return true;
+        }
+
+        // nothing ready - if nothing is being worked on, we are done
+        if ( !inFlight ) {
+            return false;
+        }
+
+        // a tile in progress may release more stage 2 work
+        workReady.wait( guard );
+    }
+}
+
+void tgConstructScheduler::workComplete( const SGBucket& b, unsigned int stage, bool ok )
+{
+    std::lock_guard<std::mutex> guard( mutex );
+
+    inFlight--;
+
+    if ( !ok ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, b.gen_index_str() << " - Stage " << stage << " failed" );
+        if ( stage == 1 ) {
+            // the buckets waiting on it never become ready
+            std::vector<long>& deps = dependents[b.gen_index()];
+            for (unsigned int i=0; i<deps.size(); i++) {
+                SG_LOG(SG_GENERAL, SG_ALERT, buckets[deps[i]].gen_index_str() << " - skipping stage 2" );
+            }
+        }
+    } else if ( stage == 1 ) {
+        stage1Complete++;
+
+        std::vector<long>& deps = dependents[b.gen_index()];
+        for (unsigned int i=0; i<deps.size(); i++) {
+            if ( --waitingOn[deps[i]] == 0 ) {
+                SG_LOG(SG_GENERAL, SG_DEBUG, "tgConstructScheduler: " << buckets[deps[i]].gen_index_str() << " ready for stage 2" );
+                stage2Queue.push( buckets[deps[i]] );
+            }
+        }
+    } else {
+        stage2Complete++;
+    }
+
+    // wake everyone - either there is new work, or we may be done
+    workReady.notify_all();
+}
+
+tgConstructWorker::tgConstructWorker( const std::string& pfile, tgConstructScheduler& s, tgMutex* l ) :
+    scheduler(s),
+    first( pfile, s.getStage1Queue(), l ),
+    second( pfile, s.getStage2Queue(), l )
+{
+}
+
+void tgConstructWorker::setPaths( const std::string& work, const std::string& dem, const std::string& share, const std::string& debug ) {
+    first.setPaths( work, dem, share, debug );
+    second.setPaths( work, dem, share, debug );
+}
+
+void tgConstructWorker::run()
+{
+    SGBucket     b;
+    unsigned int stage;
+
+    while ( scheduler.getWork( b, stage ) ) {
+        bool ok;
+
+        if ( stage == 1 ) {
+            ok = first.construct( b );
+        } else {
+            ok = second.construct( b );
+        }
+
+        scheduler.workComplete( b, stage, ok );
+    }
+
+    SG_LOG(SG_GENERAL, SG_DEBUG, "Worker thread " << current() << " finished");
+}
@@ -0,0 +1,106 @@
+// tgconstruct_scheduler.hxx -- dependency driven stage scheduling
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License as
+// published by the Free Software Foundation; either version 2 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
+//
+
+#ifndef _TGCONSTRUCT_SCHEDULER_HXX
+#define _TGCONSTRUCT_SCHEDULER_HXX
+
+#ifndef __cplusplus
+# error This library requires C++
+#endif
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <simgear/bucket/newbucket.hxx>
+#include <simgear/threads/SGThread.hxx>
+#include <simgear/threads/SGQueue.hxx>
+
+#include <terragear/tg_mutex.hxx>
+
+#include "tgconstruct_stage1.hxx"
+#include "tgconstruct_stage2.hxx"
+
+// Stage 2 of a bucket reads the stage 1 triangulation of the bucket, and the
+// shared edge nodes of its north, south, east and west neighbours.  Rather
+// than waiting for every bucket to finish stage 1, the scheduler releases a
+// bucket to stage 2 as soon as it, and all of its neighbours in the work list
+// have completed stage 1.  Neighbours outside of the work list are not
+// waited on - just as with the per stage barrier.  A bucket failing stage 1
+// never releases the buckets waiting on it - they are failed, too.
+class tgConstructScheduler
+{
+public:
+    tgConstructScheduler( const std::vector<SGBucket>& bucketList );
+
+    // block until a bucket is ready for stage 1 or stage 2.
+    // returns false once all work is complete
+    bool getWork( SGBucket& b, unsigned int& stage );
+
+    // a worker has finished a stage for a bucket - successfully, or not
+    void workComplete( const SGBucket& b, unsigned int stage, bool ok );
+
+    // number of buckets that didn't make it through stage 2.  call once
+    // all workers are joined
+    unsigned int getNumFailed( void ) const { return totalTiles - stage2Complete; }
+
+    SGLockedQueue<SGBucket>& getStage1Queue( void ) { return stage1Queue; }
+    SGLockedQueue<SGBucket>& getStage2Queue( void ) { return stage2Queue; }
+
+private:
+    void getNeighbors( const SGBucket& b, std::vector<SGBucket>& neighbors ) const;
+
+    std::mutex                          mutex;
+    std::condition_variable             workReady;
+
+    SGLockedQueue<SGBucket>             stage1Queue;
+    SGLockedQueue<SGBucket>             stage2Queue;
+
+    // bucket index -> bucket, for every bucket in the work list
+    std::map<long, SGBucket>            buckets;
+
+    // bucket index -> number of stage 1 buckets it is still waiting on
+    std::map<long, unsigned int>        waitingOn;
+
+    // bucket index -> buckets waiting on it's stage 1 completion
+    std::map<long, std::vector<long> >  dependents;
+
+    unsigned int                        inFlight;
+    unsigned int                        totalTiles;
+    unsigned int                        stage1Complete;
+    unsigned int                        stage2Complete;
+};
+
+// worker thread pulling stage 1 and stage 2 work from the scheduler
+class tgConstructWorker : public SGThread
+{
+public:
+    tgConstructWorker( const std::string& priorities_file, tgConstructScheduler& s, tgMutex* l );
+
+    // paths
+    void setPaths( const std::string& work, const std::string& dem, const std::string& share, const std::string& debug );
+
+private:
+    virtual void run();
+
+    tgConstructScheduler&   scheduler;
+    tgConstructFirst        first;
+    tgConstructSecond       second;
+};
+
+#endif // _TGCONSTRUCT_SCHEDULER_HXX
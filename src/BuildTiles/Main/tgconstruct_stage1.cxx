@@ -32,6 +32,8 @@
 #include <simgear/debug/logstream.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_cache.hxx>
+#include <terragear/tg_trace.hxx>
 
 #include "tgconstruct_stage1.hxx"
 
@@ -40,14 +42,16 @@ tgConstructFirst::tgConstructFirst( const std::string& pfile, SGLockedQueue<SGBu
         workQueue(q)
 {
     totalTiles = q.size();   
+    numFailed  = 0;
     lock = l;
 
     /* initialize tgMesh for the number of layers we have */
-    if ( areaDefs.init( pfile ) ) {
+    areaDefs = TGAreaDefinitions::load( pfile );
+    if ( !areaDefs ) {
         exit( -1 );
     }
 
-    std::vector<std::string> area_names = areaDefs.get_name_array();
+    std::vector<std::string> area_names = areaDefs->get_name_array();
     tileMesh.initPriorities( area_names );  
     tileMesh.setLock( lock );
 }
@@ -67,7 +71,7 @@ void tgConstructFirst::setPaths( const std::string& work, const std::string& dem
 
 void tgConstructFirst::safeMakeDirectory( const std::string& directory )
 {
-    lock->lock();
+    lock->lock( TG_MUTEX_SITE("stage1 mkdir") );
     std::string dummy = directory + "/dummy";
     SGPath sgp( dummy );
     sgp.create_dir( 0755 );
@@ -80,46 +84,69 @@ void tgConstructFirst::run()
 
     // as long as we have feometry to parse, do so
     while ( !workQueue.empty() ) {
-        bucket = workQueue.pop();
+        SGBucket b = workQueue.pop();
         tilesComplete = totalTiles - workQueue.size();
 
-        SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Stage1 Construct in " << bucket.gen_base_path() << " tile " << tilesComplete << " of " << totalTiles << " using thread " << current() );
+        SG_LOG(SG_GENERAL, SG_ALERT, b.gen_index_str() << " - Stage1 Construct in " << b.gen_base_path() << " tile " << tilesComplete << " of " << totalTiles << " using thread " << current() );
 
-        // assume non ocean tile until proven otherwise
-        isOcean = false;
+        if ( !construct( b ) ) {
+            numFailed++;
+        }
+    }
+
+    SG_LOG(SG_GENERAL, SG_DEBUG, bucket.gen_index_str() << " Thread " << current() << " finished");
+}
+
+bool tgConstructFirst::construct( const SGBucket& b )
+{
+    tgTrace::setTile( b.gen_index_str() );
+    TG_TRACE_SCOPE( "stage1" );
 
-        // clear mesh
-        tileMesh.clear();
+    bucket = b;
 
-        if ( !debugBase.empty() ) {
-            std::string debugPath = debugBase + "/tgconstruct_debug/stage1/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();                
-            safeMakeDirectory( debugPath );
+    // assume non ocean tile until proven otherwise
+    isOcean = false;
 
-            tileMesh.initDebug( debugPath );
-        }
+    // clear mesh
+    tileMesh.clear();
 
-        tileMesh.clipAgainstBucket( bucket );
+    if ( !debugBase.empty() ) {
+        std::string debugPath = debugBase + "/tgconstruct_debug/stage1/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();                
+        safeMakeDirectory( debugPath );
 
-        // STEP 1 - read in the polygon soup for this tile
+        tileMesh.initDebug( debugPath );
+    }
+
+    tileMesh.clipAgainstBucket( bucket );
+
+    // STEP 1 - read in the polygon soup for this tile
+    {
+        TG_TRACE_SCOPE( "loadLandclassPolys" );
         loadLandclassPolys( workBase );
+    }
 
-        // Step 2 - add the fitted nodes ( important elevation points )
-        // add them to the mesh - which adds them in triangulation
+    // Step 2 - add the fitted nodes ( important elevation points )
+    // add them to the mesh - which adds them in triangulation
+    {
+        TG_TRACE_SCOPE( "loadElevation" );
         loadElevation( demBase );
+    }
 
-        // generate the tile
-        tileMesh.generate();
+    // generate the tile
+    tileMesh.generate();
 
-        // save the intermediate data
-        std::string sharedPath = shareBase + "/stage1/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-        safeMakeDirectory( sharedPath );
+    // save the intermediate data
+    std::string sharedPath = shareBase + "/stage1/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
+    safeMakeDirectory( sharedPath );
 
-        lock->lock();
-        tileMesh.save( sharedPath );
-        lock->unlock();
+    // stage file i/o doesn't use GDAL - no need to lock.
+    // without the shared edges, the neighbors can't be matched - fail the tile
+    if ( !tileMesh.save( sharedPath ) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - failed to save stage1 data" );
+        return false;
     }
 
-    SG_LOG(SG_GENERAL, SG_DEBUG, bucket.gen_index_str() << " Thread " << current() << " finished");
+    return true;
 }
 
 int tgConstructFirst::loadLandclassPolys( const std::string& path )
@@ -150,7 +177,7 @@ int tgConstructFirst::loadLandclassPolys( const std::string& path )
                 for ( unsigned int i=0; i<polys.size(); i++ ) {
                     std::string material = polys[i].getMeta().getMaterial();
 
-                    int area = areaDefs.get_area_priority( material );                    
+                    int area = areaDefs->get_area_priority( material );                    
                     tileMesh.addPoly( area, polys[i] );
                 }
             }
@@ -169,22 +196,20 @@ int tgConstructFirst::loadLandclassPolys( const std::string& path )
 
 void tgConstructFirst::loadElevation( const std::string& path ) {        
     std::string array_path = path + "/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-    tgArray     array;
+    tgArrayRef  array;
 
-    if ( array.open(array_path) ) {
+    // stage 1 and stage 2 of the tile share the parsed array
+    if ( tgArrayCache::instance().get( array_path, bucket, array ) ) {
         std::vector<cgalPoly_Point>  elevationPoints;
 
         SG_LOG(SG_GENERAL, SG_DEBUG, "Opened Array file " << array_path);
 
-        array.parse( bucket );
-        array.remove_voids( );
-
-        std::vector<SGGeod> const& corner_list = array.get_corner_list();
+        std::vector<SGGeod> const& corner_list = array->get_corner_list();
         for (unsigned int i=0; i<corner_list.size(); i++) {
             elevationPoints.push_back( cgalPoly_Point(corner_list[i].getLongitudeDeg(), corner_list[i].getLatitudeDeg()) );
         }
 
-        std::vector<SGGeod> const& fit_list = array.get_fitted_list();
+        std::vector<SGGeod> const& fit_list = array->get_fitted_list();
         for (unsigned int i=0; i<fit_list.size(); i++) {
             elevationPoints.push_back( cgalPoly_Point(fit_list[i].getLongitudeDeg(), fit_list[i].getLatitudeDeg()) );
         }
@@ -207,7 +232,7 @@ void tgConstructFirst::addOceanPoly( void )
     pt[3] = cgalPoly_Point( bucket.get_corner( SG_BUCKET_NW ).getLongitudeDeg()-CORRECTION, bucket.get_corner( SG_BUCKET_NW ).getLatitudeDeg()+CORRECTION );    
 
     cgalPoly_Polygon poly( pt, pt+4 );
-    tgPolygonSetMeta meta(tgPolygonSetMeta::META_TEXTURED, areaDefs.get_ocean_area_name() );
+    tgPolygonSetMeta meta(tgPolygonSetMeta::META_TEXTURED, areaDefs->get_ocean_area_name() );
 
-    tileMesh.addPoly( areaDefs.get_ocean_area_priority(), tgPolygonSet( poly, meta ) );
+    tileMesh.addPoly( areaDefs->get_ocean_area_priority(), tgPolygonSet( poly, meta ) );
 }
\ No newline at end of file
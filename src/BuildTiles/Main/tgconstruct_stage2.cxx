@@ -32,6 +32,8 @@
 #include <simgear/debug/logstream.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_cache.hxx>
+#include <terragear/tg_trace.hxx>
 
 #include "tgconstruct_stage2.hxx"
 
@@ -40,14 +42,16 @@ tgConstructSecond::tgConstructSecond( const std::string& pfile, SGLockedQueue<SG
         workQueue(q)
 {
     totalTiles = q.size();
+    numFailed  = 0;
     lock = l;
 
     /* initialize tgMesh for the number of layers we have */
-    if ( areaDefs.init( pfile ) ) {
+    areaDefs = TGAreaDefinitions::load( pfile );
+    if ( !areaDefs ) {
         exit( -1 );
     }
 
-    std::vector<std::string> area_names = areaDefs.get_name_array();
+    std::vector<std::string> area_names = areaDefs->get_name_array();
     tileMesh.initPriorities( area_names );  
     tileMesh.setLock( lock );
 }
@@ -67,7 +71,7 @@ void tgConstructSecond::setPaths( const std::string& work, const std::string& de
 
 void tgConstructSecond::safeMakeDirectory( const std::string& directory )
 {
-    lock->lock();
+    lock->lock( TG_MUTEX_SITE("stage2 mkdir") );
     std::string dummy = directory + "/dummy";
     SGPath sgp( dummy );
     sgp.create_dir( 0755 );
@@ -80,61 +84,75 @@ void tgConstructSecond::run()
 
     // as long as we have feometry to parse, do so
     while ( !workQueue.empty() ) {
-        bucket = workQueue.pop();
+        SGBucket b = workQueue.pop();
         tilesComplete = totalTiles - workQueue.size();
 
-        SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Stage 2 Construct in " << bucket.gen_base_path() << " tile " << tilesComplete << " of " << totalTiles << " using thread " << current() );
+        SG_LOG(SG_GENERAL, SG_ALERT, b.gen_index_str() << " - Stage 2 Construct in " << b.gen_base_path() << " tile " << tilesComplete << " of " << totalTiles << " using thread " << current() );
 
-        // and clear
-        tileMesh.clear();
+        if ( !construct( b ) ) {
+            numFailed++;
+        }
+    }
+}
 
-        if ( !debugBase.empty() ) {
-            std::string debugPath = debugBase + "/tgconstruct_debug/stage2/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-            safeMakeDirectory( debugPath );
+bool tgConstructSecond::construct( const SGBucket& b )
+{
+    tgTrace::setTile( b.gen_index_str() );
+    TG_TRACE_SCOPE( "stage2" );
 
-            tileMesh.initDebug( debugPath );
-        }
+    bucket = b;
 
-        std::string sharedStage1Base = shareBase + "/stage1/";
+    // and clear
+    tileMesh.clear();
 
-        // STEP 1 - read in the stage 1 tile mesh triangulation, and the shared edge nodes - remesh to fit shared edges
-        isOcean = tileMesh.loadStage1( sharedStage1Base, bucket );
+    if ( !debugBase.empty() ) {
+        std::string debugPath = debugBase + "/tgconstruct_debug/stage2/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
+        safeMakeDirectory( debugPath );
 
-        if ( !isOcean ) {
+        tileMesh.initDebug( debugPath );
+    }
+
+    std::string sharedStage1Base = shareBase + "/stage1/";
+
+    // STEP 1 - read in the stage 1 tile mesh triangulation, and the shared edge nodes - remesh to fit shared edges
+    isOcean = tileMesh.loadStage1( sharedStage1Base, bucket );
+
+    if ( !isOcean ) {
 #if 0
-            // Step 2 - calculate elevation
-            tileMesh.calcElevation( demBase );
+        // Step 2 - calculate elevation
+        tileMesh.calcElevation( demBase );
 #endif
 
-            // save the intermediate data
-            std::string sharedStage2 = shareBase + "/stage2/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-            safeMakeDirectory( sharedStage2 );
+        // save the intermediate data
+        std::string sharedStage2 = shareBase + "/stage2/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
+        safeMakeDirectory( sharedStage2 );
 
-            lock->lock();
-            tileMesh.save2( sharedStage2 );
-            lock->unlock();
+        // stage file i/o doesn't use GDAL - no need to lock
+        if ( !tileMesh.save2( sharedStage2 ) ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - failed to save stage2 data" );
+            return false;
         }
     }
+
+    return true;
 }
 
 void tgConstructSecond::loadElevation( const std::string& path ) {        
     std::string array_path = path + "/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-    tgArray     array;
+    tgArrayRef  array;
 
-    if ( array.open(array_path) ) {
+    // stage 1 and stage 2 of the tile share the parsed array
+    if ( tgArrayCache::instance().get( array_path, bucket, array ) ) {
         std::vector<cgalPoly_Point>  elevationPoints;
 
         SG_LOG(SG_GENERAL, SG_DEBUG, "Opened Array file " << array_path);
 
-        array.parse( bucket );
-        array.remove_voids( );
-
-        std::vector<SGGeod> const& corner_list = array.get_corner_list();
+        std::vector<SGGeod> const& corner_list = array->get_corner_list();
         for (unsigned int i=0; i<corner_list.size(); i++) {
             elevationPoints.push_back( cgalPoly_Point(corner_list[i].getLongitudeDeg(), corner_list[i].getLatitudeDeg()) );
         }
 
-        std::vector<SGGeod> const& fit_list = array.get_fitted_list();
+        std::vector<SGGeod> const& fit_list = array->get_fitted_list();
         for (unsigned int i=0; i<fit_list.size(); i++) {
             elevationPoints.push_back( cgalPoly_Point(fit_list[i].getLongitudeDeg(), fit_list[i].getLatitudeDeg()) );
         }
@@ -47,6 +47,13 @@ public:
 
     // paths
     void setPaths( const std::string& work, const std::string& dem, const std::string& share, const std::string& debug );
+
+    // build a single bucket - used by run(), and by the tile scheduler.
+    // returns false if the bucket's stage2 data couldn't be saved
+    bool construct( const SGBucket& b );
+
+    // number of buckets run() failed to build
+    unsigned int getNumFailed( void ) const { return numFailed; }
     
 private:
     virtual void run();
@@ -60,11 +67,12 @@ private:
     void safeMakeDirectory( const std::string& directory );
 
 private:
-    TGAreaDefinitions           areaDefs;
+    TGAreaDefinitionsRef        areaDefs;   // shared by all threads
     
     // construct stage to perform
     SGLockedQueue<SGBucket>&    workQueue;
     unsigned int                totalTiles;
+    unsigned int                numFailed;
     
     // paths
     std::string                 workBase;
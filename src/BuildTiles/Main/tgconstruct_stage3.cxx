@@ -32,6 +32,7 @@
 #include <simgear/debug/logstream.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_trace.hxx>
 
 #include "tgconstruct_stage3.hxx"
 
@@ -43,11 +44,12 @@ tgConstructThird::tgConstructThird( const std::string& pfile, SGLockedQueue<SGBu
     lock = l;
     
     /* initialize tgMesh for the number of layers we have */
-    if ( areaDefs.init( pfile ) ) {
+    areaDefs = TGAreaDefinitions::load( pfile );
+    if ( !areaDefs ) {
         exit( -1 );
     }
 
-    std::vector<std::string> area_names = areaDefs.get_name_array();
+    std::vector<std::string> area_names = areaDefs->get_name_array();
     tileMesh.initPriorities( area_names );  
     tileMesh.setLock( lock );
 }
@@ -95,12 +97,15 @@ void tgConstructThird::run()
         if ( true
 #endif            
         ) {       
+            tgTrace::setTile( bucket.gen_index_str() );
+            TG_TRACE_SCOPE( "stage3" );
+
             if ( !debugBase.empty() ) {
                 SG_LOG(SG_GENERAL, SG_ALERT, " - Generate debug " );
                 
                 std::string debugPath = debugBase + "/tgconstruct_debug/stage2" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
 
-                lock->lock();
+                lock->lock( TG_MUTEX_SITE("stage3 debug mkdir") );
                 std::string dummy = debugPath + "/dummy";
                 SGPath sgp( dummy );
                 sgp.create_dir( 0755 );            
@@ -115,10 +120,16 @@ void tgConstructThird::run()
             SG_LOG(SG_GENERAL, SG_ALERT, bucket.gen_index_str() << " - Construct in " << bucket.gen_base_path() << " tile " << tilesComplete << " of " << totalTiles << " using thread " << current() );
 
             // STEP 1 - read in the stage 1 tile mesh triangulation, and the shared edge nodes - remesh to fit shared edges
-            loadMesh( sharedStage2Base );
+            {
+                TG_TRACE_SCOPE( "loadMesh" );
+                loadMesh( sharedStage2Base );
+            }
             
             // Step 2 - calculate elevation
-            tileMesh.calcFaceNormals();
+            {
+                TG_TRACE_SCOPE( "calcFaceNormals" );
+                tileMesh.calcFaceNormals();
+            }
             
             // and clear
             tileMesh.clear();
@@ -60,7 +60,7 @@ private:
     int loadMesh( const std::string& path );
 
 private:
-    TGAreaDefinitions           areaDefs;
+    TGAreaDefinitionsRef        areaDefs;   // shared by all threads
     
     // construct stage to perform
     SGLockedQueue<SGBucket>&    workQueue;
@@ -30,6 +30,8 @@
 #include <simgear/misc/strutils.hxx>
 #include <simgear/debug/logstream.hxx>
 
+#include <terragear/tg_array_raw.hxx>
+
 #include "dem.hxx"
 
 using std::cout;
@@ -456,6 +458,14 @@ TGDem::write_area( const string& root, SGBucket& b ) {
     }
     gzclose(fp);
 
+    // tgArray reads a raw array in preference to the .arr.gz - remove
+    // any left from an earlier chop, so the data just written is used
+    SGPath raw_file( path + "/" + b.gen_index_str() + TG_ARRAY_RAW_EXT );
+    if ( raw_file.exists() ) {
+        cout << "removing stale " << raw_file.str() << endl;
+        raw_file.remove();
+    }
+
     return true;
 }
 
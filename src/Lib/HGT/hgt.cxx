@@ -28,6 +28,7 @@
 #include <simgear/compiler.h>
 
 #include <stdlib.h>   // atof()
+#include <string.h>
 #include <iostream>
 
 #ifdef SG_HAVE_STD_INCLUDES
@@ -40,11 +41,8 @@
 #  include <direct.h>
 #endif
 
-#include <boost/foreach.hpp>
-
 #include <simgear/constants.h>
 #include <simgear/io/lowlevel.hxx>
-#include <simgear/misc/sg_dir.hxx>
 #include <simgear/debug/logstream.hxx>
 
 
@@ -58,6 +56,7 @@ using std::string;
 TGHgt::TGHgt( int _res ) 
 {
     hgt_resolution = _res;
+    fd = NULL;
 
     data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
     output_data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
@@ -67,6 +66,7 @@ TGHgt::TGHgt( int _res )
 TGHgt::TGHgt( int _res, const SGPath &file )
 {
     hgt_resolution = _res;
+    fd = NULL;
     data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
     output_data = new short int[MAX_HGT_SIZE][MAX_HGT_SIZE];
 
@@ -88,33 +88,23 @@ TGHgt::open ( const SGPath &f ) {
         }
     } else {
         if ( file_name.extension() == "zip" ) {
-            // extract the .zip file to /tmp and point the file name
-            // to the extracted file
-            tmp_dir = simgear::Dir::tempDir("hgt");
-            
-            cout << "Extracting " << file_name.str() << " to " << tmp_dir.path().str() << endl;
-            string command = "unzip -d \"" + tmp_dir.path().str() + "\" " + file_name.base();
-            if ( system( command.c_str() ) != -1 )
-            {
-                simgear::PathList files = tmp_dir.children(simgear::Dir::TYPE_FILE | simgear::Dir::NO_DOT_OR_DOTDOT);
-                BOOST_FOREACH(const SGPath& file, files) {
-                    string ext = file.lower_extension();
-                    if ( ext == "hgt" ) {
-                        file_name = file;
-                        break;
-                    }
-                }
-            
-                remove_tmp_file = true;
-                cout << "Proceeding with " << file_name.str() << endl;
-            } else {
-                SG_LOG(SG_GENERAL, SG_ALERT, "Failed to issue system call " << command );
-                exit(1);
+            // extract the .hgt member in memory, and point the file name
+            // at it so we get the origin from it
+            string member;
+
+            cout << "Extracting " << file_name.str() << endl;
+            if ( !extract_zip( file_name, member ) ) {
+                return false;
             }
+
+            cout << "Proceeding with " << member << endl;
+
+            fd = NULL;
+            file_name = SGPath( member );
         }
 
         cout << "Loading HGT data file: " << file_name.str() << endl;
-        if ( (fd = gzopen( file_name.c_str(), "rb" )) == NULL ) {
+        if ( zip_data.empty() && (fd = gzopen( file_name.c_str(), "rb" )) == NULL ) {
             SGPath file_name_gz = file_name;
             file_name_gz.append( ".gz" );
             if ( (fd = gzopen( file_name_gz.c_str(), "rb" )) == NULL ) {
@@ -145,7 +135,11 @@ TGHgt::open ( const SGPath &f ) {
 // close an HGT file
 bool
 TGHgt::close () {
-    gzclose(fd);
+    if ( fd ) {
+        gzclose(fd);
+        fd = NULL;
+    }
+    zip_data.clear();
     return true;
 }
 
@@ -166,20 +160,165 @@ TGHgt::load( ) {
         return false;
     }
 
-    short int *var;
+    // read the whole file in one go - it's big endian, rows from north
+    // to south.
+    std::vector<unsigned short> buf( size * size );
+    size_t bytes = buf.size() * sizeof(short);
+
+    if ( !zip_data.empty() ) {
+        if ( zip_data.size() != bytes ) {
+            cout << "ERROR: zip member is " << zip_data.size() << " bytes - expected " << bytes << endl;
+            return false;
+        }
+        memcpy( &buf[0], &zip_data[0], bytes );
+    } else if ( gzread( fd, &buf[0], bytes ) != (int)bytes ) {
+        return false;
+    }
+
+    if ( sgIsLittleEndian() ) {
+        // simple enough for the compiler to vectorize
+        unsigned short* p = &buf[0];
+        for ( size_t i = 0; i < buf.size(); ++i ) {
+            p[i] = (unsigned short)( (p[i] >> 8) | (p[i] << 8) );
+        }
+    }
+
     for ( int row = size - 1; row >= 0; --row ) {
+        const unsigned short* src = &buf[ (size - 1 - row) * size ];
         for ( int col = 0; col < size; ++col ) {
-            var = &data[col][row];
-            if ( gzread ( fd, var, sizeof(short) ) != sizeof(short) ) {
-                return false;
+            data[col][row] = (short)src[col];
+        }
+    }
+
+    return true;
+}
+
+// little endian fields of a zip header
+static unsigned int zipShort( const unsigned char* p )
+{
+    return p[0] | (p[1] << 8);
+}
+
+static unsigned int zipLong( const unsigned char* p )
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// extract the first .hgt member of a zip archive into zip_data.
+// SRTM archives hold a single member, either stored or deflated.
+bool
+TGHgt::extract_zip( const SGPath& zip_name, string& member ) {
+    std::vector<unsigned char> zip;
+
+    FILE* fp = fopen( zip_name.c_str(), "rb" );
+    if ( !fp ) {
+        cout << "ERROR: opening " << zip_name.str() << " for reading!" << endl;
+        return false;
+    }
+
+    fseek( fp, 0, SEEK_END );
+    long len = ftell( fp );
+    fseek( fp, 0, SEEK_SET );
+
+    if ( len > 0 ) {
+        zip.resize( len );
+        if ( fread( &zip[0], len, 1, fp ) != 1 ) {
+            zip.clear();
+        }
+    }
+    fclose( fp );
+
+    // find the end of central directory record - it's followed by a
+    // comment of up to 64K
+    long eocd = -1;
+    for ( long i = (long)zip.size() - 22; i >= 0 && i >= (long)zip.size() - 22 - 65535; --i ) {
+        if ( zipLong( &zip[i] ) == 0x06054b50 ) {
+            eocd = i;
+            break;
+        }
+    }
+
+    if ( eocd < 0 ) {
+        cout << "ERROR: " << zip_name.str() << " is not a zip archive" << endl;
+        return false;
+    }
+
+    unsigned int entries = zipShort( &zip[eocd + 10] );
+    size_t       pos     = zipLong( &zip[eocd + 16] );
+
+    for ( unsigned int e = 0; e < entries; ++e ) {
+        if ( pos + 46 > zip.size() || zipLong( &zip[pos] ) != 0x02014b50 ) {
+            break;
+        }
+
+        unsigned int method   = zipShort( &zip[pos + 10] );
+        size_t       csize    = zipLong( &zip[pos + 20] );
+        size_t       usize    = zipLong( &zip[pos + 24] );
+        unsigned int nameLen  = zipShort( &zip[pos + 28] );
+        unsigned int extraLen = zipShort( &zip[pos + 30] );
+        unsigned int commLen  = zipShort( &zip[pos + 32] );
+        size_t       local    = zipLong( &zip[pos + 42] );
+
+        if ( pos + 46 + nameLen > zip.size() ) {
+            break;
+        }
+
+        string name( (const char*)&zip[pos + 46], nameLen );
+        pos += 46 + nameLen + extraLen + commLen;
+
+        if ( SGPath( name ).lower_extension() != "hgt" ) {
+            continue;
+        }
+
+        // the local header has it's own name and extra field lengths
+        if ( local + 30 > zip.size() || zipLong( &zip[local] ) != 0x04034b50 ) {
+            break;
+        }
+
+        size_t start = local + 30 + zipShort( &zip[local + 26] ) + zipShort( &zip[local + 28] );
+        if ( start + csize > zip.size() ) {
+            break;
+        }
+
+        zip_data.resize( usize );
+
+        if ( method == 0 && csize == usize ) {
+            memcpy( &zip_data[0], &zip[start], usize );
+        } else if ( method == 8 ) {
+            // raw deflate stream - no zlib header
+            z_stream strm;
+            memset( &strm, 0, sizeof(strm) );
+
+            if ( inflateInit2( &strm, -MAX_WBITS ) != Z_OK ) {
+                zip_data.clear();
+                break;
             }
-            if ( sgIsLittleEndian() ) {
-                sgEndianSwap( (unsigned short int*)var);
+
+            strm.next_in   = &zip[start];
+            strm.avail_in  = csize;
+            strm.next_out  = (Bytef*)&zip_data[0];
+            strm.avail_out = usize;
+
+            int ret = inflate( &strm, Z_FINISH );
+            inflateEnd( &strm );
+
+            if ( ret != Z_STREAM_END || strm.total_out != usize ) {
+                cout << "ERROR: failed to inflate " << name << " from " << zip_name.str() << endl;
+                zip_data.clear();
+                return false;
             }
+        } else {
+            cout << "ERROR: " << name << " in " << zip_name.str() << " uses unsupported compression method " << method << endl;
+            zip_data.clear();
+            return false;
         }
+
+        member = SGPath( name ).file();
+        return true;
     }
 
-    return true;
+    cout << "ERROR: no hgt file found in " << zip_name.str() << endl;
+    return false;
 }
 
 
@@ -35,6 +35,7 @@
 #include <zlib.h>
 
 #include <string>
+#include <vector>
 
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/misc/sg_path.hxx>
@@ -49,12 +50,17 @@ private:
     // file pointer for input
     gzFile fd;
 
+    // hgt data extracted from a .zip archive
+    std::vector<char> zip_data;
+
     int hgt_resolution;
     
     // pointers to the actual grid data allocated here
     short int (*data)[MAX_HGT_SIZE];
     short int (*output_data)[MAX_HGT_SIZE];
 
+    bool extract_zip( const SGPath& zip_name, std::string& member );
+
 public:
 
     // Constructor, _res must be either "1" for the 1arcsec data or
@@ -26,12 +26,18 @@
 #endif
 
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdlib.h>
+#include <vector>
 #include <zlib.h>
 
 #include <simgear/compiler.h>
 #include <simgear/io/lowlevel.hxx>
 
+#include <terragear/tg_array_raw.hxx>
+
 #include "srtmbase.hxx"
 
 using std::cout;
@@ -45,6 +51,24 @@ TGSrtmBase::~TGSrtmBase()
     }
 }
 
+// hgtchop calls write_area from several threads.  Buckets are wider than
+// a degree above 83 degrees latitude, so more than one hgt file can feed
+// the same bucket - writers of the same bucket take turns
+static std::mutex& bucketLock( long int index )
+{
+    static std::mutex                                       mapLock;
+    static std::map< long int, std::unique_ptr<std::mutex> > locks;
+
+    std::lock_guard<std::mutex> guard( mapLock );
+
+    std::unique_ptr<std::mutex>& lock = locks[index];
+    if ( !lock ) {
+        lock.reset( new std::mutex );
+    }
+
+    return *lock;
+}
+
 // write out the area of data covered by the specified bucket.  Data
 // is written out column by column starting at the lower left hand
 // corner.
@@ -95,11 +119,17 @@ TGSrtmBase::write_area( const string& root, SGBucket& b ) {
     string path = root + "/" + base;
     SGPath sgp( path );
     sgp.append( "dummy" );
-    sgp.create_dir( 0755 );
+    {
+        // hgtchop threads share the parent directories
+        static std::mutex dirLock;
+        std::lock_guard<std::mutex> guard( dirLock );
+        sgp.create_dir( 0755 );
+    }
 
-    string array_file = path + "/" + b.gen_index_str() + ".arr.gz";
+    string array_file = path + "/" + b.gen_index_str() + TG_ARRAY_RAW_EXT;
     cout << "array_file = " << array_file << endl;
 
+    std::lock_guard<std::mutex> guard( bucketLock( b.gen_index() ) );
     write_area_bin(array_file, start_x, start_y, min_x, min_y,
         span_x, span_y, col_step, row_step);
 
@@ -110,25 +140,20 @@ bool TGSrtmBase::write_area_bin(const SGPath& aPath, int start_x, int start_y,
     int min_x, int min_y,
     int span_x, int span_y, int col_step, int row_step)
 {
-    gzFile fp;
-    if ( (fp = gzopen( aPath.c_str(), "wb9" )) == NULL ) {
-	    cout << "ERROR:  cannot open " << aPath.str() << " for writing!" << endl;
-	    return false;
-    }
-
-    int32_t header = 0x54474152; // 'TGAR'
-    sgWriteLong(fp, header);
-    sgWriteInt(fp, min_x); sgWriteInt(fp, min_y);
-    sgWriteInt(fp, span_x + 1); sgWriteInt(fp, col_step);
-    sgWriteInt(fp, span_y + 1); sgWriteInt(fp, row_step);
-
+    // raw arrays are column major
+    std::vector<short> data;
+    data.reserve( (span_x + 1) * (span_y + 1) );
     for ( int i = start_x; i <= start_x + span_x; ++i ) {
 	    for ( int j = start_y; j <= start_y + span_y; ++j ) {
-            sgWriteShort(fp, height(i,j));
+            data.push_back( height(i,j) );
 	    }
     }
 
-    gzclose(fp);
+    if ( !tgArrayRawWrite( aPath.str(), min_x, min_y, span_x + 1, col_step, span_y + 1, row_step, &data[0], compress_level ) ) {
+	    cout << "ERROR:  cannot write " << aPath.str() << endl;
+	    return false;
+    }
+
     return true;
 }
 
@@ -36,7 +36,7 @@
 class TGSrtmBase {
 
 protected:
-    TGSrtmBase() : remove_tmp_file(false)
+    TGSrtmBase() : remove_tmp_file(false), compress_level(0)
     {}
 
     ~TGSrtmBase();
@@ -53,8 +53,15 @@ protected:
     bool remove_tmp_file;
     simgear::Dir tmp_dir;
 
+    // zlib level of the written arrays
+    int compress_level;
+
 public:
 
+    // 0 ( the default ) writes uncompressed arrays, which are mapped
+    // rather than read.  1-9 compress them
+    void set_compress_level( int level ) { compress_level = level; }
+
     // write out the area of data covered by the specified bucket.
     // Data is written out column by column starting at the lower left
     // hand corner.
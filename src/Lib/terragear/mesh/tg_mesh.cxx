@@ -1,7 +1,11 @@
 #include <simgear/debug/logstream.hxx>
 
+#include <terragear/tg_trace.hxx>
+
 #include "tg_mesh.hxx"
 
+#define DEBUG_STAGE_SHAPEFILES              (0)     // also save stage data as shapefiles ( for QGIS )
+
 void tgMesh::initPriorities( const std::vector<std::string>& names )
 {
     meshArrangement.initPriorities( names );
@@ -55,11 +59,17 @@ void tgMesh::generate( void )
     // mesh generation from polygon soup :)
     if ( !meshArrangement.empty() ) {
         // Step 1 - clip polys against one another - highest priority first ( on top )
-        meshArrangement.clipPolys( b, clipBucket );
+        {
+            TG_TRACE_SCOPE( "clipPolys" );
+            meshArrangement.clipPolys( b, clipBucket );
+        }
 
         // Step 2 - insert clipped polys into an arrangement.
         // From this point on, we don't need the individual polygons.
-        meshArrangement.arrangePolys();
+        {
+            TG_TRACE_SCOPE( "arrangePolys" );
+            meshArrangement.arrangePolys();
+        }
 
         // step 3 - clean up the arrangement - cluster nodes that are too close - don't want
         // really small triangles blowing up the refined mesh.
@@ -68,12 +78,19 @@ void tgMesh::generate( void )
         // we should remember be checking the delta in interiorPoints to see if we have 
         // polys that don't meat this criteria.
         // and if it doesn't - what do we do?
-        meshArrangement.cleanArrangement( lock );
+        {
+            TG_TRACE_SCOPE( "cleanArrangement" );
+            meshArrangement.cleanArrangement();
+        }
 
         // step 4 - create constrained triangulation with arrangement edges as the constraints
-        meshTriangulation.constrainedTriangulateWithEdgeModification( meshArrangement );
+        {
+            TG_TRACE_SCOPE( "triangulate" );
+            meshTriangulation.constrainedTriangulateWithEdgeModification( meshArrangement );
+        }
 
         // step 5 - prepare for serialization
+        TG_TRACE_SCOPE( "prepareTds" );
         meshTriangulation.prepareTds();
     } else {
         SG_LOG(SG_GENERAL, SG_ALERT, "no source polys" );        
@@ -87,29 +104,37 @@ bool tgMesh::loadStage1( const std::string& basePath, const SGBucket& bucket )
     b = bucket;
 
     // now load the stage1 triangulation ( and lookup locations on the edges )
-    if ( !meshTriangulation.loadTriangulation( basePath, bucket ) ) {
+    bool hasLand;
+    {
+        TG_TRACE_SCOPE( "loadTriangulation" );
+        hasLand = meshTriangulation.loadTriangulation( basePath, bucket );
+    }
+
+    if ( !hasLand ) {
         isOcean = true;
     } else {
-        meshTriangulation.prepareTds();
+        {
+            TG_TRACE_SCOPE( "prepareTds" );
+            meshTriangulation.prepareTds();
+        }
 
         // load the arrangement so we know what material each triangle is.
+        TG_TRACE_SCOPE( "loadArrangement" );
         meshArrangement.loadArrangement( bucketPath );
     }
 
     return isOcean;
 }
 
-tgArray* tgMesh::loadElevationArray( const std::string& demBase, const SGBucket& bucket )
+tgArrayRef tgMesh::loadElevationArray( const std::string& demBase, const SGBucket& bucket )
 {
     std::string arrayPath = demBase + "/" + bucket.gen_base_path() + "/" + bucket.gen_index_str();
-    tgArray* array = new tgArray();
+    tgArrayRef  array;
 
-    if ( array->open(arrayPath) ) {
+    // neighbor arrays are shared with the tiles around us - only the first
+    // to ask actually reads the file
+    if ( tgArrayCache::instance().get( arrayPath, bucket, array ) ) {
         SG_LOG(SG_GENERAL, SG_INFO, "Opened Array file " << arrayPath);
-
-        array->parse( bucket );
-        array->remove_voids( );
-        array->close();
     } else {
         SG_LOG(SG_GENERAL, SG_INFO, "Could not open Array file " << arrayPath);
     }
@@ -121,7 +146,7 @@ tgArray* tgMesh::loadElevationArray( const std::string& demBase, const SGBucket&
 void tgMesh::calcElevation( const std::string& basePath )
 {
     // load this, and surrounding tile elevation data
-    std::vector<tgArray*> northArrays;
+    std::vector<tgArrayRef> northArrays;
     std::vector<SGBucket> northBuckets;
     b.siblings( -1, 1, northBuckets );
     b.siblings(  0, 1, northBuckets );
@@ -130,7 +155,7 @@ void tgMesh::calcElevation( const std::string& basePath )
         northArrays.push_back( loadElevationArray( basePath, northBuckets[i] ) );
     }
 
-    std::vector<tgArray*> southArrays;
+    std::vector<tgArrayRef> southArrays;
     std::vector<SGBucket> southBuckets;
     b.siblings( -1, -1, southBuckets );
     b.siblings(  0, -1, southBuckets );
@@ -140,15 +165,15 @@ void tgMesh::calcElevation( const std::string& basePath )
     }
 
     // SGBucket eastBucket = b.sibling( 1, 0);
-    // tgArray* eastArray = loadElevationArray( basePath, eastBucket );
+    // tgArrayRef eastArray = loadElevationArray( basePath, eastBucket );
 
     // SGBucket westBucket = b.sibling(-1, 0);
-    // tgArray* westArray = loadElevationArray( basePath, westBucket );
+    // tgArrayRef westArray = loadElevationArray( basePath, westBucket );
 
-    tgArray* tileArray = loadElevationArray( basePath, b );
+    tgArrayRef tileArray = loadElevationArray( basePath, b );
 
     // first calc the elevation of all nodes in this tile.
-    meshTriangulation.calcTileElevations( tileArray );
+    meshTriangulation.calcTileElevations( tileArray.get() );
 
 #if 0 // shared edges - is it needed?
 
@@ -231,17 +256,57 @@ void tgMesh::calcFaceNormals( void )
 }
 
 
-void tgMesh::save( const std::string& path ) const
+bool tgMesh::save( const std::string& path ) const
 {
+    TG_TRACE_SCOPE( "save" );
+    tgMeshStageWriter stageFile;
+
+    // shared edges first - each in its own file for the neighbor tiles
+    if ( !meshTriangulation.saveSharedEdgeFiles( path ) ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMesh::save - failed to save shared edges to " << path );
+        return false;
+    }
+
+    meshArrangement.toStageFile( stageFile );
+    meshTriangulation.saveTds( stageFile );
+
+    if ( !stageFile.write( path + "/" + TG_STAGE_FILE_NAME ) ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMesh::save - failed to save stage file to " << path );
+        return false;
+    }
+
+#if DEBUG_STAGE_SHAPEFILES
+    // GDAL is not threadsafe
+    lock->lock( TG_MUTEX_SITE("stage1 debug shapefiles") );
     meshArrangement.toShapefile( path, "stage1_arrangement" );
     meshTriangulation.saveSharedEdgeNodes( path );
     meshTriangulation.saveTds( path );
+    lock->unlock();
+#endif
+
+    return true;
 }
 
-void tgMesh::save2( const std::string& path ) const
+bool tgMesh::save2( const std::string& path ) const
 {
+    TG_TRACE_SCOPE( "save" );
+    tgMeshStageWriter stageFile;
+
+    meshTriangulation.saveTds( stageFile );
+
+    if ( !stageFile.write( path + "/" + TG_STAGE_FILE_NAME ) ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMesh::save2 - failed to save stage file to " << path );
+        return false;
+    }
+
+#if DEBUG_STAGE_SHAPEFILES
+    lock->lock( TG_MUTEX_SITE("stage2 debug shapefiles") );
     meshTriangulation.saveTds( path );
+    lock->unlock();
+#endif
 
     // generate edge node list
     // meshTriangulation.saveSharedEdgeFaces( path );
+
+    return true;
 }
@@ -6,9 +6,11 @@
 #include <terragear/polygon_set/tg_polygon_def.hxx>
 #include <terragear/polygon_set/tg_polygon_set.hxx>
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_cache.hxx>
 #include <terragear/tg_mutex.hxx>
 
 #include "tg_mesh_def.hxx"
+#include "tg_mesh_stage_file.hxx"
 
 #include "tg_mesh_arrangement.hxx"
 #include "tg_mesh_triangulation.hxx"
@@ -53,8 +55,8 @@ public:
 
     void toShapefiles( const char* dataset ) const;
 
-    void save( const std::string& path ) const;
-    void save2( const std::string& path ) const;
+    bool save( const std::string& path ) const;
+    bool save2( const std::string& path ) const;
 
     std::string getDebugPath( void ) { return debugPath; }
     SGBucket    getBucket( void )    { return b; }
@@ -63,7 +65,7 @@ public:
     friend class tgMeshTriangulation;
 
 private:
-    tgArray* loadElevationArray( const std::string& demBase, const SGBucket& bucket );
+    tgArrayRef loadElevationArray( const std::string& demBase, const SGBucket& bucket );
 
     void saveIncidentFaces( const std::string& path, const char* layer, const std::vector<meshTriVertexHandle>& vertexes ) const;
 
@@ -164,13 +164,16 @@ void tgMeshArrangement::arrangePolys( void )
     }
 
     // then add the elevation points
-    //mesh->lock->lock();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->lock( TG_MUTEX_SITE("arrangement points") );
+#endif
     std::vector<cgalPoly_Point>::iterator spit;
     for ( spit = sourcePoints.begin(); spit != sourcePoints.end(); spit++ ) {
         CGAL::insert_point( meshArr, toMeshArrPoint(*spit) );
-        //CGAL::insert_point( meshArr, *spit );
     }
-    //mesh->lock->unlock();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->unlock();
+#endif
 
 #if DEBUG_MESH_CLEANING    
     toShapefile( mesh->getDebugPath(), "arr_raw" );
@@ -179,24 +182,79 @@ void tgMeshArrangement::arrangePolys( void )
     meshPointLocation.attach( meshArr );
 }
 
+// add a face / metadata pair to the lookup table.  if a face is found
+// from more than one query point, the first one wins
+void tgMeshArrangement::addFaceMeta( meshArrFaceConstHandle f, const cgalPoly_Point& qp, const tgPolygonSetMeta& meta )
+{
+    if ( !faceLookup.is_defined( f ) ) {
+        faceLookup[f] = metaLookup.size();
+    }
+    metaLookup.push_back( tgMeshFaceMeta( f, qp, meta ) );
+}
+
+// map the inexact position of every vertex back to the vertex.  Two exact
+// points rounding to the same double are ambiguous - drop them, and let
+// the caller fall back to point location
+void tgMeshArrangement::buildVertexLookup( void )
+{
+    meshArrVertexConstIterator  vit;
+    std::vector<meshTriPoint>   ambiguous;
+
+    vertexLookup.clear();
+    vertexLookup.reserve( meshArr.number_of_vertices() );
+
+    for ( vit = meshArr.vertices_begin(); vit != meshArr.vertices_end(); vit++ ) {
+        meshTriPoint pt = toMeshTriPoint( vit->point() );
+        if ( !vertexLookup.insert( std::make_pair( pt, (meshArrVertexConstHandle)vit ) ).second ) {
+            ambiguous.push_back( pt );
+        }
+    }
+
+    for ( unsigned int i=0; i<ambiguous.size(); i++ ) {
+        vertexLookup.erase( ambiguous[i] );
+    }
+}
+
 // lookup a face in the arrangement from a face in the arrangement
 // seems silly, but we are looking for just faces that are in the 
 // lookup table.
 meshArrFaceConstHandle tgMeshArrangement::findPolyFace( meshArrFaceConstHandle f ) const
 {
     meshArrFaceConstHandle face = (meshArrFaceConstHandle)NULL;
-    bool found = false;
 
-    for ( unsigned int i=0; i<metaLookup.size() && !found; i++ ) {
-        if ( metaLookup[i].face == f ) {
-            face = f;
-            found = true;
-        }
+    if ( faceLookup.is_defined( f ) ) {
+        face = f;
     }
 
     return face;
 }
 
+// lookup the face to the left of the arrangement edge from source to target.
+// returns false if source to target is not an edge in the arrangement 
+// ( a constraint split by the mesher, or an ambiguous vertex ).
+// face is set to NULL if the edge exists, but the face isn't in the lookup table
+bool tgMeshArrangement::findEdgeFace( const meshTriPoint& source, const meshTriPoint& target, meshArrFaceConstHandle& face ) const
+{
+    tgMeshArrVertexLookup::const_iterator sit = vertexLookup.find( source );
+    tgMeshArrVertexLookup::const_iterator tit = vertexLookup.find( target );
+
+    if ( sit == vertexLookup.end() || tit == vertexLookup.end() || tit->second->is_isolated() ) {
+        return false;
+    }
+
+    // circulate the halfedges directed into target
+    meshArrIncidentHalfedgeConstCirculator first = tit->second->incident_halfedges();
+    meshArrIncidentHalfedgeConstCirculator curr  = first;
+    do {
+        if ( curr->source() == sit->second ) {
+            face = findPolyFace( curr->face() );
+            return true;
+        }
+    } while ( ++curr != first );
+
+    return false;
+}
+
 // lookup a face in the arrangement from a point in the triangulation
 // need to convert the point from EPICK to EPECK
 meshArrFaceConstHandle tgMeshArrangement::findMeshFace( const meshTriPoint& tPt ) const
@@ -251,9 +309,13 @@ void tgMeshArrangement::arrangementInsert( const std::vector<tgPolygonSet>::iter
     // convert poly segs to arr segs
     toMeshArrSegs( segs, arrSegs );
 
-    mesh->lock->lock();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->lock( TG_MUTEX_SITE("arrangement insert") );
+#endif
     CGAL::insert( meshArr, arrSegs.begin(), arrSegs.end() );
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
     mesh->lock->unlock();
+#endif
 }
 
 void tgMeshArrangement::loadArrangement( const std::string& path )
@@ -261,17 +323,24 @@ void tgMeshArrangement::loadArrangement( const std::string& path )
     // the arrangement is a set of polygons - with a query point so we can find the face 
     // once the arrangement is set.
     std::vector<meshArrSegment> edgelist;
-    std::string filePath;
+    tgMeshStageReader stageFile;
 
-    filePath = path + "/stage1_arrangement_faces.shp";
-    fromShapefile( filePath, edgelist );
+    if ( !stageFile.open( path + "/" + TG_STAGE_FILE_NAME ) || !fromStageFile( stageFile, edgelist ) ) {
+        // stage1 data from before the stage file
+        edgelist.clear();
+        fromShapefile( path + "/stage1_arrangement_faces.shp", edgelist );
+    }
 
     // add edges to arrangement
     meshArr.clear();
 
-    mesh->lock->lock();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->lock( TG_MUTEX_SITE("arrangement load") );
+#endif
     CGAL::insert( meshArr, edgelist.begin(), edgelist.end() );
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
     mesh->lock->unlock();
+#endif
 
     // save it so we can see it...
     // toShapefile( mesh->getDebugPath(), "stage2_arrangement" );
@@ -2,6 +2,9 @@
 #define __TG_MESH_ARRANGEMENT_HXX__
 
 #include <mutex>
+#include <unordered_map>
+
+#include <CGAL/Unique_hash_map.h>
 
 #include "tg_mesh.hxx"
 
@@ -18,6 +21,17 @@ public:
     tgPolygonSetMeta        meta;
 };
 
+// hash the inexact coordinates of an arrangement vertex
+struct tgMeshTriPointHash
+{
+    std::size_t operator()( const meshTriPoint& p ) const {
+        std::size_t h = std::hash<double>()( p.x() );
+        return h ^ ( std::hash<double>()( p.y() ) + 0x9e3779b9 + (h << 6) + (h >> 2) );
+    }
+};
+
+typedef std::unordered_map<meshTriPoint, meshArrVertexConstHandle, tgMeshTriPointHash> tgMeshArrVertexLookup;
+
 ////////////////////// sharp angle ( spike ) removal. /////////////////////////////////
 struct tgSharpAngle
 {
@@ -42,7 +56,7 @@ typedef std::vector<tgSharpAngleSeries>   tgSharpAngleSeriesList;
 class tgMeshArrangement
 {
 public:
-    tgMeshArrangement( tgMesh* m ) { mesh = m; }
+    tgMeshArrangement( tgMesh* m ) : meshArr(&meshTraits), faceLookup(-1) { mesh = m; }
 
     typedef enum {
         SRC_POINT_OK        = 0,
@@ -53,6 +67,8 @@ public:
     void clear( void ) {
         meshArr.clear();
         metaLookup.clear();
+        faceLookup.clear();
+        vertexLookup.clear();
 
         // clear source polys
         for ( unsigned int i=0; i<numPriorities; i++ ) {
@@ -71,7 +87,7 @@ public:
     tgPolygonSet join( unsigned int priority, const tgPolygonSetMeta& meta );
 
     void clipPolys( const SGBucket& b, bool clipBucket );
-    void cleanArrangement( std::mutex* lock );
+    void cleanArrangement( void );
     void arrangePolys( void );
 
     void loadArrangement( const std::string& path );
@@ -80,6 +96,7 @@ public:
     void getSegments( std::vector<meshTriSegment>& constraints ) const;
 
     meshArrFaceConstHandle findPolyFace( meshArrFaceConstHandle f ) const;
+    bool findEdgeFace( const meshTriPoint& source, const meshTriPoint& target, meshArrFaceConstHandle& face ) const;
     meshArrFaceConstHandle findMeshFace( const meshArrPoint& pt) const;
     meshArrFaceConstHandle findMeshFace( const meshTriPoint& pt) const;
 
@@ -103,7 +120,10 @@ private:
     void addSharpAngle( std::vector<tgSharpAngle>& angles, meshArrVertexHandle v1, meshArrVertexHandle v2, meshArrVertexHandle v3, double angle );
     void findSpikes( meshArrFaceHandle f, std::vector<tgSharpAngle>& angles, std::vector<meshArrHalfedgeHandle>& dups );
 
-    void doSnapRound( std::mutex* lock );
+    void doSnapRound( void );
+
+    void addFaceMeta( meshArrFaceConstHandle f, const cgalPoly_Point& qp, const tgPolygonSetMeta& meta );
+    void buildVertexLookup( void );
 
     meshArrPoint toMeshArrPoint( const meshTriPoint& tPoint ) const {
         return meshArrPoint( tPoint.x(), tPoint.y() );
@@ -127,6 +147,9 @@ public:
     void toShapefile( const std::string& datasource, const char* layer ) const;
     void fromShapefile( const std::string& filename, std::vector<meshArrSegment>& segments ) const;
 
+    void toStageFile( tgMeshStageWriter& stageFile ) const;
+    bool fromStageFile( tgMeshStageReader& stageFile, std::vector<meshArrSegment>& segments ) const;
+
 private:
     // helper - save a segment
     void toShapefile( OGRLayer* poLayer, const meshArrSegment& seg, const char* desc ) const;
@@ -148,9 +171,17 @@ private:
     std::vector<tgPolygonSetList>   sourcePolys;
     std::vector<cgalPoly_Point>     sourcePoints;
 
+    // traits must be declared before the arrangement that uses them
+    meshArrTraits                   meshTraits;
     meshArrangement                 meshArr;
     meshArrLandmarks_pl             meshPointLocation;
     std::vector<tgMeshFaceMeta>     metaLookup;
+
+    // built once the arrangement is clean - face handle to metaLookup index,
+    // and inexact point to vertex, so the triangulation can find the face
+    // across a constraint without point location
+    CGAL::Unique_hash_map<meshArrFaceConstHandle, int> faceLookup;
+    tgMeshArrVertexLookup           vertexLookup;
 };
 
 #endif /* __TG_MESH_ARRANGEMENT_HXX__ */
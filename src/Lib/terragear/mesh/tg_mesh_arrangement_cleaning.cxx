@@ -62,7 +62,7 @@ bool tgMeshArrangement::isEdgeVertex( meshArrVertexConstHandle v )
 
 // Use Lloyd Voronoi relaxation to cluster and 
 // remove nodes too close to one another.
-void tgMeshArrangement::cleanArrangement( std::mutex* lock )
+void tgMeshArrangement::cleanArrangement( void )
 {
     SG_LOG( SG_GENERAL, SG_DEBUG, "tgMeshArrangement::cleanArrangment : start" );
 
@@ -79,10 +79,15 @@ void tgMeshArrangement::cleanArrangement( std::mutex* lock )
         nodes.push_back( tgClusterNode( toCpPoint(vit->point()), isEdgeVertex(vit) ) );
     }
 
-    // create the cluster : not thread safe
-    lock->lock();
+    // create the cluster : reentrant, but the kd-trees hold lazy exact
+    // points - only safe to share between threads with CGAL_HAS_THREADS
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->lock( TG_MUTEX_SITE("cluster") );
+#endif
     tgCluster cluster( nodes, 0.0000025, mesh->debugPath );
-    lock->unlock();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->unlock();
+#endif
 
 #if DEBUG_MESH_CLEANING
     cluster.toShapefile( mesh->getDebugPath().c_str(), "cluster" );
@@ -104,7 +109,7 @@ void tgMeshArrangement::cleanArrangement( std::mutex* lock )
 
     // clean 3 - remove skinny faces
     // doRemoveSmallAreas();
-    // doRemoveSpikes( lock );
+    // doRemoveSpikes( mesh->lock );
 
     // clean 3
     // clustering may have moved an edge too close to a vertex - 
@@ -113,7 +118,13 @@ void tgMeshArrangement::cleanArrangement( std::mutex* lock )
     // getting them back is tricky.
     // maybe mark edges as 'special?
     // let's try without, first.
-    doSnapRound( lock );
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->lock( TG_MUTEX_SITE("snap round") );
+#endif
+    doSnapRound();
+#if !TG_MESH_THREAD_CONFINED_ARRANGEMENT
+    mesh->lock->unlock();
+#endif
 
     // clean 4
     doRemoveAntenna();
@@ -161,7 +172,7 @@ void tgMeshArrangement::cleanArrangement( std::mutex* lock )
                     if (CGAL::assign(f, obj)) {
                         // point is in face - set the material, and the query point, so we can save it
                         if ( !f->is_unbounded() ) {
-                            metaLookup.push_back( tgMeshFaceMeta(f, queryPoints[i], pit->getMeta() ) );
+                            addFaceMeta( f, queryPoints[i], pit->getMeta() );
                         } else {
                             SG_LOG( SG_GENERAL, SG_INFO, "tgMesh::tgMesh - POINT " << i << " queryPoint found on unbounded FACE!" );
 #if DEBUG_MESH_CLEANING
@@ -187,6 +198,8 @@ void tgMeshArrangement::cleanArrangement( std::mutex* lock )
     GDALClose( poDs );    
 #endif
 
+    buildVertexLookup();
+
     SG_LOG( SG_GENERAL, SG_DEBUG, "tgMesh::cleanArrangment Complete" );
 
 #if DEBUG_MESH_CLEANING
@@ -224,3 +224,72 @@ void tgMeshArrangement::fromShapefile( const std::string& filename, std::vector<
     
     GDALClose( poDS );    
 }
+
+// save the faces with their query points - the same data as the stage1_arrangement_faces layer
+void tgMeshArrangement::toStageFile( tgMeshStageWriter& stageFile ) const
+{
+    std::vector<tgStagePoint>   points;
+    std::vector<tgStageArrFace> faces;
+
+    for ( unsigned int i=0; i<metaLookup.size(); i++ ) {
+        meshArrFaceConstHandle f = metaLookup[i].face;
+
+        if ( f->has_outer_ccb() ) {
+            meshArrHalfedgeConstCirculator ccb = f->outer_ccb();
+            meshArrHalfedgeConstCirculator cur = ccb;
+            tgStageArrFace                 face;
+
+            face.qpx   = CGAL::to_double( metaLookup[i].point.x() );
+            face.qpy   = CGAL::to_double( metaLookup[i].point.y() );
+            face.first = points.size();
+
+            do {
+                tgStagePoint pt;
+
+                pt.x = CGAL::to_double( cur->source()->point().x() );
+                pt.y = CGAL::to_double( cur->source()->point().y() );
+                points.push_back( pt );
+
+                cur++;
+            } while ( cur != ccb );
+
+            face.count = points.size() - face.first;
+            faces.push_back( face );
+        } else {
+            SG_LOG(SG_GENERAL, SG_ALERT, "face has no outer ccb");
+        }
+    }
+
+    stageFile.addChunk( TG_STAGE_ARR_POINTS, points );
+    stageFile.addChunk( TG_STAGE_ARR_FACES,  faces );
+}
+
+bool tgMeshArrangement::fromStageFile( tgMeshStageReader& stageFile, std::vector<meshArrSegment>& segments ) const
+{
+    std::vector<tgStagePoint>   points;
+    std::vector<tgStageArrFace> faces;
+
+    if ( !stageFile.getChunk( TG_STAGE_ARR_POINTS, points ) ||
+         !stageFile.getChunk( TG_STAGE_ARR_FACES,  faces ) ) {
+        return false;
+    }
+
+    for ( unsigned int i=0; i<faces.size(); i++ ) {
+        if ( faces[i].first + faces[i].count > points.size() ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "tgMeshArrangement::fromStageFile - face " << i << " out of range" );
+            return false;
+        }
+
+        // close the ring
+        for ( unsigned int j=0; j<faces[i].count; j++ ) {
+            const tgStagePoint& src = points[faces[i].first + j];
+            const tgStagePoint& trg = points[faces[i].first + (j+1) % faces[i].count];
+
+            if ( src.x != trg.x || src.y != trg.y ) {
+                segments.push_back( meshArrSegment( meshArrPoint( src.x, src.y ), meshArrPoint( trg.x, trg.y ) ) );
+            }
+        }
+    }
+
+    return true;
+}
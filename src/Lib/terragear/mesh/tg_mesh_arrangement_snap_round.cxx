@@ -1,89 +1,208 @@
-#include <CGAL/Snap_rounding_traits_2.h>
-#include <CGAL/Snap_rounding_2.h>
+#include <algorithm>
+#include <cmath>
+#include <map>
 
-#include <mutex>
+#include <CGAL/intersections.h>
 
 #include <simgear/debug/logstream.hxx>
 
 #include "tg_mesh.hxx"
 
-// snap rounding looks like it causes more issues than it solves.
-// currently unused.
-// a few issues:
-// 1 - cgal translates points to the center of the pixel.  
-//     I wish we could snap to the sw corner of the pixel.
-//     We need to translate all points sw by 1/2 pixel size after snap rounding
-// 2 - it looks like if we are on the pixel border, we sometimes translate
-//     'the wrong way' making tile edge in the incorrect position.
-//     I found this when tile matching broke for just a few tiles 
-//     ( I beleive this is due to fp roundoff errors )
-// 3 - CGAL snaprounding is apparently not threadsafe - I had to protect the whole 
-//     procedure with a mutex.
-
-// instead of snaprounding, we remove small areas, then small angles ( spikes )
-// not as simple to code, but hopefully doesn't cause as many issues.
-
-typedef CGAL::Snap_rounding_traits_2<meshArrKernel> srTraits;
-typedef std::list<meshArrSegment>                   srSegmentList;
-typedef std::vector<meshArrPoint>                   srPointList;
-typedef std::list<meshArrPoint>                     srPolyline;
-typedef std::list<srPolyline>                       srPolylineList;
-
-void tgMeshArrangement::doSnapRound( std::mutex* lock )
+// hot pixel snap rounding
+//
+// The CGAL snap rounding package is not threadsafe, and had to be protected
+// by the global lock - serializing the cleaning of every tile.  It also
+// rounds to the pixel center, so the result had to be translated back 1/2
+// pixel, and points on a pixel border sometimes went 'the wrong way' making
+// the tile edge move ( tile matching broke for a few tiles ).
+//
+// This is a reentrant implementation - all data lives on the stack of the
+// calling thread, and points snap directly to the sw corner of their pixel.
+// The lazy exact points are still only thread safe with CGAL_HAS_THREADS -
+// without it, cleanArrangement keeps snap rounding under the global lock.
+//
+// The input is an arrangement, so edges only intersect at vertices.
+// This means the hot pixels are exactly the pixels containing a vertex.
+// Each edge is rerouted through the snapped corners of the hot pixels it
+// passes through, in order from source to target.
+//
+// hot pixels are binned in a coarse grid so an edge only needs to test the
+// pixels in the bins it crosses.
+
+#define SR_PIXELS_PER_DEG   (5000000.0)     // 0.0000002 degree pixels
+#define SR_BIN_PIXELS       (64)            // pixels per hot pixel bin
+#define SR_BORDER_EPSILON   (0.000001)      // fraction of a pixel considered 'on' a pixel border
+
+typedef meshArrKernel::Iso_rectangle_2          srPixelRect;
+typedef meshArrKernel::Segment_2                srSegment;
+
+typedef std::pair<long, long>                   srPixel;
+typedef std::vector<srPixel>                    srPixelList;
+typedef std::map<srPixel, srPixelList>          srPixelBins;
+
+// pixel index of a coordinate.  Values within epsilon of a pixel border
+// belong to the pixel above - so grid aligned tile edges ( multiples of
+// the pixel size ) never round down to the neighboring pixel due to
+// fp roundoff.
+static long srPixelIndex( double coord )
 {
-    srSegmentList  srInputSegs;
-    srPolylineList srOutputSegs;
-    srPointList    srInputPoints;
+    double p = coord * SR_PIXELS_PER_DEG;
+    double r = floor( p + 0.5 );
 
-    meshArrEdgeIterator eit;
-    for ( eit = meshArr.edges_begin(); eit != meshArr.edges_end(); ++eit ) {
-        srInputSegs.push_back( eit->curve() );
+    if ( fabs( p - r ) < SR_BORDER_EPSILON ) {
+        return (long)r;
+    } else {
+        return (long)floor( p );
+    }
+}
+
+static srPixel srPixelOf( const meshArrPoint& pt )
+{
+    return srPixel( srPixelIndex( CGAL::to_double( pt.x() ) ),
+                    srPixelIndex( CGAL::to_double( pt.y() ) ) );
+}
+
+static long srBinIndex( long pixel )
+{
+    // floor division for negative indices
+    return ( pixel >= 0 ) ? pixel / SR_BIN_PIXELS : -((-pixel - 1) / SR_BIN_PIXELS) - 1;
+}
+
+// the snapped location of a pixel is it's sw corner.
+// dividing by the ( exact ) pixel count gives the correctly rounded corner
+static meshArrPoint srSnappedPoint( const srPixel& px )
+{
+    return meshArrPoint( (double)px.first  / SR_PIXELS_PER_DEG,
+                         (double)px.second / SR_PIXELS_PER_DEG );
+}
+
+static srPixelRect srPixelBox( const srPixel& px )
+{
+    return srPixelRect( meshArrPoint( (double)px.first      / SR_PIXELS_PER_DEG, (double)px.second      / SR_PIXELS_PER_DEG ),
+                        meshArrPoint( (double)(px.first+1)  / SR_PIXELS_PER_DEG, (double)(px.second+1)  / SR_PIXELS_PER_DEG ) );
+}
+
+// find all hot pixels the segment passes through, ordered from source to target
+static void srFindHotPixels( const srPixelBins& bins, const meshArrSegment& curve, srPixelList& hit )
+{
+    srPixel srcPx = srPixelOf( curve.source() );
+    srPixel trgPx = srPixelOf( curve.target() );
+
+    double  sx = CGAL::to_double( curve.source().x() );
+    double  sy = CGAL::to_double( curve.source().y() );
+    double  tx = CGAL::to_double( curve.target().x() );
+    double  ty = CGAL::to_double( curve.target().y() );
+
+    srSegment seg( curve.source(), curve.target() );
+    std::vector< std::pair<double, srPixel> > ordered;
+
+    // walk the bin columns the segment crosses.  For each column, visit the
+    // bins between the segment's min and max latitude in that column,
+    // with a one bin margin for roundoff.
+    long bxMin = srBinIndex( std::min( srcPx.first,  trgPx.first ) );
+    long bxMax = srBinIndex( std::max( srcPx.first,  trgPx.first ) );
+
+    for ( long bx = bxMin; bx <= bxMax; bx++ ) {
+        double x0 = std::max( std::min(sx, tx), (double)(bx * SR_BIN_PIXELS)     / SR_PIXELS_PER_DEG );
+        double x1 = std::min( std::max(sx, tx), (double)((bx+1) * SR_BIN_PIXELS) / SR_PIXELS_PER_DEG );
+        double y0, y1;
+
+        if ( sx == tx ) {
+            y0 = std::min( sy, ty );
+            y1 = std::max( sy, ty );
+        } else {
+            double ya = sy + (ty - sy) * (x0 - sx) / (tx - sx);
+            double yb = sy + (ty - sy) * (x1 - sx) / (tx - sx);
+
+            y0 = std::min( ya, yb );
+            y1 = std::max( ya, yb );
+        }
+
+        long byMin = srBinIndex( srPixelIndex( y0 ) ) - 1;
+        long byMax = srBinIndex( srPixelIndex( y1 ) ) + 1;
+
+        for ( long by = byMin; by <= byMax; by++ ) {
+            srPixelBins::const_iterator bit = bins.find( srPixel(bx, by) );
+            if ( bit == bins.end() ) {
+                continue;
+            }
+
+            for ( unsigned int i=0; i<bit->second.size(); i++ ) {
+                const srPixel& px = bit->second[i];
+
+                if ( px == srcPx || px == trgPx || CGAL::do_intersect( seg, srPixelBox( px ) ) ) {
+                    // order by projection of the pixel center onto the segment
+                    double cx = ( (double)px.first  + 0.5 ) / SR_PIXELS_PER_DEG;
+                    double cy = ( (double)px.second + 0.5 ) / SR_PIXELS_PER_DEG;
+                    double t  = (cx - sx) * (tx - sx) + (cy - sy) * (ty - sy);
+
+                    if ( px == srcPx ) {
+                        t = -HUGE_VAL;
+                    } else if ( px == trgPx ) {
+                        t = HUGE_VAL;
+                    }
+
+                    ordered.push_back( std::make_pair( t, px ) );
+                }
+            }
+        }
+    }
+
+    std::sort( ordered.begin(), ordered.end() );
+
+    hit.clear();
+    for ( unsigned int i=0; i<ordered.size(); i++ ) {
+        if ( hit.empty() || hit.back() != ordered[i].second ) {
+            hit.push_back( ordered[i].second );
+        }
     }
+}
 
+void tgMeshArrangement::doSnapRound( void )
+{
+    srPixelBins               bins;
+    std::vector<srPixel>      isolated;
+    std::vector<meshArrSegment> curves;
+
+    // every vertex makes it's pixel hot
     meshArrVertexIterator vit;
     for ( vit = meshArr.vertices_begin(); vit != meshArr.vertices_end(); ++vit ) {
+        srPixel px = srPixelOf( vit->point() );
+        srPixelList& bin = bins[ srPixel( srBinIndex(px.first), srBinIndex(px.second) ) ];
+
+        if ( std::find( bin.begin(), bin.end(), px ) == bin.end() ) {
+            bin.push_back( px );
+        }
+
         if ( vit->is_isolated() ) {
-            srInputPoints.push_back( vit->point() );
+            isolated.push_back( px );
         }
     }
 
-    // snap rounding notes:
-    // 1) doesn't appear to be threadsafe
-    // 2) no way to define the origin of snapping.  so if a point is at 0,0, and pixel size is 1, new point will be at 0.5, 0.5.
-    //    We don't want this, so we translate the entire dataset back by 1/2 pixel size so 0,0 is still 0,0
-
-#define SR_OFFSET  (0.0000001)
-//#define SR_OFFSET  (0)
-
-    lock->lock();
-    CGAL::snap_rounding_2<srTraits, srSegmentList::const_iterator, srPolylineList>
-    (srInputSegs.begin(), srInputSegs.end(), srOutputSegs, 0.0000002, true, false, 5);
-    lock->unlock();
+    meshArrEdgeIterator eit;
+    for ( eit = meshArr.edges_begin(); eit != meshArr.edges_end(); ++eit ) {
+        curves.push_back( eit->curve() );
+    }
 
+    // reroute each edge through it's hot pixels
     std::vector<meshArrSegment> segs;
+    srPixelList                 hit;
 
-    srPolylineList::const_iterator iter1;
-    for (iter1 = srOutputSegs.begin(); iter1 != srOutputSegs.end(); ++iter1) {
-        srPolyline::const_iterator itSrc = iter1->begin();
-        srPolyline::const_iterator itTrg = itSrc; itTrg++;
-        while (itTrg != iter1->end()) {
-            meshArrPoint src( itSrc->x() - SR_OFFSET, itSrc->y() - SR_OFFSET );
-            meshArrPoint trg( itTrg->x() - SR_OFFSET, itTrg->y() - SR_OFFSET );
+    for ( unsigned int i=0; i<curves.size(); i++ ) {
+        srFindHotPixels( bins, curves[i], hit );
 
-            segs.push_back( meshArrSegment(src, trg) );
-            itSrc++; itTrg++;
+        for ( unsigned int j=1; j<hit.size(); j++ ) {
+            segs.push_back( meshArrSegment( srSnappedPoint( hit[j-1] ), srSnappedPoint( hit[j] ) ) );
         }
     }
 
+    SG_LOG( SG_GENERAL, SG_DEBUG, "tgMeshArrangement::doSnapRound : " << curves.size() << " edges snapped to " << segs.size() << " segments" );
+
     meshArr.clear();
     CGAL::insert( meshArr, segs.begin(), segs.end() );
 
     // snap round the isolated vertices, too
-    srTraits srT;
-    for ( unsigned int i=0; i<srInputPoints.size(); i++ ) {
-        meshArr_FT x, y;
-        srT.snap_2_object()(srInputPoints[i], 0.0000002, x, y);
-
-        CGAL::insert_point( meshArr, meshArrPoint( x - SR_OFFSET, y - SR_OFFSET ) );
+    for ( unsigned int i=0; i<isolated.size(); i++ ) {
+        CGAL::insert_point( meshArr, srSnappedPoint( isolated[i] ) );
     }
 }
@@ -79,6 +79,18 @@ typedef meshArrangement::Vertex_iterator                          meshArrVertexI
 typedef meshArrangement::Vertex_const_iterator                    meshArrVertexConstIterator;
 typedef CGAL::Arr_landmarks_point_location<meshArrangement>       meshArrLandmarks_pl;
 
+// thread confined arrangements
+// When CGAL is built with thread support, the lazy exact number type keeps its
+// shared constants thread local, and the default random generator used by
+// landmark point location is per thread as well.  Each tgMeshArrangement owns
+// its traits, arrangement and point location, so as long as a tgMesh is only
+// touched by one thread, segment insertion doesn't need the global lock.
+#if defined(CGAL_HAS_THREADS)
+#define TG_MESH_THREAD_CONFINED_ARRANGEMENT (1)
+#else
+#define TG_MESH_THREAD_CONFINED_ARRANGEMENT (0)
+#endif
+
 // face info for providing a link back to an arrangement face per triangle
 struct tgMeshArrFaceInfo
 {
@@ -106,9 +118,6 @@ private:
     // internal arrangement / mesh lookup
     meshArrFaceConstHandle arrMeshFace;
     bool                   visited;
-
-    // saved data
-    std::string            material;
 };
 
 // vertex info for per vertex data ( elevation )
@@ -182,6 +191,13 @@ public:
         }
     }
 
+    meshVertexInfo( int i, const meshTriPoint& p, double e ) {
+        id        = i;
+        vh        = meshTriTDS::Vertex_handle();
+        pt        = p;
+        elevation = e;
+    }
+
     meshVertexInfo( OGRFeature* poFeature ) {
         vh        = meshTriTDS::Vertex_handle();
 
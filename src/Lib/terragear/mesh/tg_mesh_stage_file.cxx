@@ -0,0 +1,202 @@
+#include <cstdio>
+
+#include <zlib.h>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tg_mesh_stage_file.hxx"
+
+void tgMeshStageWriter::addChunk( const char* tag, uint32_t count, uint32_t recordSize, const void* data )
+{
+    stageChunk          chunk;
+    const unsigned char* raw     = (const unsigned char*)data;
+    uLong               rawSize = (uLong)count * recordSize;
+
+    memset( &chunk.header, 0, sizeof(chunk.header) );
+    memcpy( chunk.header.tag, tag, 4 );
+    chunk.header.count      = count;
+    chunk.header.recordSize = recordSize;
+    chunk.header.rawSize    = rawSize;
+    chunk.header.crc        = crc32( crc32( 0L, Z_NULL, 0 ), raw, rawSize );
+
+    if ( rawSize && compressLevel > 0 ) {
+        uLongf storedSize = compressBound( rawSize );
+
+        chunk.payload.resize( storedSize );
+        if ( compress2( &chunk.payload[0], &storedSize, raw, rawSize, compressLevel ) == Z_OK && storedSize < rawSize ) {
+            chunk.payload.resize( storedSize );
+            chunk.header.flags |= TG_STAGE_CHUNK_COMPRESSED;
+        } else {
+            // incompressible - store it
+            chunk.payload.assign( raw, raw + rawSize );
+        }
+    } else if ( rawSize ) {
+        chunk.payload.assign( raw, raw + rawSize );
+    }
+    chunk.header.storedSize = chunk.payload.size();
+
+    chunks.push_back( chunk );
+}
+
+bool tgMeshStageWriter::write( const std::string& filename ) const
+{
+    tgStageFileHeader header;
+    bool              ok = true;
+
+    memcpy( header.magic, TG_STAGE_FILE_MAGIC, 4 );
+    header.version   = TG_STAGE_FILE_VERSION;
+    header.bom       = TG_STAGE_FILE_BOM;
+    header.numChunks = chunks.size();
+
+    std::string tempname = filename + TG_STAGE_TEMP_EXT;
+
+    FILE* fp = fopen( tempname.c_str(), "wb" );
+    if ( !fp ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageWriter: can't open " << tempname << " for writing" );
+        return false;
+    }
+
+    ok = ( fwrite( &header, sizeof(header), 1, fp ) == 1 );
+    for ( unsigned int i=0; ok && i<chunks.size(); i++ ) {
+        ok = ( fwrite( &chunks[i].header, sizeof(tgStageChunkHeader), 1, fp ) == 1 );
+        if ( ok && !chunks[i].payload.empty() ) {
+            ok = ( fwrite( &chunks[i].payload[0], chunks[i].payload.size(), 1, fp ) == 1 );
+        }
+    }
+
+    if ( fclose( fp ) != 0 ) {
+        ok = false;
+    }
+
+    if ( !ok ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageWriter: error writing " << tempname );
+        remove( tempname.c_str() );
+        return false;
+    }
+
+    // publish the complete file
+#ifdef _WIN32
+    // rename doesn't replace an existing file on windows
+    remove( filename.c_str() );
+#endif
+    if ( rename( tempname.c_str(), filename.c_str() ) != 0 ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageWriter: can't rename " << tempname << " to " << filename );
+        remove( tempname.c_str() );
+        return false;
+    }
+
+    return true;
+}
+
+bool tgMeshStageReader::open( const std::string& filename )
+{
+    tgStageFileHeader header;
+
+    close();
+
+    fp = fopen( filename.c_str(), "rb" );
+    if ( !fp ) {
+        // not an error - ocean tiles and old stage data don't have one
+        SG_LOG( SG_GENERAL, SG_DEBUG, "tgMeshStageReader: no stage file " << filename );
+        return false;
+    }
+    name = filename;
+
+    if ( fread( &header, sizeof(header), 1, fp ) != 1 ||
+         memcmp( header.magic, TG_STAGE_FILE_MAGIC, 4 ) ||
+         header.bom != TG_STAGE_FILE_BOM ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << filename << " is not a stage file" );
+        close();
+        return false;
+    }
+
+    if ( header.version != TG_STAGE_FILE_VERSION ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << filename << " has version " << header.version << " - expected " << TG_STAGE_FILE_VERSION );
+        close();
+        return false;
+    }
+
+    // read the chunk directory - skipping the payloads
+    for ( unsigned int i=0; i<header.numChunks; i++ ) {
+        stageChunkEntry entry;
+
+        if ( fread( &entry.header, sizeof(tgStageChunkHeader), 1, fp ) != 1 ) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << filename << " is truncated" );
+            close();
+            return false;
+        }
+
+        entry.offset = ftell( fp );
+        chunks[ std::string( entry.header.tag, 4 ) ] = entry;
+
+        if ( fseek( fp, (long)entry.header.storedSize, SEEK_CUR ) != 0 ) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << filename << " is truncated" );
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void tgMeshStageReader::close( void )
+{
+    if ( fp ) {
+        fclose( fp );
+        fp = NULL;
+    }
+    chunks.clear();
+}
+
+bool tgMeshStageReader::hasChunk( const char* tag ) const
+{
+    return chunks.find( std::string( tag, 4 ) ) != chunks.end();
+}
+
+bool tgMeshStageReader::getChunk( const char* tag, uint32_t recordSize, uint32_t& count, std::vector<unsigned char>& raw )
+{
+    std::map<std::string, stageChunkEntry>::const_iterator cit = chunks.find( std::string( tag, 4 ) );
+    if ( !fp || cit == chunks.end() ) {
+        return false;
+    }
+
+    const tgStageChunkHeader& header = cit->second.header;
+    if ( header.recordSize != recordSize || header.rawSize != (uint64_t)header.count * recordSize ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << name << " chunk " << std::string( tag, 4 ) << " has unexpected record size " << header.recordSize );
+        return false;
+    }
+
+    // an uncompressed chunk is stored as is
+    if ( !( header.flags & TG_STAGE_CHUNK_COMPRESSED ) && header.storedSize != header.rawSize ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << name << " chunk " << std::string( tag, 4 ) << " has stored size " << header.storedSize << ", expected " << header.rawSize );
+        return false;
+    }
+
+    std::vector<unsigned char> stored( header.storedSize );
+    if ( fseek( fp, cit->second.offset, SEEK_SET ) != 0 ||
+         ( !stored.empty() && fread( &stored[0], stored.size(), 1, fp ) != 1 ) ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: error reading " << name << " chunk " << std::string( tag, 4 ) );
+        return false;
+    }
+
+    if ( header.flags & TG_STAGE_CHUNK_COMPRESSED ) {
+        uLongf rawSize = header.rawSize;
+
+        raw.resize( rawSize );
+        if ( uncompress( &raw[0], &rawSize, &stored[0], stored.size() ) != Z_OK || rawSize != header.rawSize ) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << name << " chunk " << std::string( tag, 4 ) << " failed to decompress" );
+            return false;
+        }
+    } else {
+        raw.swap( stored );
+    }
+
+    uLong crc = crc32( crc32( 0L, Z_NULL, 0 ), raw.empty() ? Z_NULL : &raw[0], raw.size() );
+    if ( crc != header.crc ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgMeshStageReader: " << name << " chunk " << std::string( tag, 4 ) << " checksum mismatch" );
+        return false;
+    }
+
+    count = header.count;
+    return true;
+}
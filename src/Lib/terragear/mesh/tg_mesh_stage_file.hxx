@@ -0,0 +1,179 @@
+#ifndef __TG_MESH_STAGE_FILE_HXX__
+#define __TG_MESH_STAGE_FILE_HXX__
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Binary container for the intermediate data passed between tg-construct stages.
+//
+// Shapefiles need a .shp, .shx, .dbf and .prj per layer, and every field is
+// looked up by name on read.  The stage file is a single file per tile made of
+// tagged chunks of fixed size records, so each chunk is read or written in
+// one go.
+//
+// layout ( native byte order - the byte order mark rejects foreign files ) :
+//   tgStageFileHeader
+//   numChunks * { tgStageChunkHeader, payload }
+//
+// Each payload may be zlib compressed, and carries the crc32 of the
+// uncompressed data.  Readers only load the chunks they ask for.
+//
+// Shared edge nodes go in a small stage file per edge, so a neighbor tile
+// opens just the edge it needs.  Files are written under a temporary name
+// and renamed into place, so a reader never sees a partial file, and
+// needs no lock.
+
+#define TG_STAGE_FILE_NAME          "tgmesh.tgs"
+#define TG_STAGE_EDGE_FILE_PREFIX   "tgedge_"   // tgedge_north.tgs, etc.
+#define TG_STAGE_FILE_EXT           ".tgs"
+#define TG_STAGE_TEMP_EXT           ".tmp"
+#define TG_STAGE_FILE_MAGIC         "TGSF"
+#define TG_STAGE_FILE_VERSION       (1)
+#define TG_STAGE_FILE_BOM           (0x01020304)
+#define TG_STAGE_COMPRESS_LEVEL     (1)         // zlib level for chunk payloads - 0 stores them uncompressed
+
+#define TG_STAGE_CHUNK_COMPRESSED   (0x00000001)
+
+// chunk tags
+#define TG_STAGE_ARR_POINTS         "APTS"      // arrangement face boundary points
+#define TG_STAGE_ARR_FACES          "AFAC"      // arrangement faces ( query point and boundary )
+#define TG_STAGE_TDS_VERTICES       "TVTX"      // triangulation vertices
+#define TG_STAGE_TDS_FACES          "TFAC"      // triangulation faces
+#define TG_STAGE_EDGE_NORTH         "EDGN"      // shared edge nodes - sorted along the edge
+#define TG_STAGE_EDGE_SOUTH         "EDGS"
+#define TG_STAGE_EDGE_EAST          "EDGE"
+#define TG_STAGE_EDGE_WEST          "EDGW"
+
+// on disk records - written as they are in memory.  Every member is
+// naturally aligned, and explicit reserved fields fill what would be
+// padding, so the layout is the same for every compiler.  The asserts
+// below catch any that isn't.
+struct tgStageFileHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    bom;
+    uint32_t    numChunks;
+};
+
+struct tgStageChunkHeader
+{
+    char        tag[4];
+    uint32_t    flags;
+    uint32_t    count;          // number of records
+    uint32_t    recordSize;     // sizeof each record
+    uint64_t    rawSize;        // uncompressed payload size
+    uint64_t    storedSize;     // payload size in the file
+    uint32_t    crc;            // crc32 of the uncompressed payload
+    uint32_t    reserved;
+};
+
+struct tgStagePoint
+{
+    double      x;
+    double      y;
+};
+
+struct tgStageArrFace
+{
+    double      qpx;            // query point
+    double      qpy;
+    uint32_t    first;          // first boundary point in TG_STAGE_ARR_POINTS
+    uint32_t    count;          // number of boundary points
+};
+
+struct tgStageVertex
+{
+    double      x;
+    double      y;
+    double      z;
+    int32_t     id;
+    int32_t     reserved;
+};
+
+struct tgStageFace
+{
+    int32_t     fid;
+    int32_t     vid[3];
+    int32_t     nid[3];
+    int32_t     con;            // bit i set if edge i is constrained
+};
+
+static_assert( sizeof(tgStageFileHeader)  == 16, "tgStageFileHeader layout" );
+static_assert( sizeof(tgStageChunkHeader) == 40, "tgStageChunkHeader layout" );
+static_assert( sizeof(tgStagePoint)       == 16, "tgStagePoint layout" );
+static_assert( sizeof(tgStageArrFace)     == 24, "tgStageArrFace layout" );
+static_assert( sizeof(tgStageVertex)      == 32, "tgStageVertex layout" );
+static_assert( sizeof(tgStageFace)        == 32, "tgStageFace layout" );
+
+class tgMeshStageWriter
+{
+public:
+    tgMeshStageWriter( int level = TG_STAGE_COMPRESS_LEVEL ) : compressLevel(level) {}
+
+    template <typename T>
+    void addChunk( const char* tag, const std::vector<T>& records ) {
+        addChunk( tag, records.size(), sizeof(T), records.empty() ? NULL : &records[0] );
+    }
+    void addChunk( const char* tag, uint32_t count, uint32_t recordSize, const void* data );
+
+    // write to a temporary file, then rename it over filename
+    bool write( const std::string& filename ) const;
+
+private:
+    struct stageChunk {
+        tgStageChunkHeader          header;
+        std::vector<unsigned char>  payload;
+    };
+
+    int                     compressLevel;
+    std::vector<stageChunk> chunks;
+};
+
+class tgMeshStageReader
+{
+public:
+    tgMeshStageReader() : fp(NULL) {}
+    ~tgMeshStageReader() { close(); }
+
+    // returns false if the file doesn't exist, or isn't a valid stage file
+    bool open( const std::string& filename );
+    void close( void );
+
+    bool hasChunk( const char* tag ) const;
+
+    template <typename T>
+    bool getChunk( const char* tag, std::vector<T>& records ) {
+        std::vector<unsigned char> raw;
+        uint32_t                   count;
+
+        if ( !getChunk( tag, sizeof(T), count, raw ) ) {
+            return false;
+        }
+
+        records.resize( count );
+        if ( count ) {
+            memcpy( &records[0], &raw[0], raw.size() );
+        }
+        return true;
+    }
+
+private:
+    bool getChunk( const char* tag, uint32_t recordSize, uint32_t& count, std::vector<unsigned char>& raw );
+
+    struct stageChunkEntry {
+        tgStageChunkHeader  header;
+        long                offset;
+    };
+
+    FILE*                                   fp;
+    std::string                             name;
+    std::map<std::string, stageChunkEntry>  chunks;
+};
+
+#endif /* __TG_MESH_STAGE_FILE_HXX__ */
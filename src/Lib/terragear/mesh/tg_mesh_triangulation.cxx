@@ -77,35 +77,8 @@ void tgMeshTriangulation::constrainedTriangulateWithoutEdgeModification( const s
     SG_LOG( SG_GENERAL, TRACE_MESH_TRIANGULATION, "tgMesh::constrainedTriangulate before adding new nodes - valid? " << 
         (meshTriangulation.is_valid() ? "yes, and has " : "no, and has ") << meshTriangulation.number_of_faces() << " faces ");
 
-    // first, let's move each node ( remove - and add back.  - this invalidates all the mappings
-    // if a vertex is incident to a constrained edge, we need to remove the constraint, then re-add once new vertex is added.
-    for( unsigned int i=0; i<movedPoints.size(); i++ )
-    {
-        // first, gather the constrained edges.  in debug mode, CGAL will assert if any incident edges are constrained
-        std::vector<meshTriEdge>            constrainedEdges;
-        std::vector<meshTriVertexHandle>    constrainedEndpoints;
-
-        meshTriVertexHandle target = movedPoints[i].oldPositionHandle;
-        meshTriangulation.incident_constraints( target, std::back_inserter( constrainedEdges ) );
-
-        // save vertex handle to the other end of each constraint.
-        for ( unsigned int j=0; j<constrainedEdges.size(); j++ ) {
-            meshTriFaceHandle   face  = constrainedEdges[j].first;
-            int                 index = constrainedEdges[j].second;
-
-            constrainedEndpoints.push_back( face->vertex( face->ccw(index) ) );
-            meshTriangulation.remove_constrained_edge( face, index );
-        }
-
-        SG_LOG( SG_GENERAL, TRACE_MESH_TRIANGULATION, "tgMesh::constrainedTriangulate node to remove has " << constrainedEdges.size() << " constrained edges." ); 
-
-        meshTriangulation.remove( movedPoints[i].oldPositionHandle );
-        target = meshTriangulation.insert( movedPoints[i].newPosition );
-
-        for ( unsigned int j=0; j<constrainedEndpoints.size(); j++ ) {
-            meshTriangulation.insert_constraint( constrainedEndpoints[j], target );
-        }
-    }
+    // first, move the nodes matched to the neighbor tiles - all in one pass
+    moveNodes( movedPoints );
 
     // now add new nodes
     SG_LOG( SG_GENERAL, TRACE_MESH_TRIANGULATION, "tgMesh::constrainedTriangulate adding " << addedPoints.size() << " nodes" );
@@ -144,6 +117,125 @@ void tgMeshTriangulation::constrainedTriangulateWithoutEdgeModification( const s
     }
 }
 
+// find the neighbors of a vertex on the convex hull - in ccw order along the hull.
+// returns false if the vertex is not on the hull
+bool tgMeshTriangulation::getHullNeighbors( meshTriVertexHandle vh, meshTriVertexHandle& prev, meshTriVertexHandle& next ) const
+{
+    meshTriFaceCirculator fc = meshTriangulation.incident_faces( vh ), done( fc );
+    bool onHull = false;
+
+    do {
+        if ( meshTriangulation.is_infinite( fc ) ) {
+            // the hull runs from cw(k) to ccw(k) of an infinite face
+            int k = fc->index( meshTriangulation.infinite_vertex() );
+            meshTriVertexHandle a = fc->vertex( fc->ccw(k) );
+            meshTriVertexHandle b = fc->vertex( fc->cw(k) );
+
+            if ( a == vh ) {
+                prev = b;
+            } else {
+                next = a;
+            }
+            onHull = true;
+        }
+    } while ( ++fc != done );
+
+    return onHull;
+}
+
+// a vertex can be moved in place if every incident triangle keeps its
+// orientation, so no edge ( constrained or not ) can cross another.
+// Shared edge nodes are on the convex hull of the tile, which must also
+// stay convex - they may slide along the tile edge, but not inside it.
+bool tgMeshTriangulation::isMoveSafe( meshTriVertexHandle vh, const meshTriPoint& p ) const
+{
+    meshTriFaceCirculator fc = meshTriangulation.incident_faces( vh ), done( fc );
+
+    do {
+        if ( !meshTriangulation.is_infinite( fc ) ) {
+            int i = fc->index( vh );
+            if ( CGAL::orientation( p, fc->vertex( fc->ccw(i) )->point(), fc->vertex( fc->cw(i) )->point() ) != CGAL::LEFT_TURN ) {
+                return false;
+            }
+        }
+    } while ( ++fc != done );
+
+    meshTriVertexHandle prev, next, prevPrev, nextNext, dummy;
+    if ( getHullNeighbors( vh, prev, next ) ) {
+        getHullNeighbors( prev, prevPrev, dummy );
+        getHullNeighbors( next, dummy, nextNext );
+
+        if ( CGAL::orientation( prev->point(), p, next->point() ) == CGAL::RIGHT_TURN ||
+             CGAL::orientation( prevPrev->point(), prev->point(), p ) == CGAL::RIGHT_TURN ||
+             CGAL::orientation( p, next->point(), nextNext->point() ) == CGAL::RIGHT_TURN ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// move a node by removing it, and adding it back.
+// if a vertex is incident to a constrained edge, we need to remove the constraint, then re-add once new vertex is added.
+void tgMeshTriangulation::moveNode( const movedNode& node )
+{
+    // first, gather the constrained edges.  in debug mode, CGAL will assert if any incident edges are constrained
+    std::vector<meshTriEdge>            constrainedEdges;
+    std::vector<meshTriVertexHandle>    constrainedEndpoints;
+
+    meshTriVertexHandle target = node.oldPositionHandle;
+    meshTriangulation.incident_constraints( target, std::back_inserter( constrainedEdges ) );
+
+    // save vertex handle to the other end of each constraint.
+    for ( unsigned int j=0; j<constrainedEdges.size(); j++ ) {
+        meshTriFaceHandle   face  = constrainedEdges[j].first;
+        int                 index = constrainedEdges[j].second;
+
+        constrainedEndpoints.push_back( face->vertex( face->ccw(index) ) );
+        meshTriangulation.remove_constrained_edge( face, index );
+    }
+
+    SG_LOG( SG_GENERAL, TRACE_MESH_TRIANGULATION, "tgMesh::constrainedTriangulate node to remove has " << constrainedEdges.size() << " constrained edges." ); 
+
+    meshTriangulation.remove( node.oldPositionHandle );
+    target = meshTriangulation.insert( node.newPosition );
+
+    for ( unsigned int j=0; j<constrainedEndpoints.size(); j++ ) {
+        meshTriangulation.insert_constraint( constrainedEndpoints[j], target );
+    }
+}
+
+// move all nodes of a tile at once.
+// Nodes only move by the matching tolerance, so nearly all of them can
+// just be given their new position.  The Delaunay property is then
+// restored by flipping around all of them in a single pass.  Only the
+// nodes that would fold their star over are removed and added back.
+void tgMeshTriangulation::moveNodes( const std::vector<movedNode>& movedPoints )
+{
+    std::list<meshTriVertexHandle>  moved;
+    std::vector<unsigned int>       reinsert;
+
+    for ( unsigned int i=0; i<movedPoints.size(); i++ ) {
+        meshTriVertexHandle vh = movedPoints[i].oldPositionHandle;
+
+        if ( isMoveSafe( vh, movedPoints[i].newPosition ) ) {
+            vh->set_point( movedPoints[i].newPosition );
+            moved.push_back( vh );
+        } else {
+            reinsert.push_back( i );
+        }
+    }
+
+    meshTriangulation.flip_around( moved );
+
+    // removing a vertex keeps all other vertex handles valid
+    for ( unsigned int i=0; i<reinsert.size(); i++ ) {
+        moveNode( movedPoints[reinsert[i]] );
+    }
+
+    SG_LOG( SG_GENERAL, TRACE_MESH_TRIANGULATION, "tgMesh::constrainedTriangulate moved " << movedPoints.size() << " nodes - " << reinsert.size() << " reinserted" );
+}
+
 // given a mesh face - mark all triangle faces within the constrained boundaries with the face handle from the arrangement
 void tgMeshTriangulation::markDomains(meshTriFaceHandle start, meshArrFaceConstHandle face, std::list<meshTriEdge>& border )
 {
@@ -231,10 +323,19 @@ void tgMeshTriangulation::markDomains( const tgMeshArrangement& arr )
         // NOTE: this means each edge is referenced twice - once from each face
         meshTriFaceHandle n = e.first->neighbor(e.second);
         if( !n->info().isVisited() ) {
-            meshTriangle tri = meshTriangulation.triangle( n );
-
-            // get face handle for point inside this facet
-            face = arr.findMeshFace( CGAL::centroid(tri) );
+            // the neighbor is on the left of the constraint from the cw to the ccw
+            // vertex of this edge.  If the constraint is a whole arrangement edge,
+            // the arrangement face on the left of it is the one we want - no need
+            // to locate it.
+            const meshTriPoint& source = e.first->vertex( meshTriCDT::cw(e.second) )->point();
+            const meshTriPoint& target = e.first->vertex( meshTriCDT::ccw(e.second) )->point();
+
+            if ( !arr.findEdgeFace( source, target, face ) ) {
+                meshTriangle tri = meshTriangulation.triangle( n );
+
+                // get face handle for point inside this facet
+                face = arr.findMeshFace( CGAL::centroid(tri) );
+            }
             markDomains(n, face, border);
         }
     }
@@ -245,9 +346,21 @@ void tgMeshTriangulation::calcTileElevations( const tgArray* tileArray )
     // set point info for the 2d triangulation
     SG_LOG(SG_GENERAL, SG_INFO, "Current elevations " );
 
+    std::vector<double> lon, lat, elev;
     for (meshTriCDT::Finite_vertices_iterator vit = meshTriangulation.finite_vertices_begin(); vit != meshTriangulation.finite_vertices_end(); vit++ ) {
-        vit->info().setElevation( tileArray->altitude_from_grid( vit->point().x() * 3600.0, vit->point().y() * 3600.0 ) );
-        SG_LOG(SG_GENERAL, SG_INFO, vit->info().getElevation() );
+        lon.push_back( vit->point().x() * 3600.0 );
+        lat.push_back( vit->point().y() * 3600.0 );
+    }
+
+    elev.resize( lon.size() );
+    if ( !elev.empty() ) {
+        tileArray->altitudes_from_grid( elev.size(), &lon[0], &lat[0], &elev[0] );
+    }
+
+    unsigned int i = 0;
+    for (meshTriCDT::Finite_vertices_iterator vit = meshTriangulation.finite_vertices_begin(); vit != meshTriangulation.finite_vertices_end(); vit++, i++ ) {
+        vit->info().setElevation( elev[i] );
+        SG_LOG(SG_GENERAL, SG_DEBUG, vit->info().getElevation() );
     }
 }
 
@@ -93,6 +93,7 @@ public:
 
     // 2d triangulation shared edge matching - save edges
     void saveSharedEdgeNodes( const std::string& path ) const;
+    bool saveSharedEdgeFiles( const std::string& path ) const;
 
     // 2d triangulation shared edge matching - match current and neighbot nodes
     void matchNodes( edgeType edge, std::vector<meshVertexInfo>& current, std::vector<meshVertexInfo>& neighbor, std::vector<meshTriPoint>& addedNodes, std::vector<movedNode>& movedNodes );
@@ -139,12 +140,24 @@ public:
     // loading stage 1 triangulation 
     void fromShapefile( const std::string& filename, std::vector<meshFaceInfo>& faces ) const;
 
+    // stage file i/o
+    void toStageFile( tgMeshStageWriter& stageFile, const char* tag, const std::vector<const meshVertexInfo *>& points ) const;
+    bool fromStageFile( tgMeshStageReader& stageFile, const char* tag, std::vector<meshVertexInfo>& points ) const;
+    bool fromStageFile( tgMeshStageReader& stageFile, std::vector<meshFaceInfo>& faces ) const;
+
     bool loadTds( const std::string& bucketPath );
 
     void prepareTds( void );
     void saveTds( const std::string& bucketPath ) const;
+    void saveTds( tgMeshStageWriter& stageFile ) const;
 
 private:
+    // shared edge node relocation
+    bool getHullNeighbors( meshTriVertexHandle vh, meshTriVertexHandle& prev, meshTriVertexHandle& next ) const;
+    bool isMoveSafe( meshTriVertexHandle vh, const meshTriPoint& p ) const;
+    void moveNode( const movedNode& node );
+    void moveNodes( const std::vector<movedNode>& movedPoints );
+
     void loadStage1SharedEdge( const std::string& p, const SGBucket& b, edgeType edge, std::vector<meshVertexInfo>& points );
     void sortByLat( std::vector<meshVertexInfo>& points ) const;
     void sortByLon( std::vector<meshVertexInfo>& points ) const;
@@ -461,6 +461,90 @@ void tgMeshTriangulation::saveTds( const std::string& bucketPath ) const
     }
 }
 
+void tgMeshTriangulation::toStageFile( tgMeshStageWriter& stageFile, const char* tag, const std::vector<const meshVertexInfo *>& points ) const
+{
+    std::vector<tgStageVertex> records( points.size() );
+
+    for ( unsigned int i=0; i<points.size(); i++ ) {
+        records[i].x        = points[i]->getX();
+        records[i].y        = points[i]->getY();
+        records[i].z        = points[i]->getZ();
+        records[i].id       = points[i]->getId();
+        records[i].reserved = 0;
+    }
+
+    stageFile.addChunk( tag, records );
+}
+
+// load vertex info from a stage file chunk, and append to the given vector
+bool tgMeshTriangulation::fromStageFile( tgMeshStageReader& stageFile, const char* tag, std::vector<meshVertexInfo>& points ) const
+{
+    std::vector<tgStageVertex> records;
+
+    if ( !stageFile.getChunk( tag, records ) ) {
+        return false;
+    }
+
+    points.reserve( points.size() + records.size() );
+    for ( unsigned int i=0; i<records.size(); i++ ) {
+        points.push_back( meshVertexInfo( records[i].id, meshTriPoint( records[i].x, records[i].y ), records[i].z ) );
+    }
+
+    return true;
+}
+
+bool tgMeshTriangulation::fromStageFile( tgMeshStageReader& stageFile, std::vector<meshFaceInfo>& faces ) const
+{
+    std::vector<tgStageFace> records;
+
+    if ( !stageFile.getChunk( TG_STAGE_TDS_FACES, records ) ) {
+        return false;
+    }
+
+    faces.reserve( faces.size() + records.size() );
+    for ( unsigned int i=0; i<records.size(); i++ ) {
+        int vIdx[3];
+        int nIdx[3];
+        int cons[3];
+
+        for ( unsigned int j=0; j<3; j++ ) {
+            vIdx[j] = records[i].vid[j];
+            nIdx[j] = records[i].nid[j];
+            cons[j] = ( records[i].con >> j ) & 1;
+        }
+
+        faces.push_back( meshFaceInfo( records[i].fid, vIdx, nIdx, cons ) );
+    }
+
+    return true;
+}
+
+void tgMeshTriangulation::saveTds( tgMeshStageWriter& stageFile ) const
+{
+    std::vector<const meshVertexInfo *> points;
+    std::vector<tgStageFace>            faces( faceInfo.size() );
+
+    // don't save first point : it's infinite vertex
+    for (unsigned int i=1; i<vertexInfo.size(); i++) {
+        points.push_back( &vertexInfo[i] );
+    }
+    toStageFile( stageFile, TG_STAGE_TDS_VERTICES, points );
+
+    for (unsigned int i=0; i<faceInfo.size(); i++) {
+        faces[i].fid = faceInfo[i].getFid();
+        faces[i].con = 0;
+
+        for ( unsigned int j=0; j<3; j++ ) {
+            faces[i].vid[j] = faceInfo[i].getVid(j);
+            faces[i].nid[j] = faceInfo[i].getNid(j);
+            if ( faceInfo[i].getConstrained(j) ) {
+                faces[i].con |= ( 1 << j );
+            }
+        }
+    }
+    stageFile.addChunk( TG_STAGE_TDS_FACES, faces );
+}
+
 bool tgMeshTriangulation::loadTds( const std::string& bucketPath )
 {
     // load the tile points
@@ -473,11 +557,20 @@ bool tgMeshTriangulation::loadTds( const std::string& bucketPath )
     tds.clear();
 
     // load vertices, and save their handles in V
-    filePath = bucketPath + "/tds_points.shp"; 
-    fromShapefile( filePath, points );
-
-    filePath = bucketPath + "/tds_faces.shp"; 
-    fromShapefile( filePath, faces );
+    tgMeshStageReader stageFile;
+    if ( !stageFile.open( bucketPath + "/" + TG_STAGE_FILE_NAME ) ||
+         !fromStageFile( stageFile, TG_STAGE_TDS_VERTICES, points ) ||
+         !fromStageFile( stageFile, faces ) ) {
+        // stage data from before the stage file
+        points.clear();
+        faces.clear();
+
+        filePath = bucketPath + "/tds_points.shp"; 
+        fromShapefile( filePath, points );
+
+        filePath = bucketPath + "/tds_faces.shp"; 
+        fromShapefile( filePath, faces );
+    }
 
     if (!points.empty() && !faces.empty()) {
         SG_LOG(SG_GENERAL, SG_DEBUG, "loadTDS from " << points.size() << " points and " << faces.size() << " faces" );
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <cmath>
 #include <functional>
 
 #include <simgear/debug/logstream.hxx>
 
+#include <terragear/tg_trace.hxx>
+
 #include "tg_mesh.hxx"
 
 #define THRESHOLD_SAME      (0.0000000000001)
@@ -10,234 +13,242 @@
 
 #define DEBUG_SHARED_EDGE   (0)
 
+static const char *edgestr[4] = {
+    "north",
+    "south",
+    "east",
+    "west"
+};
+
+static const char *edgetag[4] = {
+    TG_STAGE_EDGE_NORTH,
+    TG_STAGE_EDGE_SOUTH,
+    TG_STAGE_EDGE_EAST,
+    TG_STAGE_EDGE_WEST
+};
+
+static std::string edgeFileName( edgeType edge )
+{
+    return std::string( TG_STAGE_EDGE_FILE_PREFIX ) + edgestr[edge] + TG_STAGE_FILE_EXT;
+}
+
+// position of a node along a shared edge.  north and south edges run east - west,
+// so nodes are ordered by longitude.  east and west edges by latitude.
+static double edgeParameter( edgeType edge, const meshTriPoint& pt )
+{
+    return ( edge == NORTH_EDGE || edge == SOUTH_EDGE ) ? pt.x() : pt.y();
+}
+
+// sort nodes along the edge - ties broken by position, so both tiles sharing
+// the edge traverse the nodes in the same order
+static void sortEdgeNodes( edgeType edge, std::vector<nodeMembershipData>& nodes )
+{
+    std::sort( nodes.begin(), nodes.end(), [edge]( const nodeMembershipData& a, const nodeMembershipData& b ) {
+        double ta = edgeParameter( edge, boost::get<0>(a) );
+        double tb = edgeParameter( edge, boost::get<0>(b) );
+
+        if ( ta != tb ) {
+            return ta < tb;
+        }
+        return boost::get<0>(a) < boost::get<0>(b);
+    } );
+}
+
+// find the closest node to pt closer than sqrt(maxDistSq).  nodes are sorted along
+// the edge, and the distance along the edge is never more than the real distance,
+// so only the nodes within that window are checked - nodes slightly off the edge
+// are still found.  skip is the index of pt in nodes, if it is one of them.
+// returns the index of the closest node, or -1 if none is close enough
+static int findClosestEdgeNode( edgeType edge, const std::vector<nodeMembershipData>& nodes, const meshTriPoint& pt, double maxDistSq, int skip, double& distSq )
+{
+    double t     = edgeParameter( edge, pt );
+    double range = sqrt( maxDistSq );
+    int    found = -1;
+
+    std::vector<nodeMembershipData>::const_iterator it = std::lower_bound( nodes.begin(), nodes.end(), t - range, [edge]( const nodeMembershipData& n, double v ) {
+        return edgeParameter( edge, boost::get<0>(n) ) < v;
+    } );
+
+    distSq = maxDistSq;
+    for ( ; it != nodes.end() && edgeParameter( edge, boost::get<0>(*it) ) <= t + range; it++ ) {
+        int    i = it - nodes.begin();
+        double d = CGAL::squared_distance( pt, boost::get<0>(*it) );
+
+        if ( i != skip && d < distSq ) {
+            distSq = d;
+            found  = i;
+        }
+    }
+
+    return found;
+}
+
 /* This will add or move nodes to match a neighbor edge.  Algorithm is designed to give the same result for both tiles.  
  * (it is run twice - once for each tile on the shared edge )
  */
 void tgMeshTriangulation::matchNodes( edgeType edge, std::vector<meshVertexInfo>& curVertexes, std::vector<meshVertexInfo>& neighVertexes, std::vector<meshTriPoint>& addedNodes, std::vector<movedNode>& movedNodes )
 {
-    // we'll build a search tree of all nodes on the shared edge - flag which ones are current, which are neighbor, and which are both.
-    // to determine if they are on both, we'll create 2 kd-trees to search first.
-    // CGAL kd trees cannot remove items, so merging in tree is innefficient.
-    nodeMembershipTree  curTree, neighTree;
+    TG_TRACE_SCOPE( "matchNodes" );
+    TG_TRACE_COUNTER( "shared edge nodes", curVertexes.size() + neighVertexes.size() );
+
+    // we'll build a list of all nodes on the shared edge - flag which ones are current, which are neighbor, and which are both.
+    // all nodes lie ( very nearly ) on the edge, so instead of search trees, each list is sorted along the edge, 
+    // and searched over a small window around the query node.
+    std::vector<nodeMembershipData> curNodes, neighNodes;
     std::vector<meshVertexInfo>::iterator viIt;
 
     for ( viIt = curVertexes.begin(); viIt != curVertexes.end(); viIt++ ) {
-        curTree.insert( nodeMembershipData( viIt->getPoint(), NODE_CURRENT, viIt->getId() ) );        
+        curNodes.push_back( nodeMembershipData( viIt->getPoint(), NODE_CURRENT, viIt->getId() ) );
     }
+    sortEdgeNodes( edge, curNodes );
 
     for ( viIt = neighVertexes.begin(); viIt != neighVertexes.end(); viIt++ ) {
-        neighTree.insert( nodeMembershipData( viIt->getPoint(), NODE_NEIGHBOR, -1 ) );        
+        neighNodes.push_back( nodeMembershipData( viIt->getPoint(), NODE_NEIGHBOR, -1 ) );
     }
+    sortEdgeNodes( edge, neighNodes );
 
-    // does this need to be a tree as well?
-    nodeMembershipTree  nodeTree;
+    std::vector<nodeMembershipData> nodes;
+    nodes.reserve( curNodes.size() + neighNodes.size() );
 
-    const char *edgestr[4] = {
-        "north",
-        "south",
-        "east",
-        "west"
-    };
-
-    SG_LOG(SG_GENERAL, SG_DEBUG, "edge matching bucket " << mesh->getBucket().gen_index_str() << " edge " << edgestr[edge] << ".  current - " << curTree.size() << ", neighbor - " << neighTree.size() );           
+    SG_LOG(SG_GENERAL, SG_DEBUG, "edge matching bucket " << mesh->getBucket().gen_index_str() << " edge " << edgestr[edge] << ".  current - " << curNodes.size() << ", neighbor - " << neighNodes.size() );           
 
     // traverse neighbor tile - nodes are either both, or neighbor
-    for( viIt = neighVertexes.begin(); viIt != neighVertexes.end(); viIt++ ) {
-        nodeMembershipSearch           currentSearch( curTree, viIt->getPoint(), 1 ); 
-
-        if( currentSearch.begin() != currentSearch.end() ) {
-            nodeMembershipSearch::iterator csit = currentSearch.begin();
-            nodeMembershipData             csdata  = csit->first;
-            double                         dist_sq = csit->second;
-
-            if ( dist_sq < THRESHOLD_SAME ) {
-                // use the current info id - from the tree
-                nodeTree.insert( nodeMembershipData(viIt->getPoint(), NODE_BOTH, boost::get<2>(csdata)) );
-            } else {
-                nodeTree.insert( nodeMembershipData(viIt->getPoint(), NODE_NEIGHBOR, -1) );
-            }
+    std::vector<nodeMembershipData>::const_iterator nit;
+    for ( nit = neighNodes.begin(); nit != neighNodes.end(); nit++ ) {
+        double distSq;
+        int    c = findClosestEdgeNode( edge, curNodes, boost::get<0>(*nit), THRESHOLD_SAME, -1, distSq );
+
+        if ( c >= 0 ) {
+            // use the current info id
+            nodes.push_back( nodeMembershipData(boost::get<0>(*nit), NODE_BOTH, boost::get<2>(curNodes[c])) );
         } else {
-            SG_LOG(SG_GENERAL, SG_DEBUG, "ERROR: search returned no results 1" );
+            nodes.push_back( nodeMembershipData(boost::get<0>(*nit), NODE_NEIGHBOR, -1) );
         }
     }
 
-    // now traverse current tile - nodes are either both, current ( or duplicate )
-    for( viIt = curVertexes.begin(); viIt != curVertexes.end(); viIt++ ) {
-        if ( !neighTree.empty() ) {
-            nodeMembershipSearch           neighborSearch( neighTree, viIt->getPoint(), 1 );
-
-            if( neighborSearch.begin() != neighborSearch.end() ) {
-                nodeMembershipSearch::iterator nsit = neighborSearch.begin();
-                nodeMembershipData             nsdata  = nsit->first;
-                double                         dist_sq = nsit->second;
-                meshTriPoint                   pt = boost::get<0>(nsdata);
-
-                if ( dist_sq < THRESHOLD_SAME ) {
-                    // only add nodes in BOTH onece - is it already in nodeTree?
-                    nodeMembershipSearch duplicateSearch( nodeTree, pt, 1 );
-                    if ( duplicateSearch.begin() != duplicateSearch.end() ) {
-                        double               dupDist_sq = duplicateSearch.begin()->second;
-
-                        if ( dupDist_sq > THRESHOLD_SAME ) {
-                            // use the current info ID - from the original array
-                            nodeTree.insert( nodeMembershipData(viIt->getPoint(), NODE_BOTH, viIt->getId() ) );                    
-                        } else {
-                            // duplicate - already in the membership tree as both
-                        }
-                    } else {
-                        SG_LOG(SG_GENERAL, SG_DEBUG, "ERROR: search returned no results 2" );
-                    }
-                } else {
-                    // no neighbor near - just us
-                    nodeTree.insert( nodeMembershipData(viIt->getPoint(), NODE_CURRENT, viIt->getId() ) );
-                }
-            } else {
-                // no neighbors at all - just add current
-                nodeTree.insert( nodeMembershipData(viIt->getPoint(), NODE_CURRENT, viIt->getId() ) );
-            }
-        } else {
-            SG_LOG(SG_GENERAL, SG_DEBUG, "ERROR: search returned no results 3" );
+    // now traverse current tile - nodes are either current, or were already 
+    // added as both from the neighbor
+    for ( nit = curNodes.begin(); nit != curNodes.end(); nit++ ) {
+        double distSq;
+
+        if ( findClosestEdgeNode( edge, neighNodes, boost::get<0>(*nit), THRESHOLD_SAME, -1, distSq ) < 0 ) {
+            // no neighbor near - just us
+            nodes.push_back( *nit );
         }
     }
 
-    // we now have a search tree with all nodes on the shared edge.  each node is marked cur, neigh, or both.
+    // we now have a list with all nodes on the shared edge.  each node is marked cur, neigh, or both.
     // now we look for cur and neigh nodes that are very close to an opposite neigh or current to merge them.
-    // first - let's dump the debug output
-    nodeMembershipTree::const_iterator mit;
-    unsigned int nodeCnt = 1;
-
-    // now traverse the tree again, and either add or merge nodes.  
-    // This tree should be exactly the same for each tile sharing the edge.
+    // This list should be exactly the same for each tile sharing the edge.
     // If it isn't we'll get T-Junctions at tile boundaries...
+    sortEdgeNodes( edge, nodes );
 
-    // we can't actively search the tree while traversing it...
-    // make a copy of the nodeDatas
-    std::vector<nodeMembershipData> queryPoints;
-    for ( mit = nodeTree.begin(); mit != nodeTree.end(); mit++ ) {
-        queryPoints.push_back( *mit );
-    }
-
-    std::vector<nodeMembershipData>::const_iterator qpit = queryPoints.begin();
-    while ( qpit != queryPoints.end() ) {
+    for ( unsigned int i=0; i<nodes.size(); i++ ) {
         // Only worry about nodes that are NOT on both edges - either add them or merge them
-        if ( boost::get<1>(*qpit) != NODE_BOTH ) {
-
-            // do a search for the closest node to this one 
-            // - search for 2 nodes, as the closest one will be this one :)
-            meshTriPoint qp = boost::get<0>(*qpit);
-            nodeMembershipSearch memberSearch( nodeTree, qp, 2 );
-
-            if ( memberSearch.begin() != memberSearch.end() ) {
-                nodeMembershipSearch::iterator rit = memberSearch.begin(); 
-
-                nodeMembershipData thisNode = rit->first;
-                rit++;
-                nodeMembershipData nextNode = rit->first;
-                double             distSq   = rit->second;
-
-                // if the distance between nodes is less than the merge threshold - see if we can merge them.
-                if ( distSq < THRESHOLD_TOO_CLOSE ) {
-                    std::string debugInfo = "dist is within merge thresh.  ";
-                    switch( boost::get<1>(thisNode) ) {
-                        case NODE_BOTH:     debugInfo += " this is BOTH, ";       break;
-                        case NODE_CURRENT:  debugInfo += " this is CURRENT, ";    break;
-                        case NODE_NEIGHBOR: debugInfo += " this is NEIGHBOR, ";   break;
-                    }
-                    switch( boost::get<1>(nextNode) ) {
-                        case NODE_BOTH:     debugInfo += " next is BOTH";         break;
-                        case NODE_CURRENT:  debugInfo += " next is CURRENT";      break;
-                        case NODE_NEIGHBOR: debugInfo += " next is NEIGHBOR";     break;
-                    }
+        if ( boost::get<1>(nodes[i]) != NODE_BOTH ) {
+
+            // find the closest node to this one ( other than itself )
+            const nodeMembershipData& thisNode = nodes[i];
+            double                    distSq;
+            int                       next = findClosestEdgeNode( edge, nodes, boost::get<0>(thisNode), THRESHOLD_TOO_CLOSE, i, distSq );
+
+            // if the distance between nodes is less than the merge threshold - see if we can merge them.
+            if ( next >= 0 ) {
+                const nodeMembershipData& nextNode = nodes[next];
+
+                std::string debugInfo = "dist is within merge thresh.  ";
+                switch( boost::get<1>(thisNode) ) {
+                    case NODE_BOTH:     debugInfo += " this is BOTH, ";       break;
+                    case NODE_CURRENT:  debugInfo += " this is CURRENT, ";    break;
+                    case NODE_NEIGHBOR: debugInfo += " this is NEIGHBOR, ";   break;
+                }
+                switch( boost::get<1>(nextNode) ) {
+                    case NODE_BOTH:     debugInfo += " next is BOTH";         break;
+                    case NODE_CURRENT:  debugInfo += " next is CURRENT";      break;
+                    case NODE_NEIGHBOR: debugInfo += " next is NEIGHBOR";     break;
+                }
 
-                    // merge these points only if they are in opposite tiles
-                    if ( boost::get<1>(nextNode) != NODE_BOTH ) {
-                        int index;
-
-                        // NOTE - we're going to add the moved node twice ( once from curent, and once from neighbot.
-                        // This is OK, as we will lookup and find just the one - from current
-                        if ( (boost::get<1>(thisNode) == NODE_CURRENT) && (boost::get<1>(nextNode) == NODE_NEIGHBOR) ) {
-                            debugInfo += ": MERGE";
-
-                            // moving thisNode to midpoint of this and next
-                            index = boost::get<2>(thisNode);
-                            if ( vertexIndexToHandleMap.find(index) != vertexIndexToHandleMap.end() ) {
-                                meshTriTDS::Vertex_handle vHand = vertexIndexToHandleMap[index];
-                                movedNodes.push_back( movedNode(vHand, boost::get<0>(thisNode), CGAL::midpoint( boost::get<0>(thisNode), boost::get<0>(nextNode)) ) );
-                            } else {
-                                SG_LOG(SG_GENERAL, SG_INFO, "Can't find index " << index << " map size is " << vertexIndexToHandleMap.size() );
-                            }
-                        } else if ( (boost::get<1>(thisNode) == NODE_NEIGHBOR) && (boost::get<1>(nextNode) == NODE_CURRENT) ) {
-                            debugInfo += ": MERGE";
-
-                            // moving nextNode to midpoint of this and next
-                            index = boost::get<2>(nextNode);
-                            if ( vertexIndexToHandleMap.find(index) != vertexIndexToHandleMap.end() ) {
-                                meshTriTDS::Vertex_handle vHand = vertexIndexToHandleMap[index];
-                                movedNodes.push_back( movedNode(vHand, boost::get<0>(nextNode), CGAL::midpoint( boost::get<0>(thisNode), boost::get<0>(nextNode)) ) );
-                            } else {
-                                SG_LOG(SG_GENERAL, SG_INFO, "Can't find index " << index << " map size is " << vertexIndexToHandleMap.size() );
-                            }
+                // merge these points only if they are in opposite tiles
+                if ( boost::get<1>(nextNode) != NODE_BOTH ) {
+                    int index;
+
+                    // NOTE - we're going to add the moved node twice ( once from curent, and once from neighbot.
+                    // This is OK, as we will lookup and find just the one - from current
+                    if ( (boost::get<1>(thisNode) == NODE_CURRENT) && (boost::get<1>(nextNode) == NODE_NEIGHBOR) ) {
+                        debugInfo += ": MERGE";
+
+                        // moving thisNode to midpoint of this and next
+                        index = boost::get<2>(thisNode);
+                        if ( vertexIndexToHandleMap.find(index) != vertexIndexToHandleMap.end() ) {
+                            meshTriTDS::Vertex_handle vHand = vertexIndexToHandleMap[index];
+                            movedNodes.push_back( movedNode(vHand, boost::get<0>(thisNode), CGAL::midpoint( boost::get<0>(thisNode), boost::get<0>(nextNode)) ) );
                         } else {
-                            // we've found 2 points that are very close in the same tile - if it's the neighbor tile, go ahead and add it
-                            if ( boost::get<1>(thisNode) == NODE_NEIGHBOR ) {
-                                debugInfo += ": CAN'T MERGE - both points neighbor - addding neighbor node";
-                                addedNodes.push_back( boost::get<0>(thisNode) );
-                            } else {
-                                debugInfo += ": CAN'T MERGE - both points current - ignore";
-                            }
+                            SG_LOG(SG_GENERAL, SG_INFO, "Can't find index " << index << " map size is " << vertexIndexToHandleMap.size() );
+                        }
+                    } else if ( (boost::get<1>(thisNode) == NODE_NEIGHBOR) && (boost::get<1>(nextNode) == NODE_CURRENT) ) {
+                        debugInfo += ": MERGE";
+
+                        // moving nextNode to midpoint of this and next
+                        index = boost::get<2>(nextNode);
+                        if ( vertexIndexToHandleMap.find(index) != vertexIndexToHandleMap.end() ) {
+                            meshTriTDS::Vertex_handle vHand = vertexIndexToHandleMap[index];
+                            movedNodes.push_back( movedNode(vHand, boost::get<0>(nextNode), CGAL::midpoint( boost::get<0>(thisNode), boost::get<0>(nextNode)) ) );
+                        } else {
+                            SG_LOG(SG_GENERAL, SG_INFO, "Can't find index " << index << " map size is " << vertexIndexToHandleMap.size() );
                         }
                     } else {
-                        // current node is on just one edge, but next is on both 
-                        // if it is on the neighbor edge, add it to current
+                        // we've found 2 points that are very close in the same tile - if it's the neighbor tile, go ahead and add it
                         if ( boost::get<1>(thisNode) == NODE_NEIGHBOR ) {
-                            debugInfo += ": CAN'T MERGE - next closest on both edges - adding neighbor node";
+                            debugInfo += ": CAN'T MERGE - both points neighbor - addding neighbor node";
                             addedNodes.push_back( boost::get<0>(thisNode) );
                         } else {
-                            // current node is by definition, on current tile edge.
-                            debugInfo += ": CAN'T MERGE - next closest on both edges - skipping current node";
+                            debugInfo += ": CAN'T MERGE - both points current - ignore";
                         }
                     }
-
-                    SG_LOG( SG_GENERAL, SG_DEBUG, debugInfo );
                 } else {
-                    // distance between nodes is too large to merge 
-                    // - if cur is on neighbor edge, add it to current
+                    // current node is on just one edge, but next is on both 
+                    // if it is on the neighbor edge, add it to current
                     if ( boost::get<1>(thisNode) == NODE_NEIGHBOR ) {
+                        debugInfo += ": CAN'T MERGE - next closest on both edges - adding neighbor node";
                         addedNodes.push_back( boost::get<0>(thisNode) );
                     } else {
                         // current node is by definition, on current tile edge.
+                        debugInfo += ": CAN'T MERGE - next closest on both edges - skipping current node";
                     }
                 }
+
+                SG_LOG( SG_GENERAL, SG_DEBUG, debugInfo );
             } else {
-                SG_LOG(SG_GENERAL, SG_DEBUG, "ERROR: search returned no results 4" );
+                // distance between nodes is too large to merge 
+                // - if cur is on neighbor edge, add it to current
+                if ( boost::get<1>(thisNode) == NODE_NEIGHBOR ) {
+                    addedNodes.push_back( boost::get<0>(thisNode) );
+                } else {
+                    // current node is by definition, on current tile edge.
+                }
             }
         } else {
             // node is already on both edges - ignore.
         }
-
-        // try next node ( or next  next, in case of merge )
-        if ( qpit != queryPoints.end() ) {
-            nodeCnt++;
-            qpit++;
-        }
     }
 }
 
 void tgMeshTriangulation::loadStage1SharedEdge( const std::string& p, const SGBucket& bucket, edgeType edge, std::vector<meshVertexInfo>& points ) 
 {
-    const char *edgestr[4] = {
-        "north",
-        "south",
-        "east",
-        "west"
-    };
-
-    char filename[64];
-    sprintf( filename, "stage1_%s.shp", edgestr[edge] );
-    std::string filePath = p + bucket.gen_base_path() + "/" + bucket.gen_index_str() + "/" + filename;
-
-    SG_LOG(SG_GENERAL, SG_DEBUG, "Loading Bucket " << bucket.gen_index_str() << " edge " << edgestr[edge] << " from " << filePath );           
-    fromShapefile( filePath, points );
+    std::string bucketPath = p + bucket.gen_base_path() + "/" + bucket.gen_index_str();
+    tgMeshStageReader stageFile;
+
+    // only the one edge file is read from the neighbor
+    SG_LOG(SG_GENERAL, SG_DEBUG, "Loading Bucket " << bucket.gen_index_str() << " edge " << edgestr[edge] << " from " << bucketPath );           
+    if ( !stageFile.open( bucketPath + "/" + edgeFileName( edge ) ) || !fromStageFile( stageFile, edgetag[edge], points ) ) {
+        // stage1 data from before the edge files - the edge is a chunk of the tile stage file
+        if ( !stageFile.open( bucketPath + "/" + TG_STAGE_FILE_NAME ) || !fromStageFile( stageFile, edgetag[edge], points ) ) {
+            // stage1 data from before the stage file
+            char filename[64];
+            sprintf( filename, "/stage1_%s.shp", edgestr[edge] );
+            fromShapefile( bucketPath + filename, points );
+        }
+    }
 
     SG_LOG(SG_GENERAL, SG_DEBUG, "Loaded " << points.size() << " nodes on edge " << edgestr[edge] );        
 }
@@ -510,6 +521,41 @@ void tgMeshTriangulation::saveSharedEdgeNodes( const std::string& path ) const
     toShapefile( path, "stage1_west",  west );
 }
 
+static bool lessLatitudePtr(const meshVertexInfo* a, const meshVertexInfo* b)
+{
+    return a->getY() < b->getY();
+}
+
+static bool lessLongitudePtr(const meshVertexInfo* a, const meshVertexInfo* b)
+{
+    return a->getX() < b->getX();
+}
+
+// save each shared edge in its own stage file, sorted along the edge
+bool tgMeshTriangulation::saveSharedEdgeFiles( const std::string& path ) const
+{
+    std::vector<const meshVertexInfo *> nodes[4];
+    bool                                ok = true;
+
+    getEdgeNodes( nodes[NORTH_EDGE], nodes[SOUTH_EDGE], nodes[EAST_EDGE], nodes[WEST_EDGE] );
+
+    std::sort( nodes[NORTH_EDGE].begin(), nodes[NORTH_EDGE].end(), lessLongitudePtr );
+    std::sort( nodes[SOUTH_EDGE].begin(), nodes[SOUTH_EDGE].end(), lessLongitudePtr );
+    std::sort( nodes[EAST_EDGE].begin(),  nodes[EAST_EDGE].end(),  lessLatitudePtr );
+    std::sort( nodes[WEST_EDGE].begin(),  nodes[WEST_EDGE].end(),  lessLatitudePtr );
+
+    for ( unsigned int i=0; i<4; i++ ) {
+        tgMeshStageWriter edgeFile;
+
+        toStageFile( edgeFile, edgetag[i], nodes[i] );
+        if ( !edgeFile.write( path + "/" + edgeFileName( (edgeType)i ) ) ) {
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
 void tgMeshTriangulation::saveIncidentFaces( const std::string& path, const char* layer, const std::vector<const meshVertexInfo *>& edgeVertexes ) const
 {
 #if 0
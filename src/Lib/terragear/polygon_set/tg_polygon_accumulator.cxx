@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -481,24 +483,78 @@ void tgAccumulator::Add_cgal( const tgPolygon& subject )
 // need a few functions:
 // 1) generate a Polygon_set from the Polygons_with_holes in the list that intersect subject bounding box
 // 2) Add to the Polygons_with_holes list with a Polygon set ( and the bounding boxes )
+
+// get the range of grid cells covered by a bounding box.
+// returns the number of cells, or 0 if the box can't be gridded
+unsigned int tgAccumulator::GetCells( const CGAL::Bbox_2& bb, tgAccumCell& min, tgAccumCell& max ) const
+{
+    double span = (double)TG_ACCUM_MAX_CELLS * TG_ACCUM_CELL_SIZE;
+
+    // empty, inverted, or huge boxes go in the large list
+    if ( !( bb.xmin() <= bb.xmax() && bb.ymin() <= bb.ymax() ) ||
+         bb.xmax() - bb.xmin() > span || bb.ymax() - bb.ymin() > span ) {
+        return 0;
+    }
+
+    min.first  = (int)floor( bb.xmin() / TG_ACCUM_CELL_SIZE );
+    min.second = (int)floor( bb.ymin() / TG_ACCUM_CELL_SIZE );
+    max.first  = (int)floor( bb.xmax() / TG_ACCUM_CELL_SIZE );
+    max.second = (int)floor( bb.ymax() / TG_ACCUM_CELL_SIZE );
+
+    return (max.first - min.first + 1) * (max.second - min.second + 1);
+}
+
+// get the indices of all entries whose bounding box overlaps bb - in the order they were added
+void tgAccumulator::GetCandidates( const CGAL::Bbox_2& bb, std::vector<unsigned int>& candidates ) const
+{
+    tgAccumCell  min, max;
+    unsigned int numCells = GetCells( bb, min, max );
+
+    candidates.clear();
+
+    if ( !numCells || numCells > accum_cgal_list.size() ) {
+        // visiting the cells would cost more than checking every entry
+        for ( unsigned int i=0; i<accum_cgal_list.size(); i++ ) {
+            if ( CGAL::do_overlap( bb, accum_cgal_list[i].bbox ) ) {
+                candidates.push_back( i );
+            }
+        }
+        return;
+    }
+
+    for ( int x = min.first; x <= max.first; x++ ) {
+        for ( int y = min.second; y <= max.second; y++ ) {
+            std::map<tgAccumCell, std::vector<unsigned int> >::const_iterator cit = accum_grid.find( tgAccumCell(x, y) );
+            if ( cit != accum_grid.end() ) {
+                candidates.insert( candidates.end(), cit->second.begin(), cit->second.end() );
+            }
+        }
+    }
+    candidates.insert( candidates.end(), accum_large.begin(), accum_large.end() );
+
+    // entries spanning several cells are found more than once
+    std::sort( candidates.begin(), candidates.end() );
+    candidates.erase( std::unique( candidates.begin(), candidates.end() ), candidates.end() );
+
+    unsigned int numOverlap = 0;
+    for ( unsigned int i=0; i<candidates.size(); i++ ) {
+        if ( CGAL::do_overlap( bb, accum_cgal_list[candidates[i]].bbox ) ) {
+            candidates[numOverlap++] = candidates[i];
+        }
+    }
+    candidates.resize( numOverlap );
+}
+
 void tgAccumulator::GetAccumPolygonSet( const CGAL::Bbox_2& bbox, cgalPoly_PolygonSet& accumPs ) 
 {
-    std::list<tgAccumEntry>::const_iterator it;
+    std::vector<unsigned int> candidates;
     std::list<cgalPoly_PolygonWithHoles> accum;
 //  static int num_iter = 1;
     
-    // traverse all of the Polygon_with_holes and accumulate their union
-    for ( it=accum_cgal_list.begin(); it!=accum_cgal_list.end(); it++ ) {
-        if ( CGAL::do_overlap( bbox, (*it).bbox ) ) {
-#if 0
-            if ( (*it).pwh.is_unbounded() ) {
-                SG_LOG(SG_GENERAL, SG_ALERT, "tgAccumulator::GetAccumPolygonSet - pwh is unbounded" );
-            } else {
-                SG_LOG(SG_GENERAL, SG_ALERT, "tgAccumulator::GetAccumPolygonSet - pwh is bounded" );
-            }
-#endif            
-            accum.push_back( (*it).pwh );
-        }
+    // accumulate the union of the Polygon_with_holes overlapping the box
+    GetCandidates( bbox, candidates );
+    for ( unsigned int i=0; i<candidates.size(); i++ ) {
+        accum.push_back( accum_cgal_list[candidates[i]].pwh );
     }
     
 #if 0
@@ -574,7 +630,20 @@ void tgAccumulator::AddAccumPolygonSet( const cgalPoly_PolygonSet& ps )
         entry.pwh  = (*it);
         entry.bbox =  entry.pwh.outer_boundary().bbox();
 
+        unsigned int idx = accum_cgal_list.size();
         accum_cgal_list.push_back( entry );
+
+        // register the entry in every cell it's bounding box covers
+        tgAccumCell min, max;
+        if ( GetCells( entry.bbox, min, max ) ) {
+            for ( int x = min.first; x <= max.first; x++ ) {
+                for ( int y = min.second; y <= max.second; y++ ) {
+                    accum_grid[tgAccumCell(x, y)].push_back( idx );
+                }
+            }
+        } else {
+            accum_large.push_back( idx );
+        }
     }    
 }
 
@@ -1,8 +1,18 @@
 #ifndef _TGACCUMULATOR_HXX
 #define _TGACCUMULATOR_HXX
 
+#include <map>
+#include <vector>
+
 #include "tg_polygon_set.hxx"
 
+// The accumulated polygons are indexed in a uniform grid, so a diff only
+// joins the polygons that overlap the subject, rather than scanning them all.
+// Polygons covering more than TG_ACCUM_MAX_CELLS cells ( ocean, large
+// landclass ) are kept in a separate list that is always scanned.
+#define TG_ACCUM_CELL_SIZE      (0.01)      // grid cell size in degrees
+#define TG_ACCUM_MAX_CELLS      (256)       // max cells an entry is registered in
+
 struct tgAccumEntry
 {
 public:
@@ -22,13 +32,22 @@ public:
     
     
 private:
+    typedef std::pair<int, int> tgAccumCell;
+
     void                    GetAccumPolygonSet( const CGAL::Bbox_2& bb, cgalPoly_PolygonSet& accumPs );
     void                    AddAccumPolygonSet( const cgalPoly_PolygonSet& ps );
 
+    unsigned int            GetCells( const CGAL::Bbox_2& bb, tgAccumCell& min, tgAccumCell& max ) const;
+    void                    GetCandidates( const CGAL::Bbox_2& bb, std::vector<unsigned int>& candidates ) const;
+
     bool                        accumEmpty;
     cgalPoly_PolygonSet         accum_cgal;
 
-    std::list<tgAccumEntry>     accum_cgal_list;
+    std::vector<tgAccumEntry>   accum_cgal_list;
+
+    // grid cell -> indices into accum_cgal_list
+    std::map<tgAccumCell, std::vector<unsigned int> >   accum_grid;
+    std::vector<unsigned int>                           accum_large;
 };
 
 #endif // _TGACCUMULATOR_HXX
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <atomic>
+
 #include <boost/interprocess/sync/scoped_lock.hpp>
 #include <boost/interprocess/sync/named_mutex.hpp>
 
@@ -6,6 +8,8 @@
 #include <simgear/misc/sg_path.hxx>
 #include <simgear/io/lowlevel.hxx>
 
+#include <terragear/tg_trace.hxx>
+
 #include "tg_polygon_chop.hxx"
 #include "tg_shapefile.hxx"
 #include "tg_rectangle.hxx"
@@ -25,6 +29,110 @@
 
 #define DEBUG_CHOPPER   0
 
+#if DEBUG_CHOPPER
+static std::mutex debugLock;
+#endif
+
+tgChopperPool::~tgChopperPool()
+{
+    lock.lock();
+    stopping = true;
+    lock.unlock();
+    work.notify_all();
+
+    for ( unsigned int t=0; t<helpers.size(); t++ ) {
+        helpers[t].join();
+    }
+}
+
+void tgChopperPool::Run( unsigned int numItems, const std::function<void(unsigned int)>& fn )
+{
+#if !defined(CGAL_HAS_THREADS)
+    // CGAL statics are shared between threads - stay serial
+    for ( unsigned int i=0; i<numItems; i++ ) {
+        fn( i );
+    }
+#else
+    Job job;
+    job.fn       = &fn;
+    job.numItems = numItems;
+    job.next     = 0;
+    job.done     = 0;
+
+    std::unique_lock<std::mutex> guard( lock );
+
+    if ( numItems > 1 && numHelpers ) {
+        // helpers are started with the first job worth sharing
+        while ( helpers.size() < numHelpers ) {
+            helpers.push_back( std::thread( &tgChopperPool::Helper, this ) );
+        }
+
+        jobs.push_back( &job );
+        work.notify_all();
+    }
+
+    // the calling thread works, too
+    while ( job.next < job.numItems ) {
+        RunOne( guard, job );
+    }
+
+    // wait for the items the helpers claimed
+    while ( job.done < job.numItems ) {
+        finished.wait( guard );
+    }
+#endif
+}
+
+void tgChopperPool::RunOne( std::unique_lock<std::mutex>& guard, Job& job )
+{
+    unsigned int i = job.next++;
+    if ( job.next == job.numItems ) {
+        // all claimed - helpers look for other work
+        jobs.remove( &job );
+    }
+
+    guard.unlock();
+    (*job.fn)( i );
+    guard.lock();
+
+    // the job is on the runner's stack - don't touch it once it's done
+    if ( ++job.done == job.numItems ) {
+        finished.notify_all();
+    }
+}
+
+void tgChopperPool::Helper( void )
+{
+    std::unique_lock<std::mutex> guard( lock );
+
+    while ( !stopping ) {
+        if ( jobs.empty() ) {
+            work.wait( guard );
+        } else {
+            RunOne( guard, *jobs.front() );
+        }
+    }
+}
+
+// The lazy exact kernel computes a point's exact value the first time it is
+// needed, and stores it in the ( shared ) representation.  The chunks all
+// share the subject's points, so compute them before the threads start,
+// leaving the shared data read only.
+static void chopMakeExact( const cgalPoly_PolygonSet& ps )
+{
+    const cgalPoly_PolygonSet::Arrangement_2& arr = ps.arrangement();
+
+    cgalPoly_PolygonSet::Arrangement_2::Vertex_const_iterator vit;
+    for ( vit = arr.vertices_begin(); vit != arr.vertices_end(); ++vit ) {
+        CGAL::exact( vit->point() );
+    }
+
+    cgalPoly_PolygonSet::Arrangement_2::Edge_const_iterator eit;
+    for ( eit = arr.edges_begin(); eit != arr.edges_end(); ++eit ) {
+        CGAL::exact( eit->curve().supporting_line() );
+    }
+}
+
 void tgChopperChunk::setBuckets( const SGGeod& min, const SGGeod& max, bool checkBorders )
 {
     if ( checkBorders ) {
@@ -60,9 +168,11 @@ void tgChopper::Add( const tgPolygonSet& subject )
     std::vector<tgChopperChunk> chunks;
     PreChop( subject, chunks);
 
-    for ( unsigned int i=0; i < chunks.size(); i++ ) {
-        chunks[i].clip(bucket_id, root_path, &lock);
-    }
+    // each bucket belongs to a single chunk, so every bucket receives its
+    // polys in the same order as when the chunks are clipped serially
+    pool.Run( chunks.size(), [&]( unsigned int i ) {
+        chunks[i].clip( bucket_id, writer );
+    } );
 }
 
 void tgChopper::PreChop( const tgPolygonSet& subject, std::vector<tgChopperChunk>& chunks )
@@ -107,45 +217,60 @@ void tgChopper::PreChop( const tgPolygonSet& subject, std::vector<tgChopperChunk
     if ( width > CHUNK_X || height > CHUNK_Y ) {
         // break up the geometries, and add them to the queue
         // use exact match
+        std::vector<std::pair<double, double> > origins;
         for ( double x=startx; x<endx; x+=CHUNK_X ) {
             for ( double y=starty; y<endy; y+=CHUNK_Y ) {
-                char chunkname[256];
-                
+                origins.push_back( std::make_pair( x, y ) );
+            }
+        }
+
+        // the chunk intersections are independent - run them in parallel
+        std::vector<tgPolygonSet> results( origins.size() );
+
+        chopMakeExact( subject.getPs() );
+        pool.Run( origins.size(), [&]( unsigned int i ) {
+            double x = origins[i].first;
+            double y = origins[i].second;
+
+            double min_cor_x = x - PRECHOP_CORRECTION, max_cor_x = x + CHUNK_X + PRECHOP_CORRECTION;
+            double min_cor_y = y - PRECHOP_CORRECTION, max_cor_y = y + CHUNK_Y + PRECHOP_CORRECTION;
+
+            // create the clipping geometry for this piece
+            cgalPoly_Point base_pts[4];
+
+            base_pts[0] = cgalPoly_Point( min_cor_x, min_cor_y );
+            base_pts[1] = cgalPoly_Point( max_cor_x, min_cor_y );
+            base_pts[2] = cgalPoly_Point( max_cor_x, max_cor_y );
+            base_pts[3] = cgalPoly_Point( min_cor_x, max_cor_y );
+
+            cgalPoly_Polygon clip( base_pts, base_pts+4 );
+            results[i].intersection2( subject, clip );
+        } );
+
+        // then build the chunks in order
+        for ( unsigned int i=0; i<origins.size(); i++ ) {
+            if ( !results[i].isEmpty() ) {
+                double x = origins[i].first;
+                double y = origins[i].second;
+                char   chunkname[256];
+
                 sprintf(chunkname, "%0f_%0f", x, y );
-                
+                results[i].getMeta().setDescription( chunkname );
+
                 // we need two rectangles.  1 for the chunk, and one for calculating the buckets
                 // for the chunk.  we want the chunk slightly larger than what we need for chopping,
                 // but we don't want to include the partial buckets on the edges.
-                double min_bucket_x = x, max_bucket_x = x + CHUNK_X;
-                double min_bucket_y = y, max_bucket_y = y + CHUNK_Y;
-             
-                double min_cor_x = min_bucket_x - PRECHOP_CORRECTION, max_cor_x = max_bucket_x + PRECHOP_CORRECTION;
-                double min_cor_y = min_bucket_y - PRECHOP_CORRECTION, max_cor_y = max_bucket_y + PRECHOP_CORRECTION;
-                tgPolygonSet result;
-                
-                // create the clipping geometry for this piece
-                cgalPoly_Point base_pts[4];
-                
-                base_pts[0] = cgalPoly_Point( min_cor_x, min_cor_y );
-                base_pts[1] = cgalPoly_Point( max_cor_x, min_cor_y );
-                base_pts[2] = cgalPoly_Point( max_cor_x, max_cor_y );
-                base_pts[3] = cgalPoly_Point( min_cor_x, max_cor_y );
-                
-                cgalPoly_Polygon clip( base_pts, base_pts+4 );
-                result.intersection2( subject, clip );
-                
-                if ( !result.isEmpty() ) {
-                    result.getMeta().setDescription( chunkname );
-                    
-                    tgChopperChunk chunk( result );
-                    
-                    // add the correct buckets to chunk ( without correction )
-                    SGGeod gMin = SGGeod::fromDeg( min_bucket_x, min_bucket_y );
-                    SGGeod gMax = SGGeod::fromDeg( max_bucket_x, max_bucket_y );
-                    
-                    chunk.setBuckets ( gMin, gMax, true );
-                    chunks.push_back( chunk );
-                }
+                tgChopperChunk chunk( results[i] );
+
+                // add the correct buckets to chunk ( without correction )
+                SGGeod gMin = SGGeod::fromDeg( x, y );
+                SGGeod gMax = SGGeod::fromDeg( x + CHUNK_X, y + CHUNK_Y );
+
+                chunk.setBuckets ( gMin, gMax, true );
+                chunks.push_back( chunk );
+
+                // free the geometry - the chunk has it's own copy
+                results[i] = tgPolygonSet();
             }
         }
     } else {
@@ -163,20 +288,139 @@ void tgChopper::PreChop( const tgPolygonSet& subject, std::vector<tgChopperChunk
     }
 }
 
-void tgChopperChunk::clip( long int bucket_id, std::string& rootPath, std::mutex* lock )
+void tgChopperWriter::Take( tgChopperQueue& q, std::vector<tgChopperBatch>& batches )
+{
+    batches.push_back( tgChopperBatch() );
+    batches.back().bucket = q.bucket;
+    batches.back().seq    = q.taken++;
+    batches.back().polys.swap( q.polys );
+    numQueued -= batches.back().polys.size();
+}
+
+void tgChopperWriter::Add( const SGBucket& b, const std::string& material, const tgPolygonSet& poly )
+{
+    std::vector<tgChopperBatch> batches;
+
+    lock.lock();
+    tgChopperQueue& q = queued[b.gen_index()];
+    q.bucket = b;
+    q.polys.push_back( tgChopperPoly( material, poly ) );
+    numQueued++;
+
+    if ( q.polys.size() >= CHOPPER_BATCH_SIZE ) {
+        Take( q, batches );
+    } else if ( numQueued >= CHOPPER_MAX_QUEUED ) {
+        // too much queued - write the largest queues, not just the one
+        // we added to, so each write frees as much as it can
+        while ( numQueued > CHOPPER_FLUSH_QUEUED ) {
+            std::map<long int, tgChopperQueue>::iterator largest = queued.begin();
+            std::map<long int, tgChopperQueue>::iterator it;
+            for ( it = queued.begin(); it != queued.end(); it++ ) {
+                if ( it->second.polys.size() > largest->second.polys.size() ) {
+                    largest = it;
+                }
+            }
+
+            Take( largest->second, batches );
+        }
+    }
+    lock.unlock();
+
+    // write outside of the queue lock
+    for ( unsigned int i=0; i<batches.size(); i++ ) {
+        Write( batches[i] );
+    }
+}
+
+void tgChopperWriter::Flush( void )
+{
+    std::vector<tgChopperBatch> batches;
+
+    lock.lock();
+    std::map<long int, tgChopperQueue>::iterator it;
+    for ( it = queued.begin(); it != queued.end(); it++ ) {
+        if ( !it->second.polys.empty() ) {
+            Take( it->second, batches );
+        }
+    }
+    lock.unlock();
+
+    for ( unsigned int i=0; i<batches.size(); i++ ) {
+        Write( batches[i] );
+    }
+}
+
+void tgChopperWriter::Write( const tgChopperBatch& batch )
+{
+    long int    tileId   = batch.bucket.gen_index();
+    std::string polyfile = root_path + "/" + batch.bucket.gen_base_path() + "/" + batch.bucket.gen_index_str();
+
+    TG_TRACE_SCOPE( "chopper write" );
+    TG_TRACE_COUNTER( "chopper polys written", batch.polys.size() );
+
+    // wait for the earlier batches of this bucket.  this also makes us the
+    // only writer of the bucket's datasource until we are done.  queues are
+    // never erased, so the reference stays valid
+    {
+        TG_TRACE_SCOPE( "chopper dataset wait" );
+        std::unique_lock<std::mutex> guard( lock );
+        tgChopperQueue& q = queued[tileId];
+        while ( q.written != batch.seq ) {
+            batchWritten.wait( guard );
+        }
+    }
+
+    // lock mutex to simgear directory creation
+    dirLock.lock();
+    SGPath sgp( polyfile );
+    sgp.create_dir( 0755 );
+    dirLock.unlock();
+
+    // save chopped polygons to a Shapefile in layers named from material
+    GDALDataset* poDS = tgPolygonSet::openDatasource( polyfile.c_str() );
+    if ( poDS ) {
+        for ( unsigned int i=0; i<batch.polys.size(); i++ ) {
+            OGRLayer* poLayer = tgPolygonSet::openLayer( poDS, wkbPolygon25D, tgPolygonSet::LF_ALL, batch.polys[i].material.c_str() );
+            if ( poLayer ) {
+                batch.polys[i].poly.toShapefile( poLayer );
+            }
+        }
+
+        GDALClose( poDS );
+    } else {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgChopperWriter - failed to open datasource " << polyfile );
+    }
+
+    // let the next batch of this bucket go
+    lock.lock();
+    queued[tileId].written++;
+    lock.unlock();
+    batchWritten.notify_all();
+
+    SG_LOG( SG_GENERAL, SG_DEBUG, "tgChopperWriter - wrote " << batch.polys.size() << " polys to " << polyfile );
+}
+
+// running average of the clip time, shared by all chopping threads
+static void chopTime( const SGTimeStamp& begin )
+{
+    static std::atomic<uint64_t> total_usecs( 0 );
+    static std::atomic<uint64_t> num_chops( 0 );
+
+    uint64_t usecs = ( SGTimeStamp::now() - begin ).toUSecs();
+    uint64_t total = ( total_usecs += usecs );
+    uint64_t count = ++num_chops;
+
+    SG_LOG( SG_GENERAL, SG_DEBUG, "tgChopper Clip - avg chop time: " << total / 1000.0 / count );
+}
+
+void tgChopperChunk::clip( long int bucket_id, tgChopperWriter& writer )
 {
     for ( unsigned int i=0; i<buckets.size(); i++ ) {
         cgalPoly_Point    base_pts[4];
         const std::string material = chunk.getMeta().material;
         SGGeod            pt;
-        char              layer[256];
         tgPolygonSet      result;
     
-        SGTimeStamp       chop_begin, chop_end, chop_time;
-    
-        static double     total_chop_time = 0;
-        static unsigned long num_chops = 1;
-    
         // set up clipping tile
         pt = buckets[i].get_corner( SG_BUCKET_SW );
         base_pts[0] = cgalPoly_Point( pt.getLongitudeDeg()-CLIP_CORRECTION, pt.getLatitudeDeg()-CLIP_CORRECTION );
@@ -194,7 +438,7 @@ void tgChopperChunk::clip( long int bucket_id, std::string& rootPath, std::mutex
     
         sprintf(debugDatasetName, "./Chopper/tile_%s_%s", b.gen_index_str().c_str(), material.c_str() );
     
-        lock->lock();
+        debugLock.lock();
         SGPath sgp( debugDatasetName );
         sgp.create_dir( 0755 );
         
@@ -209,18 +453,21 @@ void tgChopperChunk::clip( long int bucket_id, std::string& rootPath, std::mutex
         tgPolygonSet::toDebugShapefile( poLayerTile, base, "tile" );        
 #endif
     
-        chop_begin.stamp();
         // new geometry is intersection of original geometry and tile
-        result.intersection2( chunk, base );
-        chop_end.stamp();
-        chop_time = chop_end-chop_begin;
+        SGTimeStamp chop_begin;
+        chop_begin.stamp();
+        {
+            TG_TRACE_SCOPE( "chopper clip" );
+            result.intersection2( chunk, base );
+        }
+        chopTime( chop_begin );
     
 #if DEBUG_CHOPPER
         tgPolygonSet::toDebugShapefile( poLayerResult, result.getPs(), "result" );
     
         curClip++;
         GDALClose( poDS );
-        lock->unlock();
+        debugLock.unlock();
 #endif
     
         if ( !result.isEmpty() ) {
@@ -231,32 +478,8 @@ void tgChopperChunk::clip( long int bucket_id, std::string& rootPath, std::mutex
         
             long int cur_bucket = buckets[i].gen_index();
             if ( ( bucket_id < 0 ) || (cur_bucket == bucket_id ) ) {
-                std::string path = rootPath + "/" + buckets[i].gen_base_path();
-                std::string polyfile = path + "/" + buckets[i].gen_index_str();
-            
-                // lock mutex to simgear directory creation
-                lock->lock();
-                SGPath sgp( polyfile );
-                sgp.create_dir( 0755 );
-                //lock.unlock();
-            
-                // now get a per dataset lock
-                //dataset.Request( cur_bucket );
-            
-                snprintf( layer, 256, "%s_%s", material.c_str(), result.getMeta().getMetaType().c_str() );
-            
-                // save chopped polygon to a Shapefile in layer named from material
-                result.toShapefile( polyfile.c_str(), material.c_str() );
-            
-                // Release per dataset lock
-                //dataset.Release( cur_bucket );
-                lock->unlock();
+                writer.Add( buckets[i], material, result );
             }
         }
-
-        // dump debug...
-        total_chop_time += chop_time.toMSecs();
-        SG_LOG( SG_GENERAL, SG_DEBUG, "tgChopper Clip - avg chop time: " << total_chop_time/num_chops );
-        num_chops++;        
     }
 }
@@ -1,12 +1,120 @@
+#include <condition_variable>
+#include <functional>
+#include <list>
 #include <map>
 #include <mutex>
+#include <thread>
 
 #include <simgear/timing/timestamp.hxx>
 #include <simgear/bucket/newbucket.hxx>
 
-#include <terragear/tg_dataset_protect.hxx>
 #include "tg_polygon_set.hxx"
 
+// Chopped polygons are queued per bucket, and written in batches, so a
+// bucket's datasource is opened once per batch rather than once per polygon.
+// Batches for different buckets are written concurrently by the threads
+// adding them.  Each batch taken from a bucket's queue gets the next sequence
+// number of that bucket, and is only written once all earlier batches of the
+// bucket are, so a bucket's polygons are written in the order they were added.
+#define CHOPPER_BATCH_SIZE      (64)        // polygons queued per bucket before they are written
+#define CHOPPER_MAX_QUEUED      (16384)     // write the largest queues once this many polygons are queued
+#define CHOPPER_FLUSH_QUEUED    (12288)     // ... until no more than this many are left
+
+struct tgChopperPoly
+{
+public:
+    tgChopperPoly( const std::string& m, const tgPolygonSet& p ) : material(m), poly(p) {}
+
+    std::string     material;
+    tgPolygonSet    poly;
+};
+
+struct tgChopperQueue
+{
+public:
+    tgChopperQueue() : taken(0), written(0) {}
+
+    SGBucket                    bucket;
+    std::vector<tgChopperPoly>  polys;
+    unsigned long               taken;      // batches taken from the queue
+    unsigned long               written;    // ... and how many of them are written
+};
+
+struct tgChopperBatch
+{
+    SGBucket                    bucket;
+    unsigned long               seq;
+    std::vector<tgChopperPoly>  polys;
+};
+
+class tgChopperWriter
+{
+public:
+    tgChopperWriter( const std::string& path ) : root_path(path), numQueued(0) {}
+    ~tgChopperWriter() { Flush(); }
+
+    void Add( const SGBucket& b, const std::string& material, const tgPolygonSet& poly );
+
+    // write everything still queued
+    void Flush( void );
+
+private:
+    // called with the queue lock held
+    void Take( tgChopperQueue& q, std::vector<tgChopperBatch>& batches );
+    void Write( const tgChopperBatch& batch );
+
+    std::string                         root_path;
+
+    std::mutex                          lock;       // protects the queues
+    std::condition_variable             batchWritten;
+    std::map<long int, tgChopperQueue>  queued;
+    unsigned int                        numQueued;
+
+    std::mutex                          dirLock;    // simgear directory creation
+};
+
+// Large polys are pre chopped into many chunks, which are clipped by a
+// bounded pool of helper threads, shared by all threads adding to the
+// chopper.  The thread running a job works on it too - claiming the next
+// unprocessed item until none are left - so a job always makes progress,
+// and the number of clipping threads doesn't grow with the number of
+// features chopped at once.  Results are stored by item index, so the
+// output doesn't depend on which thread ran first.
+class tgChopperPool
+{
+public:
+    tgChopperPool() : numHelpers(0), stopping(false) {}
+    ~tgChopperPool();
+
+    // number of helper threads - set before the first Run
+    void SetNumHelpers( unsigned int n ) { numHelpers = n; }
+
+    // call fn( i ) for every i < numItems, and return once all have
+    void Run( unsigned int numItems, const std::function<void(unsigned int)>& fn );
+
+private:
+    struct Job
+    {
+        const std::function<void(unsigned int)>* fn;
+        unsigned int    numItems;
+        unsigned int    next;       // next unclaimed item
+        unsigned int    done;
+    };
+
+    // called with the pool lock held
+    void RunOne( std::unique_lock<std::mutex>& guard, Job& job );
+    void Helper( void );
+
+    unsigned int                numHelpers;
+    std::vector<std::thread>    helpers;
+
+    std::mutex                  lock;
+    std::condition_variable     work;       // a job was added, or we are stopping
+    std::condition_variable     finished;   // the last item of a job is done
+    std::list<Job*>             jobs;       // jobs with unclaimed items
+    bool                        stopping;
+};
+
 class tgChopperChunk
 {
 public:
@@ -16,7 +124,7 @@ public:
     
     void setBuckets( const SGGeod& min, const SGGeod& max, bool checkBorders );
     
-    void clip( long int bucket_id, std::string& rootPath, std::mutex* lock );
+    void clip( long int bucket_id, tgChopperWriter& writer );
     
 private:
     std::vector<SGBucket>   buckets;
@@ -26,18 +134,26 @@ private:
 class tgChopper
 {
 public:
-    tgChopper( const std::string& path, long int bid = -1 ) {
-        root_path = path;
-        bucket_id = bid;
+    tgChopper( const std::string& path, long int bid = -1 ) : writer(path) {
+        root_path   = path;
+        bucket_id   = bid;
     }
 
     void Add( const tgPolygonSet& poly );
 
+    // number of threads clipping the chunks of each large poly - the
+    // adding thread, and n-1 helpers shared by all adding threads.
+    // 1 by default.  set before the first Add
+    void SetNumThreads( unsigned int n ) { pool.SetNumHelpers( n > 1 ? n - 1 : 0 ); }
+
+    // write all chopped polygons - call once all Adds are complete
+    void Flush( void ) { writer.Flush(); }
+
 private:
     void PreChop( const tgPolygonSet& subject, std::vector<tgChopperChunk>& chunks );
 
     long int         bucket_id;     // set if we only want to save a single bucket
     std::string      root_path;
-    std::mutex          lock;
-    tgDatasetAcess   dataset;
+    tgChopperPool    pool;
+    tgChopperWriter  writer;
 };
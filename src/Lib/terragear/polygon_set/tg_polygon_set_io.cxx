@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include <simgear/debug/logstream.hxx>
 
 #include "tg_polygon_set.hxx"
@@ -132,7 +134,9 @@ GDALDataset* tgPolygonSet::openDatasource( const char* datasource_name )
     
     SG_LOG( SG_GENERAL, SG_DEBUG, "Open Datasource: " << datasource_name );
     
-    GDALAllRegister();
+    // only need to register drivers once
+    static std::once_flag registered;
+    std::call_once( registered, GDALAllRegister );
     
     poDriver = GetGDALDriverManager()->GetDriverByName( format_name );
     if ( poDriver ) {    
@@ -23,9 +23,12 @@
 #  include <config.h>
 #endif
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 
 #include <simgear/compiler.h>
+#include <simgear/constants.h>
 #include <simgear/io/iostreams/sgstream.hxx>
 #include <simgear/debug/logstream.hxx>
 #include <simgear/misc/strutils.hxx>
@@ -39,8 +42,11 @@ using std::string;
 
 tgArray::tgArray( void ):
   array_in(NULL),
+  raw_open(false),
   fitted_in(NULL),
-  in_data(NULL)
+  fit_open(false),
+  in_data(NULL),
+  all_void(false)
 {
 
 }
@@ -48,8 +54,11 @@ tgArray::tgArray( void ):
 
 tgArray::tgArray( const string &file ):
   array_in(NULL),
+  raw_open(false),
   fitted_in(NULL),
-      in_data(NULL)
+  fit_open(false),
+      in_data(NULL),
+      all_void(false)
 {
     tgArray::open(file);
 }
@@ -57,15 +66,29 @@ tgArray::tgArray( const string &file ):
 
 // open an Array file (and fitted file if it exists)
 bool tgArray::open( const string& file_base ) {
-    // open array data file
-    string array_name = file_base + ".arr.gz";
+    // open array data file - the raw format if we have it
+    raw_name = file_base + TG_ARRAY_RAW_EXT;
+    raw_open = tgArrayRawOpen( raw_name, raw_header );
 
-    array_in = gzopen( array_name.c_str(), "rb" );
-    if (array_in == NULL) {
-        return false;
+    if ( !raw_open ) {
+        string array_name = file_base + ".arr.gz";
+
+        array_in = gzopen( array_name.c_str(), "rb" );
+        if (array_in == NULL) {
+            return false;
+        }
+    }
+
+    // open fitted data file - the binary one if terrafit wrote it
+    tgArrayFitHeader fit_header;
+    fit_name = file_base + TG_ARRAY_FIT_EXT;
+    fit_open = tgArrayFitOpen( fit_name, fit_header );
+
+    if ( fit_open ) {
+        SG_LOG(SG_GENERAL, SG_DEBUG, "  Opening fitted data file: " << fit_name );
+        return is_open();
     }
 
-    // open fitted data file
     string fitted_name = file_base + ".fit.gz";
     fitted_in = new sg_gzifstream( fitted_name );
     if ( !fitted_in->is_open() ) {
@@ -80,7 +103,7 @@ bool tgArray::open( const string& file_base ) {
         SG_LOG(SG_GENERAL, SG_DEBUG, "  Opening fitted data file: " << fitted_name );
     }
 
-    return (array_in != NULL) ? true : false;
+    return is_open();
 }
 
 
@@ -91,6 +114,8 @@ tgArray::close() {
         gzclose(array_in);
         array_in = NULL;
     }
+    raw_open = false;
+    fit_open = false;
 
     if (fitted_in ) {
         fitted_in->close();
@@ -107,6 +132,8 @@ tgArray::unload( void ) {
         gzclose(array_in);
         array_in = NULL;
     }
+    raw_open = false;
+    fit_open = false;
 
     if (fitted_in ) {
         fitted_in->close();
@@ -114,10 +141,7 @@ tgArray::unload( void ) {
         fitted_in = NULL;
     }
 
-    if (in_data) {
-        delete[] in_data;
-        in_data = NULL;
-    }
+    free_data();
 
     corner_list.clear();
     fitted_list.clear();
@@ -129,8 +153,12 @@ bool
 tgArray::parse( const SGBucket& b ) {
     // Parse/load the array data file
     SG_LOG(SG_GENERAL, SG_DEBUG, " Parse bucket centered at " << b.get_center() );
-    
-    if ( array_in ) {
+
+    free_data();
+
+    if ( raw_open ) {
+        parse_raw();
+    } else if ( array_in ) {
         parse_bin();
     } else {
         // file not open (not found?), fill with zero'd data        
@@ -156,7 +184,9 @@ tgArray::parse( const SGBucket& b ) {
     }
 
     // Parse/load the fitted data file
-    if ( fitted_in && fitted_in->is_open() ) {
+    if ( fit_open ) {
+        tgArrayFitRead( fit_name, fitted_list );
+    } else if ( fitted_in && fitted_in->is_open() ) {
         int fitted_size;
         double x, y, z;
         *fitted_in >> fitted_size;
@@ -167,6 +197,9 @@ tgArray::parse( const SGBucket& b ) {
         }
     }
 
+    // fresh data - build the void lookup up front
+    build_nearest_nonvoid();
+
     return true;
 }
 
@@ -203,8 +236,47 @@ void tgArray::parse_bin()
     
 }
 
-// write an Array file
-bool tgArray::write( const string root_dir, SGBucket& b ) {
+void tgArray::parse_raw()
+{
+    if ( !tgArrayRawLoad( raw_name, raw_header, raw_data ) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "\nThe .arr.raw file " << raw_name << " could not be loaded."
+        << "\nPlease rebuild it using the latest TerraGear tools.");
+        exit(1);
+    }
+
+    originx  = raw_header.originx;
+    originy  = raw_header.originy;
+    cols     = raw_header.cols;
+    col_step = raw_header.col_step;
+    rows     = raw_header.rows;
+    row_step = raw_header.row_step;
+
+    // no copy - this is the mapped file, if it's uncompressed
+    in_data = raw_data.data;
+
+    SG_LOG(SG_GENERAL, SG_DEBUG, "    origin  = " << originx << "  " << originy );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "    cols = " << cols << "  rows = " << rows );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "    col_step = " << col_step << "  row_step = " << row_step );
+    SG_LOG(SG_GENERAL, SG_DEBUG, "    " << ( raw_data.mapBase ? "mapped" : "loaded" ) << " " << raw_name );
+}
+
+// free the elevation data - allocated, or loaded from a raw array
+void tgArray::free_data()
+{
+    if ( raw_data.data ) {
+        tgArrayRawRelease( raw_data );
+    } else if ( in_data ) {
+        delete[] in_data;
+    }
+    in_data = NULL;
+
+    nearest_nonvoid.clear();
+    all_void = false;
+}
+
+// write an Array file - as a raw array, which open() prefers over any
+// .arr.gz next to it
+bool tgArray::write( const string root_dir, SGBucket& b, int compressLevel ) {
     // generate output file name
     string base = b.gen_base_path();
     string path = root_dir + "/" + base;
@@ -212,26 +284,24 @@ bool tgArray::write( const string root_dir, SGBucket& b ) {
     sgp.append( "dummy" );
     sgp.create_dir( 0755 );
 
-    string array_file = path + "/" + b.gen_index_str() + ".arr.new.gz";
+    string array_file = path + "/" + b.gen_index_str() + TG_ARRAY_RAW_EXT;
     SG_LOG(SG_GENERAL, SG_DEBUG, "array_file = " << array_file );
 
-    // write the file
-    gzFile fp;
-    if ( (fp = gzopen( array_file.c_str(), "wb9" )) == NULL ) {
-	SG_LOG(SG_GENERAL, SG_ALERT, "ERROR:  cannot open " << array_file << " for writing!" );
-	return false;
-    }
-
-    SG_LOG(SG_GENERAL, SG_DEBUG, "origin = " << originx << ", " << originy );
-    gzprintf( fp, "%d %d\n", (int)originx, (int)originy );
-    gzprintf( fp, "%d %d %d %d\n", cols, (int)col_step, rows, (int)row_step );
+    // column major, as we keep it
+    std::vector<short> data;
+    data.reserve( (size_t)cols * rows );
     for ( int i = 0; i < cols; ++i ) {
 	for ( int j = 0; j < rows; ++j ) {
-	    gzprintf( fp, "%d ", get_array_elev(i, j) );
+	    data.push_back( get_array_elev(i, j) );
 	}
-	gzprintf( fp, "\n" );
     }
-    gzclose(fp);
+
+    // written to a temporary, and renamed into place
+    if ( !tgArrayRawWrite( array_file, (int)originx, (int)originy, cols, (int)col_step, rows, (int)row_step,
+                           data.empty() ? NULL : &data[0], compressLevel ) ) {
+	SG_LOG(SG_GENERAL, SG_ALERT, "ERROR:  cannot write " << array_file );
+	return false;
+    }
 
     return true;
 }
@@ -318,55 +388,193 @@ void tgArray::remove_voids( ) {
             }
         }
     }
+
+    // arrays may be shared read only from here on - so leave the
+    // closest non-void lookup up to date ( with the voids filled, there
+    // usually isn't one )
+    build_nearest_nonvoid();
 }
 
 
-// Return the elevation of the closest non-void grid point to lon, lat
-double tgArray::closest_nonvoid_elev( double lon, double lat ) const {
-    double mindist = 99999999999.9;
-    double minelev = -9999.0;
-    SGGeod p0 = SGGeod::fromDeg( lon, lat );
+// Build the closest non-void grid point lookup.
+//
+// This is a two pass euclidean distance transform ( Felzenszwalb and
+// Huttenlocher ) that remembers the site instead of just the distance.
+// The first pass finds the closest non-void point in each column, the second
+// takes the lower envelope of the parabolas those points make along each row.
+// Distances are in arc seconds, with longitude scaled by cos( lat ) at the
+// center of the array - close enough to meters over a single array.
+//
+// Arrays without voids ( most of them, and all of them after remove_voids )
+// don't need the table.
+void tgArray::build_nearest_nonvoid() {
+    const int    size = cols * rows;
+    const double wy   = row_step;
+    const double wx   = col_step * cos( (originy + 0.5 * rows * row_step) / 3600.0 * SGD_DEGREES_TO_RADIANS );
+
+    std::vector<int>().swap( nearest_nonvoid );
+    all_void = false;
+
+    if ( !in_data || !size ) {
+        all_void = true;
+        return;
+    }
+
+    int voids = 0;
+    for ( int i = 0; i < size; i++ ) {
+        if ( in_data[i] <= -9000 ) {
+            voids++;
+        }
+    }
+
+    if ( voids == 0 ) {
+        return;
+    }
+    if ( voids == size ) {
+        all_void = true;
+        return;
+    }
+
+    nearest_nonvoid.assign( size, -1 );
+
+    // pass 1 : closest non-void row in each column
+    std::vector<int> colNearest( size, -1 );
+    for ( int col = 0; col < cols; col++ ) {
+        int last = -1;
+        for ( int row = 0; row < rows; row++ ) {
+            if ( get_array_elev(col, row) > -9000 ) {
+                last = row;
+            }
+            colNearest[col * rows + row] = last;
+        }
+
+        last = -1;
+        for ( int row = rows - 1; row >= 0; row-- ) {
+            if ( get_array_elev(col, row) > -9000 ) {
+                last = row;
+            }
+
+            int& n = colNearest[col * rows + row];
+            if ( last >= 0 && ( n < 0 || (last - row) < (row - n) ) ) {
+                n = last;
+            }
+        }
+    }
+
+    // pass 2 : lower envelope of the column distances along each row
+    std::vector<double> f( cols );
+    std::vector<int>    v( cols );
+    std::vector<double> z( cols + 1 );
 
     for ( int row = 0; row < rows; row++ ) {
+        int k = -1;
+
         for ( int col = 0; col < cols; col++ ) {
-            SGGeod p1 = SGGeod::fromDeg( originx + col * col_step, originy + row * row_step );
-            double dist = SGGeodesy::distanceM( p0, p1 );
-            double elev = get_array_elev(col, row);
-            if ( dist < mindist && elev > -9000 ) {
-                mindist = dist;
-                minelev = elev;
+            int n = colNearest[col * rows + row];
+            if ( n < 0 ) {
+                continue;
+            }
+
+            double dy = (n - row) * wy;
+            f[col] = dy * dy;
+
+            // position of the parabola with it's vertex at q
+            double q = col * wx;
+            while ( k >= 0 ) {
+                double r = v[k] * wx;
+                double s = ( (f[col] + q * q) - (f[v[k]] + r * r) ) / ( 2.0 * (q - r) );
+                if ( s > z[k] ) {
+                    k++;
+                    v[k]   = col;
+                    z[k]   = s;
+                    z[k+1] = HUGE_VAL;
+                    break;
+                }
+                k--;
+            }
+
+            if ( k < 0 ) {
+                k      = 0;
+                v[0]   = col;
+                z[0]   = -HUGE_VAL;
+                z[1]   = HUGE_VAL;
             }
         }
+
+        if ( k < 0 ) {
+            // can't happen - there is at least one non-void point
+            continue;
+        }
+
+        int j = 0;
+        for ( int col = 0; col < cols; col++ ) {
+            while ( z[j+1] < col * wx ) {
+                j++;
+            }
+            nearest_nonvoid[col * rows + row] = v[j] * rows + colNearest[v[j] * rows + row];
+        }
     }
+}
 
-    if ( minelev > -9999.0 ) {
-        return minelev;
-    } else {
-        return 0.0;
+int tgArray::nearest_nonvoid_index( int col, int row ) const {
+    if ( nearest_nonvoid.empty() ) {
+        return all_void ? -1 : col * rows + row;
     }
+
+    return nearest_nonvoid[col * rows + row];
 }
 
+// Return the elevation of the closest non-void grid point to lon, lat
+// ( in arc seconds ).  Looks up the closest non-void points of the grid
+// cell containing lon, lat and returns the closest of them.
+double tgArray::closest_nonvoid_elev( double lon, double lat ) const {
+    if ( all_void ) {
+        return 0.0;
+    }
+
+    const double wx = cos( lat / 3600.0 * SGD_DEGREES_TO_RADIANS );
 
-// return the current altitude based on grid data.
-// TODO: We should rewrite this to interpolate exact values, but for now this is good enough
-double tgArray::altitude_from_grid( double lon, double lat ) const {
-    // we expect incoming (lon,lat) to be in arcsec for now
+    double xlocal = (lon - originx) / col_step;
+    double ylocal = (lat - originy) / row_step;
 
-    double xlocal, ylocal, dx, dy, zA, zB, elev;
-    int x1, x2, x3, y1, y2, y3;
-    float z1, z2, z3;
-    int xindex, yindex;
+    int xindex = (int)floor( xlocal );
+    int yindex = (int)floor( ylocal );
 
-    /* determine if we are in the lower triangle or the upper triangle
-       ______
-       |   /|
-       |  / |
-       | /  |
-       |/   |
-       ------
+    double mindist = HUGE_VAL;
+    int    minidx  = -1;
 
-       then calculate our end points
-     */
+    for ( int i = xindex; i <= xindex + 1; i++ ) {
+        for ( int j = yindex; j <= yindex + 1; j++ ) {
+            int col = std::min( std::max( i, 0 ), cols - 1 );
+            int row = std::min( std::max( j, 0 ), rows - 1 );
+            int idx = nearest_nonvoid_index( col, row );
+
+            if ( idx < 0 ) {
+                continue;
+            }
+
+            double dx = ( originx + (idx / rows) * col_step - lon ) * wx;
+            double dy = ( originy + (idx % rows) * row_step - lat );
+            double dist = dx * dx + dy * dy;
+            if ( dist < mindist ) {
+                mindist = dist;
+                minidx  = idx;
+            }
+        }
+    }
+
+    if ( minidx >= 0 ) {
+        return in_data[minidx];
+    } else {
+        return 0.0;
+    }
+}
+
+
+// find the grid cell containing lon, lat ( in arc seconds ), and the
+// position within it.  Returns false if the point is outside of the array
+bool tgArray::grid_cell( double lon, double lat, int& xindex, int& yindex, double& dx, double& dy ) const {
+    double xlocal, ylocal;
 
     xlocal = (lon - originx) / col_step;
     ylocal = (lat - originy) / row_step;
@@ -390,26 +598,40 @@ double tgArray::altitude_from_grid( double lon, double lat ) const {
     SG_LOG(SG_GENERAL, SG_ALERT, " originx: " << originx << " originy: " << originy );    
     SG_LOG(SG_GENERAL, SG_ALERT, " xindex: " << xindex << " cols: " << cols );
     SG_LOG(SG_GENERAL, SG_ALERT, " yindex: " << yindex << " rows: " << rows );
-    return -9999;
+    return false;
     }
 
     dx = xlocal - xindex;
     dy = ylocal - yindex;
 
-    if ( dx > dy ) {
-	// lower triangle
+    return true;
+}
+
+// interpolate the elevation at dx, dy within the grid cell at xindex, yindex
+double tgArray::interpolate_cell( int xindex, int yindex, double dx, double dy, double lon, double lat ) const {
+    double zA, zB, elev;
+    float z1, z2, z3;
+
+    /* determine if we are in the lower triangle or the upper triangle
+       ______
+       |   /|
+       |  / |
+       | /  |
+       |/   |
+       ------
 
-	x1 = xindex;
-	y1 = yindex;
-	z1 = get_array_elev(x1, y1);
+       then calculate our end points
+     */
 
-	x2 = xindex + 1;
-	y2 = yindex;
-	z2 = get_array_elev(x2, y2);
+    // the cell's corners are adjacent in memory - column major
+    const short* sw = in_data + (xindex * rows) + yindex;
 
-	x3 = xindex + 1;
-	y3 = yindex + 1;
-	z3 = get_array_elev(x3, y3);
+    z1 = sw[0];
+
+    if ( dx > dy ) {
+	// lower triangle ( xindex, yindex ), ( xindex+1, yindex ), ( xindex+1, yindex+1 )
+	z2 = sw[rows];
+	z3 = sw[rows + 1];
 
         if ( z1 < -9000 || z2 < -9000 || z3 < -9000 ) {
             // don't interpolate off a void
@@ -425,19 +647,9 @@ double tgArray::altitude_from_grid( double lon, double lat ) const {
 	    elev = zA;
 	}
     } else {
-	// upper triangle
-
-	x1 = xindex;
-	y1 = yindex;
-	z1 = get_array_elev(x1, y1);
-
-	x2 = xindex;
-	y2 = yindex + 1;
-	z2 = get_array_elev(x2, y2);
-
-	x3 = xindex + 1;
-	y3 = yindex + 1;
-	z3 = get_array_elev(x3, y3);
+	// upper triangle ( xindex, yindex ), ( xindex, yindex+1 ), ( xindex+1, yindex+1 )
+	z2 = sw[1];
+	z3 = sw[rows + 1];
 
         if ( z1 < -9000 || z2 < -9000 || z3 < -9000 ) {
             // don't interpolate off a void
@@ -457,13 +669,66 @@ double tgArray::altitude_from_grid( double lon, double lat ) const {
     return elev;
 }
 
+// return the current altitude based on grid data.
+// TODO: We should rewrite this to interpolate exact values, but for now this is good enough
+double tgArray::altitude_from_grid( double lon, double lat ) const {
+    // we expect incoming (lon,lat) to be in arcsec for now
+    int    xindex, yindex;
+    double dx, dy;
+
+    if ( !grid_cell( lon, lat, xindex, yindex, dx, dy ) ) {
+        return -9999;
+    }
+
+    return interpolate_cell( xindex, yindex, dx, dy, lon, lat );
+}
+
+// return the altitudes of count points ( in arc seconds ) based on grid data.
+// The points are visited in grid order, so each cell of the array is loaded
+// once no matter how the callers points are ordered.  Points outside of the
+// array get -9999, just like altitude_from_grid
+void tgArray::altitudes_from_grid( unsigned int count, const double* lon, const double* lat, double* elev ) const {
+    std::vector< std::pair<int, unsigned int> > order;
+    std::vector<double> dx( count ), dy( count );
+
+    order.reserve( count );
+    for ( unsigned int i = 0; i < count; i++ ) {
+        int xindex, yindex;
+
+        if ( grid_cell( lon[i], lat[i], xindex, yindex, dx[i], dy[i] ) ) {
+            order.push_back( std::make_pair( (xindex * rows) + yindex, i ) );
+        } else {
+            elev[i] = -9999;
+        }
+    }
+
+    std::sort( order.begin(), order.end() );
+
+    for ( unsigned int i = 0; i < order.size(); i++ ) {
+        unsigned int p = order[i].second;
+
+        elev[p] = interpolate_cell( order[i].first / rows, order[i].first % rows, dx[p], dy[p], lon[p], lat[p] );
+    }
+}
+
+void tgArray::altitudes_from_grid( const std::vector<SGGeod>& geods, std::vector<double>& elevs ) const {
+    std::vector<double> lon( geods.size() ), lat( geods.size() );
+
+    for ( unsigned int i = 0; i < geods.size(); i++ ) {
+        lon[i] = geods[i].getLongitudeDeg() * 3600.0;
+        lat[i] = geods[i].getLatitudeDeg()  * 3600.0;
+    }
+
+    elevs.resize( geods.size() );
+    if ( !geods.empty() ) {
+        altitudes_from_grid( geods.size(), &lon[0], &lat[0], &elevs[0] );
+    }
+}
+
 
 tgArray::~tgArray( void )
 {
-    if (in_data) {
-        delete[] in_data;
-        in_data = NULL;
-    }
+    free_data();
 
     if (array_in) {
         gzclose(array_in);
@@ -489,7 +754,7 @@ void tgArray::set_array_elev( int col, int row, int val )
 
 bool tgArray::is_open() const
 {
-  if ( array_in != NULL ) {
+  if ( array_in != NULL || raw_open ) {
       return true;
   } else {
       return false;
@@ -24,18 +24,34 @@
 #define _TG_ARRAY_HXX
 
 #include <simgear/compiler.h>
+
+#include <vector>
+
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/math/sg_types.hxx>
 #include <simgear/io/iostreams/sgstream.hxx>
 
+#include "tg_array_fit.hxx"
+#include "tg_array_raw.hxx"
+
 class tgArray {
 
 private:
     gzFile array_in;
 
+    // raw array file - used in preference to the .arr.gz
+    std::string      raw_name;
+    tgArrayRawHeader raw_header;
+    bool             raw_open;
+    tgArrayRawData   raw_data;
+
     // fitted file pointer
     sg_gzifstream *fitted_in;
 
+    // binary fitted file - used in preference to the .fit.gz
+    std::string      fit_name;
+    bool             fit_open;
+
     // coordinates (in arc seconds) of south west corner
     double originx, originy;
 
@@ -48,11 +64,25 @@ private:
     // pointers to the actual grid data allocated here
     short *in_data;
 
+    // index of the closest non-void grid point to each grid point.  Built
+    // by parse() and remove_voids(), and only read after that - so arrays
+    // can be shared between threads.  Empty if the array has no voids
+    // ( every point is its own closest ), or is all void
+    std::vector<int> nearest_nonvoid;
+    bool all_void;
+
     // output nodes
     std::vector<SGGeod> corner_list;
     std::vector<SGGeod> fitted_list;
 
     void parse_bin();
+    void parse_raw();
+    void free_data();
+    void build_nearest_nonvoid();
+    int nearest_nonvoid_index( int col, int row ) const;
+
+    bool grid_cell( double lon, double lat, int& xindex, int& yindex, double& dx, double& dy ) const;
+    double interpolate_cell( int xindex, int yindex, double dx, double dy, double lon, double lat ) const;
 public:
 
     // Constructor
@@ -74,8 +104,8 @@ public:
     // parse a Array file
     bool parse( const SGBucket& b );
 
-    // write an Array file
-    bool write( const std::string root_dir, SGBucket& b );
+    // write an Array file ( .arr.raw ) - compressLevel as for tgArrayRawWrite
+    bool write( const std::string root_dir, SGBucket& b, int compressLevel = 0 );
 
     // do our best to remove voids by picking data from the nearest
     // neighbor.
@@ -89,11 +119,21 @@ public:
     // good enough
     double altitude_from_grid( double lon, double lat ) const;
 
+    // return the altitudes of many points at once - lon, lat in arc seconds.
+    // Much faster than calling altitude_from_grid for each point
+    void altitudes_from_grid( unsigned int count, const double* lon, const double* lat, double* elev ) const;
+
+    // same, for points in degrees
+    void altitudes_from_grid( const std::vector<SGGeod>& geods, std::vector<double>& elevs ) const;
+
     // Informational methods
     inline double get_originx() const { return originx; }
     inline double get_originy() const { return originy; }
     inline int get_cols() const { return cols; }
     inline int get_rows() const { return rows; }
+
+    // bytes held by the elevations, and the closest non-void lookup
+    inline size_t get_memory_size() const { return (size_t)cols * rows * sizeof(short) + nearest_nonvoid.size() * sizeof(int); }
     inline double get_col_step() const { return col_step; }
     inline double get_row_step() const { return row_step; }
 
@@ -101,6 +141,8 @@ public:
     inline std::vector<SGGeod> const& get_fitted_list() const { return fitted_list; }
 
     int get_array_elev( int col, int row ) const;
+    // doesn't update the closest non-void lookup - that is rebuilt by
+    // remove_voids()
     void set_array_elev( int col, int row, int val );
 
     // reset Array to initial state - ready to load another elevation file
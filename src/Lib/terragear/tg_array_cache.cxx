@@ -0,0 +1,145 @@
+#include <functional>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tg_array_cache.hxx"
+
+tgArrayCache& tgArrayCache::instance( void )
+{
+    static tgArrayCache cache;
+    return cache;
+}
+
+tgArrayCache::tgArrayCache()
+{
+    budget = (size_t)TG_ARRAY_CACHE_DEFAULT_BUDGET * 1024 * 1024;
+    total  = 0;
+    hits   = 0;
+    misses = 0;
+}
+
+void tgArrayCache::setBudget( unsigned int mb )
+{
+    std::lock_guard<std::mutex> guard( mutex );
+
+    budget = (size_t)mb * 1024 * 1024;
+    evict();
+}
+
+void tgArrayCache::clear( void )
+{
+    std::lock_guard<std::mutex> guard( mutex );
+
+    size_t saved = budget;
+    budget = 0;
+    evict();
+    budget = saved;
+}
+
+// drops the reserved entry if the load doesn't finish ( open or parse
+// throwing ), so waiters don't hang on an entry that is never loaded
+class tgArrayCacheLoadGuard
+{
+public:
+    tgArrayCacheLoadGuard( std::function<void()> f ) : abort(f), done(false) {}
+    ~tgArrayCacheLoadGuard() { if ( !done ) abort(); }
+
+    void release( void ) { done = true; }
+
+private:
+    std::function<void()>   abort;
+    bool                    done;
+};
+
+bool tgArrayCache::get( const std::string& arrayPath, const SGBucket& b, tgArrayRef& array )
+{
+    std::unique_lock<std::mutex> guard( mutex );
+
+    // another thread may be loading it - wait for it rather than loading it
+    // again.  The entry can be evicted, or its load abandoned while we
+    // sleep, so look it up again after every wait
+    std::map<std::string, cacheEntry>::iterator eit;
+    while ( ( eit = entries.find( arrayPath ) ) != entries.end() && eit->second.loading ) {
+        loaded.wait( guard );
+    }
+
+    if ( eit != entries.end() ) {
+        lru.splice( lru.begin(), lru, eit->second.lru );
+        hits++;
+
+        array = eit->second.array;
+        return eit->second.found;
+    }
+
+    // reserve the entry, and load the array without holding the lock
+    cacheEntry& entry = entries[arrayPath];
+    lru.push_front( arrayPath );
+    entry.lru = lru.begin();
+    misses++;
+
+    tgArrayCacheLoadGuard abandon( [&]() {
+        if ( !guard.owns_lock() ) {
+            guard.lock();
+        }
+
+        lru.erase( entry.lru );
+        entries.erase( arrayPath );
+        loaded.notify_all();
+    } );
+
+    guard.unlock();
+
+    std::unique_ptr<tgArray> loading( new tgArray() );
+    bool found = loading->open( arrayPath );
+
+    if ( found ) {
+        SG_LOG(SG_GENERAL, SG_DEBUG, "tgArrayCache: loading " << arrayPath );
+    } else {
+        SG_LOG(SG_GENERAL, SG_DEBUG, "tgArrayCache: no array " << arrayPath << " - using zero'd data" );
+    }
+
+    // this will fill in a zero structure if no array data found/opened
+    loading->parse( b );
+    loading->remove_voids();
+    loading->close();
+
+    guard.lock();
+    abandon.release();
+
+    // std::map iterators and references stay valid while other entries
+    // come and go - and nobody evicts an entry still loading
+    entry.size    = loading->get_memory_size();
+    entry.array   = tgArrayRef( loading.release() );
+    entry.found   = found;
+    entry.loading = false;
+    total += entry.size;
+
+    array = entry.array;
+
+    SG_LOG(SG_GENERAL, SG_DEBUG, "tgArrayCache: " << entries.size() << " arrays, " << total / 1024 << " KB, " << hits << " hits, " << misses << " misses" );
+
+    evict();
+    loaded.notify_all();
+
+    return found;
+}
+
+// drop least recently used arrays until we are within budget.
+// called with the lock held
+void tgArrayCache::evict( void )
+{
+    std::list<std::string>::iterator it = lru.end();
+
+    while ( total > budget && it != lru.begin() ) {
+        --it;
+
+        std::map<std::string, cacheEntry>::iterator eit = entries.find( *it );
+        if ( eit->second.loading ) {
+            continue;
+        }
+
+        total -= eit->second.size;
+        entries.erase( eit );
+        it = lru.erase( it );
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef __TG_ARRAY_CACHE_HXX__
+#define __TG_ARRAY_CACHE_HXX__
+
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <simgear/bucket/newbucket.hxx>
+
+#include "tg_array.hxx"
+
+// Process wide cache of parsed elevation arrays.
+//
+// Each tile reads the arrays of itself and its neighbors, so without the
+// cache every array is decompressed and parsed up to 9 times per run.
+// Arrays are loaded once, voids removed, then handed out read only to any
+// thread that asks.  The returned reference keeps the array alive, so an
+// array evicted from the cache is freed when the last user lets go of it.
+//
+// Least recently used arrays are evicted once the cache holds more than
+// its memory budget.
+
+#define TG_ARRAY_CACHE_DEFAULT_BUDGET   (256)   // MB
+
+typedef std::shared_ptr<const tgArray> tgArrayRef;
+
+class tgArrayCache
+{
+public:
+    static tgArrayCache& instance( void );
+
+    // get the array at arrayPath ( without the .arr.gz extension ).
+    // array is always set - to zero'd data for the bucket if the file doesn't
+    // exist.  Returns true if the file was found
+    bool get( const std::string& arrayPath, const SGBucket& b, tgArrayRef& array );
+
+    // memory budget in MB
+    void setBudget( unsigned int mb );
+
+    // drop all arrays not in use
+    void clear( void );
+
+private:
+    tgArrayCache();
+
+    struct cacheEntry {
+        cacheEntry() : found(false), loading(true), size(0) {}
+
+        tgArrayRef                          array;
+        bool                                found;
+        bool                                loading;
+        size_t                              size;
+        std::list<std::string>::iterator    lru;
+    };
+
+    void evict( void );
+
+    std::mutex                              mutex;
+    std::condition_variable                 loaded;
+
+    std::map<std::string, cacheEntry>       entries;
+    std::list<std::string>                  lru;        // most recently used first
+
+    size_t                                  budget;
+    size_t                                  total;
+    unsigned long                           hits;
+    unsigned long                           misses;
+};
+
+#endif /* __TG_ARRAY_CACHE_HXX__ */
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include <simgear/debug/logstream.hxx>
+#include <simgear/io/lowlevel.hxx>
+
+#include "tg_array_fit.hxx"
+
+// the file is little endian - swap on big endian hosts
+static void swapHeader( tgArrayFitHeader& h )
+{
+    if ( sgIsLittleEndian() ) {
+        return;
+    }
+
+    sgEndianSwap( &h.version );
+    sgEndianSwap( &h.headerSize );
+    sgEndianSwap( &h.count );
+    sgEndianSwap( &h.sourceHash );
+}
+
+static void swapPoints( double* data, size_t count )
+{
+    if ( sgIsLittleEndian() ) {
+        return;
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+        sgEndianSwap( (uint64_t*)&data[i] );
+    }
+}
+
+bool tgArrayFitOpen( const std::string& file, tgArrayFitHeader& header )
+{
+    FILE* fp = fopen( file.c_str(), "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    bool ok = ( fread( &header, sizeof(header), 1, fp ) == 1 );
+    fclose( fp );
+
+    if ( ok ) {
+        swapHeader( header );
+    }
+
+    if ( !ok || memcmp( header.magic, TG_ARRAY_FIT_MAGIC, 4 ) || header.headerSize != sizeof(header) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitOpen: " << file << " is not a fit file" );
+        return false;
+    }
+
+    if ( header.version != TG_ARRAY_FIT_VERSION ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitOpen: " << file << " has version " << header.version << " - expected " << TG_ARRAY_FIT_VERSION );
+        return false;
+    }
+
+    // a file cut short by a crash must not pass for a finished fit
+    struct stat st;
+    if ( stat( file.c_str(), &st ) != 0 ||
+         (uint64_t)st.st_size != sizeof(header) + (uint64_t)header.count * 3 * sizeof(double) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitOpen: " << file << " is truncated" );
+        return false;
+    }
+
+    return true;
+}
+
+bool tgArrayFitRead( const std::string& file, std::vector<SGGeod>& points )
+{
+    tgArrayFitHeader header;
+
+    if ( !tgArrayFitOpen( file, header ) ) {
+        return false;
+    }
+
+    FILE* fp = fopen( file.c_str(), "rb" );
+    if ( !fp ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitRead: can't open " << file );
+        return false;
+    }
+
+    std::vector<double> data( (size_t)header.count * 3 );
+
+    bool ok = ( fseek( fp, sizeof(header), SEEK_SET ) == 0 &&
+                ( data.empty() || fread( &data[0], sizeof(double), data.size(), fp ) == data.size() ) );
+    fclose( fp );
+
+    if ( !ok ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitRead: " << file << " is truncated" );
+        return false;
+    }
+
+    swapPoints( data.empty() ? NULL : &data[0], data.size() );
+
+    points.reserve( points.size() + header.count );
+    for ( unsigned int i = 0; i < header.count; i++ ) {
+        points.push_back( SGGeod::fromDegM( data[i*3], data[i*3+1], data[i*3+2] ) );
+    }
+
+    return true;
+}
+
+bool tgArrayFitWrite( const std::string& file, uint64_t sourceHash, const std::vector<SGGeod>& points )
+{
+    tgArrayFitHeader header;
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, TG_ARRAY_FIT_MAGIC, 4 );
+    header.version    = TG_ARRAY_FIT_VERSION;
+    header.headerSize = sizeof(header);
+    header.count      = points.size();
+    header.sourceHash = sourceHash;
+
+    std::vector<double> data;
+    data.reserve( points.size() * 3 );
+    for ( unsigned int i = 0; i < points.size(); i++ ) {
+        data.push_back( points[i].getLongitudeDeg() );
+        data.push_back( points[i].getLatitudeDeg() );
+        data.push_back( points[i].getElevationM() );
+    }
+
+    swapHeader( header );
+    swapPoints( data.empty() ? NULL : &data[0], data.size() );
+
+    FILE* fp = fopen( file.c_str(), "wb" );
+    if ( !fp ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitWrite: can't open " << file << " for writing" );
+        return false;
+    }
+
+    bool ok = ( fwrite( &header, sizeof(header), 1, fp ) == 1 );
+    if ( ok && !data.empty() ) {
+        ok = ( fwrite( &data[0], sizeof(double), data.size(), fp ) == data.size() );
+    }
+
+    if ( fclose( fp ) != 0 ) {
+        ok = false;
+    }
+
+    if ( !ok ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayFitWrite: error writing " << file );
+    }
+
+    return ok;
+}
@@ -0,0 +1,44 @@
+#ifndef __TG_ARRAY_FIT_HXX__
+#define __TG_ARRAY_FIT_HXX__
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <simgear/math/SGGeod.hxx>
+
+// Binary fitted point file, written by terrafit.
+//
+// The .fit.gz format is a gzipped text list that tgArray parses one number
+// at a time.  The binary format is a fixed header, followed by the points
+// as little endian doubles ( lon and lat in degrees, elevation in meters ),
+// read with a single fread.
+//
+// The header also records a hash of the source array and the fit
+// parameters, so terrafit can tell when a fit is still current.
+
+#define TG_ARRAY_FIT_EXT            ".fit.raw"
+#define TG_ARRAY_FIT_MAGIC          "TGFT"
+#define TG_ARRAY_FIT_VERSION        (1)
+
+// on disk header - all fields little endian
+struct tgArrayFitHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    headerSize;     // sizeof( tgArrayFitHeader )
+    uint32_t    count;          // number of points
+    uint64_t    sourceHash;
+};
+
+// read and validate the header of a fit file
+bool tgArrayFitOpen( const std::string& file, tgArrayFitHeader& header );
+
+// read the fitted points
+bool tgArrayFitRead( const std::string& file, std::vector<SGGeod>& points );
+
+// write the fitted points
+bool tgArrayFitWrite( const std::string& file, uint64_t sourceHash, const std::vector<SGGeod>& points );
+
+#endif /* __TG_ARRAY_FIT_HXX__ */
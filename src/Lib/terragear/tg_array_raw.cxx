@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <zlib.h>
+
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include <simgear/debug/logstream.hxx>
+#include <simgear/io/lowlevel.hxx>
+
+#include "tg_array_raw.hxx"
+
+// the file is little endian - swap header fields and payload on big endian hosts
+static void swapHeader( tgArrayRawHeader& h )
+{
+    if ( sgIsLittleEndian() ) {
+        return;
+    }
+
+    sgEndianSwap( &h.version );
+    sgEndianSwap( &h.flags );
+    sgEndianSwap( &h.headerSize );
+    sgEndianSwap( (uint32_t*)&h.originx );
+    sgEndianSwap( (uint32_t*)&h.originy );
+    sgEndianSwap( (uint32_t*)&h.cols );
+    sgEndianSwap( (uint32_t*)&h.col_step );
+    sgEndianSwap( (uint32_t*)&h.rows );
+    sgEndianSwap( (uint32_t*)&h.row_step );
+    sgEndianSwap( &h.numBlocks );
+    sgEndianSwap( &h.blockSize );
+    sgEndianSwap( &h.dataOffset );
+    sgEndianSwap( &h.dataSize );
+}
+
+static void swapBlock( tgArrayRawBlock& b )
+{
+    if ( sgIsLittleEndian() ) {
+        return;
+    }
+
+    sgEndianSwap( &b.offset );
+    sgEndianSwap( &b.storedSize );
+    sgEndianSwap( &b.rawSize );
+}
+
+static void swapData( short* data, size_t count )
+{
+    if ( sgIsLittleEndian() ) {
+        return;
+    }
+
+    for ( size_t i = 0; i < count; i++ ) {
+        sgEndianSwap( (uint16_t*)&data[i] );
+    }
+}
+
+bool tgArrayRawOpen( const std::string& file, tgArrayRawHeader& header )
+{
+    FILE* fp = fopen( file.c_str(), "rb" );
+    if ( !fp ) {
+        return false;
+    }
+
+    bool ok = ( fread( &header, sizeof(header), 1, fp ) == 1 );
+    fclose( fp );
+
+    if ( ok ) {
+        swapHeader( header );
+    }
+
+    if ( !ok || memcmp( header.magic, TG_ARRAY_RAW_MAGIC, 4 ) || header.headerSize != sizeof(header) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawOpen: " << file << " is not a raw array file" );
+        return false;
+    }
+
+    if ( header.version != TG_ARRAY_RAW_VERSION ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawOpen: " << file << " has version " << header.version << " - expected " << TG_ARRAY_RAW_VERSION );
+        return false;
+    }
+
+    if ( header.cols <= 0 || header.rows <= 0 ||
+         header.dataSize != (uint64_t)header.cols * header.rows * sizeof(short) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawOpen: " << file << " has bad dimensions " << header.cols << " x " << header.rows );
+        return false;
+    }
+
+    return true;
+}
+
+static bool loadCompressed( FILE* fp, const std::string& file, const tgArrayRawHeader& header, tgArrayRawData& raw )
+{
+    std::vector<tgArrayRawBlock> blocks( header.numBlocks );
+    std::vector<unsigned char>   stored;
+
+    if ( fseek( fp, sizeof(header), SEEK_SET ) != 0 ||
+         fread( &blocks[0], sizeof(tgArrayRawBlock), blocks.size(), fp ) != blocks.size() ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: " << file << " is truncated" );
+        return false;
+    }
+
+    raw.data = new short[header.cols * header.rows];
+
+    unsigned char* dst = (unsigned char*)raw.data;
+    uint64_t       pos = 0;
+
+    for ( unsigned int i = 0; i < blocks.size(); i++ ) {
+        swapBlock( blocks[i] );
+
+        uLongf rawSize = blocks[i].rawSize;
+        stored.resize( blocks[i].storedSize );
+
+        if ( pos + rawSize > header.dataSize ||
+             fseek( fp, (long)blocks[i].offset, SEEK_SET ) != 0 ||
+             fread( &stored[0], stored.size(), 1, fp ) != 1 ||
+             uncompress( dst + pos, &rawSize, &stored[0], stored.size() ) != Z_OK ||
+             rawSize != blocks[i].rawSize ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: " << file << " block " << i << " is corrupt" );
+            tgArrayRawRelease( raw );
+            return false;
+        }
+
+        pos += rawSize;
+    }
+
+    if ( pos != header.dataSize ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: " << file << " is truncated" );
+        tgArrayRawRelease( raw );
+        return false;
+    }
+
+    swapData( raw.data, header.cols * header.rows );
+    return true;
+}
+
+bool tgArrayRawLoad( const std::string& file, const tgArrayRawHeader& header, tgArrayRawData& raw )
+{
+    tgArrayRawRelease( raw );
+
+#ifndef _WIN32
+    if ( !(header.flags & TG_ARRAY_RAW_COMPRESSED) ) {
+        struct stat st;
+        size_t      size = header.dataOffset + header.dataSize;
+        int         fd   = ::open( file.c_str(), O_RDONLY );
+
+        if ( fd < 0 ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: can't open " << file );
+            return false;
+        }
+
+        // mapping past the end of a truncated file would fault on access
+        if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < size ) {
+            SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: " << file << " is truncated" );
+            ::close( fd );
+            return false;
+        }
+
+        // private mapping - remove_voids writes to a copy of the page,
+        // never the file
+        void* base = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0 );
+        ::close( fd );
+
+        if ( base != MAP_FAILED ) {
+            raw.mapBase = base;
+            raw.mapSize = size;
+            raw.data    = (short*)( (char*)base + header.dataOffset );
+
+            swapData( raw.data, header.cols * header.rows );
+            return true;
+        }
+
+        SG_LOG(SG_GENERAL, SG_DEBUG, "tgArrayRawLoad: can't map " << file << " - reading it" );
+    }
+#endif
+
+    FILE* fp = fopen( file.c_str(), "rb" );
+    if ( !fp ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: can't open " << file );
+        return false;
+    }
+
+    bool ok;
+    if ( header.flags & TG_ARRAY_RAW_COMPRESSED ) {
+        ok = loadCompressed( fp, file, header, raw );
+    } else {
+        raw.data = new short[header.cols * header.rows];
+
+        ok = ( fseek( fp, (long)header.dataOffset, SEEK_SET ) == 0 &&
+               fread( raw.data, header.dataSize, 1, fp ) == 1 );
+        if ( ok ) {
+            swapData( raw.data, header.cols * header.rows );
+        } else {
+            SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawLoad: " << file << " is truncated" );
+            tgArrayRawRelease( raw );
+        }
+    }
+
+    fclose( fp );
+    return ok;
+}
+
+void tgArrayRawRelease( tgArrayRawData& raw )
+{
+    if ( raw.mapBase ) {
+#ifndef _WIN32
+        munmap( raw.mapBase, raw.mapSize );
+#endif
+    } else if ( raw.data ) {
+        delete[] raw.data;
+    }
+
+    raw.data    = NULL;
+    raw.mapBase = NULL;
+    raw.mapSize = 0;
+}
+
+bool tgArrayRawWrite( const std::string& file, int originx, int originy,
+                      int cols, int col_step, int rows, int row_step,
+                      const short* data, int compressLevel )
+{
+    tgArrayRawHeader                        header;
+    std::vector<tgArrayRawBlock>            blocks;
+    std::vector< std::vector<unsigned char> > payloads;
+    std::vector<short>                      le( data, data + cols * rows );
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, TG_ARRAY_RAW_MAGIC, 4 );
+    header.version    = TG_ARRAY_RAW_VERSION;
+    header.headerSize = sizeof(header);
+    header.originx    = originx;
+    header.originy    = originy;
+    header.cols       = cols;
+    header.col_step   = col_step;
+    header.rows       = rows;
+    header.row_step   = row_step;
+    header.blockSize  = TG_ARRAY_RAW_BLOCK_SIZE;
+    header.dataSize   = (uint64_t)cols * rows * sizeof(short);
+
+    swapData( &le[0], le.size() );
+
+    if ( compressLevel > 0 ) {
+        const unsigned char* src = (const unsigned char*)&le[0];
+
+        header.flags |= TG_ARRAY_RAW_COMPRESSED;
+        header.numBlocks = ( header.dataSize + TG_ARRAY_RAW_BLOCK_SIZE - 1 ) / TG_ARRAY_RAW_BLOCK_SIZE;
+
+        blocks.resize( header.numBlocks );
+        payloads.resize( header.numBlocks );
+
+        for ( unsigned int i = 0; i < header.numBlocks; i++ ) {
+            uLong  rawSize    = std::min( (uint64_t)TG_ARRAY_RAW_BLOCK_SIZE, header.dataSize - (uint64_t)i * TG_ARRAY_RAW_BLOCK_SIZE );
+            uLongf storedSize = compressBound( rawSize );
+
+            payloads[i].resize( storedSize );
+            if ( compress2( &payloads[i][0], &storedSize, src + (size_t)i * TG_ARRAY_RAW_BLOCK_SIZE, rawSize, compressLevel ) != Z_OK ) {
+                SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawWrite: failed to compress " << file );
+                return false;
+            }
+            payloads[i].resize( storedSize );
+
+            blocks[i].storedSize = storedSize;
+            blocks[i].rawSize    = rawSize;
+        }
+    }
+
+    // payload starts on the first page after the header and block table
+    uint64_t tableEnd = sizeof(header) + blocks.size() * sizeof(tgArrayRawBlock);
+    header.dataOffset = ( ( tableEnd + TG_ARRAY_RAW_PAGE_SIZE - 1 ) / TG_ARRAY_RAW_PAGE_SIZE ) * TG_ARRAY_RAW_PAGE_SIZE;
+
+    uint64_t offset = header.dataOffset;
+    for ( unsigned int i = 0; i < blocks.size(); i++ ) {
+        blocks[i].offset = offset;
+        offset += blocks[i].storedSize;
+        swapBlock( blocks[i] );
+    }
+
+    tgArrayRawHeader out = header;
+    swapHeader( out );
+
+    // write a temp file, and rename it into place once complete - readers
+    // never see a partial array
+    std::string tempname = file + TG_ARRAY_RAW_TEMP_EXT;
+
+    FILE* fp = fopen( tempname.c_str(), "wb" );
+    if ( !fp ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawWrite: can't open " << tempname << " for writing" );
+        return false;
+    }
+
+    std::vector<char> pad( header.dataOffset - tableEnd, 0 );
+
+    bool ok = ( fwrite( &out, sizeof(out), 1, fp ) == 1 );
+    if ( ok && !blocks.empty() ) {
+        ok = ( fwrite( &blocks[0], sizeof(tgArrayRawBlock), blocks.size(), fp ) == blocks.size() );
+    }
+    if ( ok && !pad.empty() ) {
+        ok = ( fwrite( &pad[0], pad.size(), 1, fp ) == 1 );
+    }
+
+    if ( header.flags & TG_ARRAY_RAW_COMPRESSED ) {
+        for ( unsigned int i = 0; ok && i < payloads.size(); i++ ) {
+            ok = ( fwrite( &payloads[i][0], payloads[i].size(), 1, fp ) == 1 );
+        }
+    } else if ( ok ) {
+        ok = ( fwrite( &le[0], header.dataSize, 1, fp ) == 1 );
+    }
+
+    if ( fclose( fp ) != 0 ) {
+        ok = false;
+    }
+
+    if ( !ok ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawWrite: error writing " << tempname );
+        remove( tempname.c_str() );
+        return false;
+    }
+
+#ifdef _WIN32
+    // rename doesn't replace an existing file on windows
+    remove( file.c_str() );
+#endif
+    if ( rename( tempname.c_str(), file.c_str() ) != 0 ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "tgArrayRawWrite: can't rename " << tempname << " to " << file );
+        remove( tempname.c_str() );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef __TG_ARRAY_RAW_HXX__
+#define __TG_ARRAY_RAW_HXX__
+
+#include <cstddef>
+#include <string>
+
+#include <stdint.h>
+
+// Raw elevation array container.
+//
+// The .arr.gz format is a gzip stream read and written one short at a time.
+// The raw format is a fixed header, and the elevations as little endian
+// int16 in the same column major order tgArray keeps them in memory.  The
+// payload starts on a page boundary, so an uncompressed file is mapped
+// straight into tgArray without copying or parsing anything.
+//
+// layout :
+//   tgArrayRawHeader
+//   numBlocks * tgArrayRawBlock     ( compressed files only )
+//   payload at dataOffset           ( page aligned )
+//
+// Compressed files split the payload into blocks of TG_ARRAY_RAW_BLOCK_SIZE
+// bytes, each zlib compressed on its own.  These can't be mapped, but are
+// still much cheaper to read than the .arr.gz stream.
+
+#define TG_ARRAY_RAW_EXT            ".arr.raw"
+#define TG_ARRAY_RAW_TEMP_EXT       ".tmp"
+#define TG_ARRAY_RAW_MAGIC          "TGAW"
+#define TG_ARRAY_RAW_VERSION        (1)
+#define TG_ARRAY_RAW_PAGE_SIZE      (4096)
+#define TG_ARRAY_RAW_BLOCK_SIZE     (65536)
+
+#define TG_ARRAY_RAW_COMPRESSED     (0x00000001)
+
+// on disk header - all fields little endian
+struct tgArrayRawHeader
+{
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    flags;
+    uint32_t    headerSize;     // sizeof( tgArrayRawHeader )
+    int32_t     originx;        // arc seconds
+    int32_t     originy;
+    int32_t     cols;
+    int32_t     col_step;       // arc seconds
+    int32_t     rows;
+    int32_t     row_step;
+    uint32_t    numBlocks;      // 0 if uncompressed
+    uint32_t    blockSize;
+    uint64_t    dataOffset;
+    uint64_t    dataSize;       // uncompressed payload size
+};
+
+struct tgArrayRawBlock
+{
+    uint64_t    offset;
+    uint32_t    storedSize;
+    uint32_t    rawSize;
+};
+
+// elevation data loaded from a raw array.  Either mapped, or allocated
+// with new[] - tgArrayRawRelease frees it either way
+struct tgArrayRawData
+{
+    tgArrayRawData() : data(NULL), mapBase(NULL), mapSize(0) {}
+
+    short*      data;
+    void*       mapBase;
+    size_t      mapSize;
+};
+
+// read and validate the header of a raw array
+bool tgArrayRawOpen( const std::string& file, tgArrayRawHeader& header );
+
+// load the elevations of a raw array - mapped copy on write if possible
+bool tgArrayRawLoad( const std::string& file, const tgArrayRawHeader& header, tgArrayRawData& raw );
+void tgArrayRawRelease( tgArrayRawData& raw );
+
+// write a raw array.  data is cols * rows elevations, column major.
+// compressLevel 0 writes an uncompressed ( mappable ) file
+bool tgArrayRawWrite( const std::string& file, int originx, int originy,
+                      int cols, int col_step, int rows, int row_step,
+                      const short* data, int compressLevel = 0 );
+
+#endif /* __TG_ARRAY_RAW_HXX__ */
@@ -16,74 +16,64 @@
 #define DEBUG_CLUSTER   (0)
 #define LOG_CLUSER      SG_DEBUG
 
-
-std::list<EPECSegment_2>::iterator it;
-std::vector<EPECPoint_2>::iterator vfrom,vto;
-std::vector<EPECPoint_2>::iterator fcit;
-
+// voronoi cell location is the nearest centroid
 EPECPoint_2 tgCluster::Locate(const EPECPoint_2& point) const
 {
-    VDLocateResult lr = vd.locate(point);
-    EPECPoint_2    q;
+    EPECPoint_2 q;
 
-    if ( VDVertexHandle* v = boost::get<VDVertexHandle>(&lr) ) 
-    {
-        q = (*v)->site(0)->point();
-    } 
-    else if ( VDHalfedgeHandle* e = boost::get<VDHalfedgeHandle>(&lr) )
-    {
-        q = (*e)->up()->point();        
-    } 
-    else if ( VDFaceHandle* f = boost::get<VDFaceHandle>(&lr) ) 
-    {
-        q = (*f)->dual()->point();
+    cellSearch search( cellLocator, point, 1 );
+    if ( search.begin() != search.end() ) {
+        q = boost::get<0>( search.begin()->first );
     }
 
     return q;
 }
 
+void tgCluster::buildCellTree( const std::vector<tgVoronoiCell>& cells )
+{
+    cellLocator.clear();
+    for ( unsigned int i=0; i<cells.size(); i++ ) {
+        cellLocator.insert( cellData( cells[i].centroid, i ) );
+    }
+}
+
+// one iteration of Lloyd relaxation :
+// assign every node to the cell of it's nearest centroid, then move each 
+// centroid to the center of it's nodes.  Fixed centroids don't move.
 void tgCluster::computenewcentroids(void)
 {
-    std::vector<tgVoronoiCell>::iterator oc, nc;
+    std::vector<tgVoronoiCell>::iterator oc;
 
     tag tg;
-    vd.clear();
+    buildCellTree( oldcells );
     for(oc = oldcells.begin(); oc!= oldcells.end(); oc++)
     {
-        (*oc).face = vd.insert((*oc).centroid);
         (*oc).nodes.clear();
     }
-    assert( vd.is_valid() );
 
     for ( std::list<tgClusterNode>::iterator it = nodes.begin(); it != nodes.end(); it++ )
     {
-        EPECPoint_2 q = Locate(it->point);
-
-        for(oc = oldcells.begin(); oc!= oldcells.end(); oc++)
-        {
-            if ( (*oc).centroid == q ) {
-                (*oc).nodes.push_back(*it);
-                break;
-            }
+        cellSearch search( cellLocator, it->point, 1 );
+        if ( search.begin() != search.end() ) {
+            unsigned int idx = boost::get<1>( search.begin()->first );
+            oldcells[idx].nodes.push_back(*it);
         }
     }
 
     // UPDATE THE CENTROIDS HERE
-    oc = oldcells.begin();
     newcells.clear();
 
     for(oc = oldcells.begin(); oc!= oldcells.end(); oc++)
     {
         tgVoronoiCell newvc;
-        if ((*oc).nodes.empty())
+        if ( (*oc).nodes.empty() || (*oc).fixed )
         {
             newvc.centroid = (*oc).centroid;
-            newvc.face     = (*oc).face;
+            newvc.fixed    = (*oc).fixed;
             newvc.nodes    = (*oc).nodes;
         }
         else
         {
-            // if he voronoi cell has fixed nodes, set them as centroids for new cells
             std::vector<tgClusterNode>::const_iterator nit = (*oc).nodes.begin();
 
             // todo - split a voronoi cell if more than 1 fixed node inside
@@ -94,7 +84,7 @@ void tgCluster::computenewcentroids(void)
             }
 
             newvc.centroid = CGAL::centroid(positions.begin(),positions.end(),tg);
-            newvc.face     = (*oc).face;
+            newvc.fixed    = false;
             newvc.nodes    = (*oc).nodes;
         }
         newcells.push_back(newvc);
@@ -370,6 +360,7 @@ tgCluster::tgCluster( std::list<tgClusterNode>& points, double err, const std::s
             {
                 tgVoronoiCell newvc;
                 newvc.centroid = (*cit).centroid;
+                newvc.fixed    = (*cit).fixed;
                 oldcells.push_back( newvc );
             }
         }
@@ -386,8 +377,6 @@ void tgCluster::toShapefile( const char* datasource, const char* layer_prefix )
     std::vector<tgVoronoiCell>::iterator cit;
     for(cit = newcells.begin(); cit!= newcells.end(); cit++, cell_id++)
     {
-        std::vector<tgSegment> edges;
-
         // label each centroid
         sprintf( description, "voronoi_cell_%04d", cell_id );
         sprintf( layer, "%s_centroids", layer_prefix ); 
@@ -400,28 +389,6 @@ void tgCluster::toShapefile( const char* datasource, const char* layer_prefix )
             tgShapefile::FromGeod( centroid, datasource, layer, description );
         }
 
-        // dump edges
-        VDCcbHalfedgeCirculator ec_start = (*cit).face->ccb();
-        VDCcbHalfedgeCirculator ec       = ec_start;
-
-        sprintf( layer, "%s_edges", layer_prefix ); 
-        edges.clear();
-        do
-        {
-            VDHalfedgeHandle e = ec;
-            if ( e->is_segment() ) {
-                SGGeod gsrc = SGGeod::fromDeg( CGAL::to_double(e->source()->point().x()),
-                                               CGAL::to_double(e->source()->point().y()) );
-                SGGeod gtrg = SGGeod::fromDeg( CGAL::to_double(e->target()->point().x()),
-                                               CGAL::to_double(e->target()->point().y()) );
-
-                edges.push_back( tgSegment(gsrc, gtrg) );
-            }
-
-        } while ( ++ec != ec_start );
-
-        tgShapefile::FromSegmentList( edges, false, datasource, layer, description );
-
         // generate node list
         sprintf( layer, "%s_nodes", layer_prefix ); 
         sprintf( layer2, "%s_fixed_nodes", layer_prefix ); 
@@ -7,13 +7,8 @@
 #include "tg_cgal_epec.hxx"
 #include "tg_cgal.hxx"
 
-// includes for defining the Voronoi diagram adaptor
+// includes for the centroid search trees
 #include <CGAL/basic.h>
-#include <CGAL/Triangulation_2.h>
-#include <CGAL/Delaunay_triangulation_2.h>
-#include <CGAL/Voronoi_diagram_2.h>
-#include <CGAL/Delaunay_triangulation_adaptation_traits_2.h>
-#include <CGAL/Delaunay_triangulation_adaptation_policies_2.h>
 #include <CGAL/centroid.h>
 #include <CGAL/Dimension.h>
 
@@ -21,27 +16,10 @@
 #include <CGAL/algorithm.h>
 #include <CGAL/Fuzzy_sphere.h>
 #include <CGAL/Search_traits_2.h>
+#include <CGAL/Search_traits_adapter.h>
+#include <CGAL/Orthogonal_k_neighbor_search.h>
 
-// typedefs for defining the adaptor
-typedef CGAL::Delaunay_triangulation_2<EPECKernel>                           DT;
-typedef CGAL::Delaunay_triangulation_adaptation_traits_2<DT>                 AT;
-typedef CGAL::Delaunay_triangulation_caching_degeneracy_removal_policy_2<DT> AP;
-typedef CGAL::Voronoi_diagram_2<DT,AT,AP>                                    VD;
-typedef CGAL::Dimension_tag<0>                                               tag;
-
-//typedef K::Point_2                            Point;
-typedef EPECKernel::Iso_rectangle_2             EPECIsoRectangle;
-
-// typedef for the result type of the point location
-typedef AT::Site_2                              EPECSite;
-
-typedef VD::Locate_result                       VDLocateResult;
-typedef AT::Nearest_site_2                      ATLocateResult;
-typedef VD::Vertex_handle                       VDVertexHandle;
-typedef VD::Face_handle                         VDFaceHandle;
-typedef VD::Halfedge_handle                     VDHalfedgeHandle;
-typedef VD::Ccb_halfedge_circulator             VDCcbHalfedgeCirculator;
-typedef VD::Halfedge_around_vertex_circulator   VDHalfedge_around_vertex_circulator;
+typedef CGAL::Dimension_tag<0>                  tag;
 
 struct tgClusterNode
 {
@@ -61,13 +39,16 @@ public:
 typedef boost::tuple<EPECPoint_2, std::vector<tgClusterNode>::iterator> nodesData;
 typedef CGAL::Search_traits_2<EPECKernel>       nodesTraitsBase;
 typedef CGAL::Search_traits_adapter<nodesData, CGAL::Nth_of_tuple_property_map<0, nodesData>,nodesTraitsBase>  VDnodesTraits;
-//typedef CGAL::Search_traits_2<EPECKernel>                         VDnodesTraits;
 
 typedef CGAL::Fuzzy_sphere<VDnodesTraits>       VDnodesFuzzyCir;
 typedef CGAL::Kd_tree<VDnodesTraits>            VDnodesTree;
 
-typedef std::vector<EPECPoint_2>                Points;
-typedef std::vector<Points>                     PointsArray;
+// the voronoi cell of a centroid is the set of points closer to it than to
+// any other centroid - so locating a cell is a nearest neighbour search
+typedef boost::tuple<EPECPoint_2, unsigned int> cellData;
+typedef CGAL::Search_traits_adapter<cellData, CGAL::Nth_of_tuple_property_map<0, cellData>,nodesTraitsBase>  cellTraits;
+typedef CGAL::Orthogonal_k_neighbor_search<cellTraits>  cellSearch;
+typedef cellSearch::Tree                                cellTree;
 
 struct tgVoronoiCell 
 {
@@ -75,7 +56,6 @@ public:
 
     EPECPoint_2                centroid;
     bool                       fixed;
-    VDFaceHandle               face;
     std::vector<tgClusterNode> nodes;
 
     bool operator==(const tgVoronoiCell& other ) {
@@ -83,6 +63,8 @@ public:
     }
 };
 
+// clustering is reentrant - all search structures are owned by the cluster, 
+// so each thread can cluster it's own nodes concurrently.
 class tgCluster 
 {
 public:
@@ -93,6 +75,7 @@ public:
 
 private:
     void computenewcentroids(void);
+    void buildCellTree( const std::vector<tgVoronoiCell>& cells );
 
     // debug
     GDALDataset* openDatasource( const std::string& debug ) const;
@@ -107,14 +90,11 @@ private:
     double                    squaredError;
     int                       numcentroids;
 
-    std::vector<tgsegment_list> v_faces;       // segments making up the face
-    PointsArray                 vpoints;
-
     std::vector<tgClusterNode>  oldcentroids, newcentroids;
     std::vector<tgVoronoiCell>  oldcells,     newcells;
 
     VDnodesTree tree;
-    VD          vd;
+    cellTree    cellLocator;
     std::string debug;
 };
 
@@ -1,7 +1,7 @@
+#include <condition_variable>
 #include <map>
 #include <mutex>
 
-#include <simgear/threads/SGThread.hxx>
 #include <simgear/debug/logstream.hxx>
 
 // This file is used to serialize access to GDAL DataSets.
@@ -29,39 +29,31 @@ struct tileInfo {
 public:
     tileInfo( unsigned long id ) : tid( id ), numWaiting(1), inUse( true ) {}
 
-    void AddWaiter( std::mutex& m ) {
-        //std::lock_guard<std::mutex> g(mutex);
-
-        SG_LOG(SG_GENERAL, SG_INFO, "tgDataSetProtect task " << SGThread::current() << " waiting on tile " << tid << " num ahead is " << numWaiting );
-        
+    // called with the map lock held - returns with the tile ours
+    void AddWaiter( std::unique_lock<std::mutex>& g ) {
         numWaiting++;
-        while ( inUse ) {            
-            available.wait( m );
-            SG_LOG(SG_GENERAL, SG_INFO, "tgDataSetProtect task " << SGThread::current() << " signalled for tile " << tid << " num waiting is " << numWaiting << " inUse is " << inUse );            
+        while ( inUse ) {
+            available.wait( g );
         }
+        inUse = true;
     }
 
     bool RemoveWaiter( void ) {
-        //std::lock_guard<std::mutex> g(mutex);
-
-        SG_LOG(SG_GENERAL, SG_INFO, "tgDataSetProtect task " << SGThread::current() << " finished with tile " << tid << " num waiting is " << numWaiting );
-        
         numWaiting--;
         inUse = false;
-        
+
         if ( numWaiting ) {
-            available.signal();
+            available.notify_one();
         }
-        
+
         return ( numWaiting == 0 );
     }
 
-    SGWaitCondition available;
-    //std::mutex         mutex;
+    std::condition_variable available;
 
     unsigned long   tid;
     int             numWaiting;     // when this is 0, we can remove tileInfo from the map
-    bool            inUse;          // condition variable - cleared on release
+    bool            inUse;          // set by the owner, cleared on release
 };
 
 typedef std::map< unsigned long, tileInfo* >	tile_map;
@@ -73,7 +65,7 @@ public:
 
     // whenever you want to write to a tile, you need to Request it
     void Request( unsigned long tileId ) {
-        std::lock_guard<std::mutex> g(mutex);
+        std::unique_lock<std::mutex> g(mutex);
         
         tile_map::iterator it = waitingTasks.find( tileId );
         if ( it == waitingTasks.end() ) {
@@ -82,12 +74,11 @@ public:
             waitingTasks[tileId] = new tileInfo( tileId );
             // we can continue to use it - we're the first to ask for it
             // so no call to AddWaiter
-            SG_LOG(SG_GENERAL, SG_INFO, "tgDataSetProtect task " << SGThread::current() << " working on tile " << tileId );
         } else {
             // tile is in the map, so it is already in use
             // once AddWaiter returns, we have the tile for ourselves
             tileInfo* ti = it->second;
-            ti->AddWaiter(mutex);
+            ti->AddWaiter(g);
         }
     }
 
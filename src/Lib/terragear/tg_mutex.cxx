@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tg_mutex.hxx"
+
+// every site ever constructed - sites are function statics, so they are
+// never removed
+static std::atomic<tgMutexSite*> siteList( NULL );
+
+tgMutexSite::tgMutexSite( const char* n ) :
+    name(n), count(0), waitTotal(0), waitMax(0), holdTotal(0), holdMax(0)
+{
+    next = siteList.load( std::memory_order_relaxed );
+    while ( !siteList.compare_exchange_weak( next, this, std::memory_order_release, std::memory_order_relaxed ) ) {
+    }
+}
+
+void tgMutex::enableProfiling( bool e )
+{
+    static std::once_flag registered;
+
+    if ( e ) {
+        std::call_once( registered, []() { std::atexit( tgMutex::reportProfile ); } );
+    }
+
+    profiling().store( e, std::memory_order_relaxed );
+}
+
+static bool byWait( const tgMutexSite* a, const tgMutexSite* b )
+{
+    return a->waitTotal.load( std::memory_order_relaxed ) > b->waitTotal.load( std::memory_order_relaxed );
+}
+
+void tgMutex::reportProfile( void )
+{
+    std::vector<tgMutexSite*> sites;
+
+    for ( tgMutexSite* s = siteList.load( std::memory_order_acquire ); s; s = s->next ) {
+        if ( s->count.load( std::memory_order_relaxed ) ) {
+            sites.push_back( s );
+        }
+    }
+
+    if ( sites.empty() ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "Lock profile: no locks taken" );
+        return;
+    }
+
+    std::sort( sites.begin(), sites.end(), byWait );
+
+    char line[256];
+
+    snprintf( line, sizeof(line), "  %-24s %12s %12s %12s %12s %12s", "site", "count", "wait ms", "max wait ms", "hold ms", "max hold ms" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "Lock profile:" );
+    SG_LOG( SG_GENERAL, SG_ALERT, line );
+
+    for ( unsigned int i=0; i<sites.size(); i++ ) {
+        const tgMutexSite* s = sites[i];
+
+        snprintf( line, sizeof(line), "  %-24s %12llu %12.3f %12.3f %12.3f %12.3f", s->name,
+                  (unsigned long long)s->count.load( std::memory_order_relaxed ),
+                  s->waitTotal.load( std::memory_order_relaxed ) / 1000000.0,
+                  s->waitMax.load( std::memory_order_relaxed ) / 1000000.0,
+                  s->holdTotal.load( std::memory_order_relaxed ) / 1000000.0,
+                  s->holdMax.load( std::memory_order_relaxed ) / 1000000.0 );
+
+        SG_LOG( SG_GENERAL, SG_ALERT, line );
+    }
+}
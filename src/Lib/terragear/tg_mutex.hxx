@@ -1,19 +1,87 @@
 #ifndef __TG_MUTEX_H__
 #define __TG_MUTEX_H__
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 
+#include <stdint.h>
+
+#include "tg_trace.hxx"
+
 #define DEBUG_LOCKS (0)
 
+// when tracing, the time spent waiting for the lock, and the time it is
+// held are recorded as "lock wait" and "lock hold" events
+
+// Lock contention profiling.
+//
+// Every place that takes the lock can name itself with a site :
+//
+//     lock->lock( TG_MUTEX_SITE("arrangement insert") );
+//
+// When profiling is enabled ( tgMutex::enableProfiling ), or tracing is,
+// each site counts its acquisitions, and the total and max time spent
+// waiting for, and holding the lock.  The counters are atomics - no extra
+// locking.  With profiling on, a table of all sites is logged at exit.
+// lock() without a site is counted as "unnamed".
+class tgMutexSite
+{
+public:
+    tgMutexSite( const char* n );
+
+    void addWait( uint64_t ns ) {
+        count.fetch_add( 1, std::memory_order_relaxed );
+        waitTotal.fetch_add( ns, std::memory_order_relaxed );
+        updateMax( waitMax, ns );
+    }
+
+    void addHold( uint64_t ns ) {
+        holdTotal.fetch_add( ns, std::memory_order_relaxed );
+        updateMax( holdMax, ns );
+    }
+
+    const char*             name;
+    std::atomic<uint64_t>   count;
+    std::atomic<uint64_t>   waitTotal;      // nanoseconds
+    std::atomic<uint64_t>   waitMax;
+    std::atomic<uint64_t>   holdTotal;
+    std::atomic<uint64_t>   holdMax;
+    tgMutexSite*            next;           // all sites, newest first
+
+private:
+    static void updateMax( std::atomic<uint64_t>& max, uint64_t v ) {
+        uint64_t cur = max.load( std::memory_order_relaxed );
+        while ( v > cur && !max.compare_exchange_weak( cur, v, std::memory_order_relaxed ) ) {
+        }
+    }
+};
+
+// one site object per call site - constructed on first use
+#define TG_MUTEX_SITE(n)    ( []() -> tgMutexSite& { static tgMutexSite site( n ); return site; }() )
+
 class tgMutex : public std::mutex
 {
 public:
     tgMutex() : std::mutex()
     {
         held = 0;
+        holdStart = -1;
+        holdSite = NULL;
+        holdSiteStart = 0;
     }
 
+    // profiling is off by default.  enabling it logs the site table at exit
+    static void enableProfiling( bool e );
+    static bool isProfiling( void ) { return profiling().load( std::memory_order_relaxed ); }
+    static void reportProfile( void );
+
     void lock( void )
+    {
+        lock( unnamedSite() );
+    }
+
+    void lock( tgMutexSite& site )
     {
 #if DEBUG_LOCKS
         if ( held ) {
@@ -23,7 +91,26 @@ public:
         }
 #endif
 
-        std::mutex::lock();
+        tgTrace& trace   = tgTrace::instance();
+        bool     tracing = trace.isEnabled();
+
+        if ( tracing || isProfiling() ) {
+            int64_t  traceStart = tracing ? trace.now() : -1;
+            uint64_t waitStart  = profileNow();
+
+            std::mutex::lock();
+
+            holdSite      = &site;
+            holdSiteStart = profileNow();
+            site.addWait( holdSiteStart - waitStart );
+
+            if ( tracing ) {
+                holdStart = trace.now();
+                trace.addEvent( "lock wait", traceStart, holdStart - traceStart );
+            }
+        } else {
+            std::mutex::lock();
+        }
 
 #if DEBUG_LOCKS
         held = SGThread::current();
@@ -41,6 +128,18 @@ public:
         }
 #endif
 
+        if ( holdStart >= 0 ) {
+            tgTrace& trace = tgTrace::instance();
+
+            trace.addEvent( "lock hold", holdStart, trace.now() - holdStart );
+            holdStart = -1;
+        }
+
+        if ( holdSite ) {
+            holdSite->addHold( profileNow() - holdSiteStart );
+            holdSite = NULL;
+        }
+
         std::mutex::unlock();
 
 #if DEBUG_LOCKS
@@ -49,7 +148,26 @@ public:
     }
 
 private:
-    long held;
+    static std::atomic<bool>& profiling( void ) {
+        static std::atomic<bool> enabled( false );
+        return enabled;
+    }
+
+    static tgMutexSite& unnamedSite( void ) {
+        static tgMutexSite site( "unnamed" );
+        return site;
+    }
+
+    static uint64_t profileNow( void ) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    long            held;
+
+    // only touched by the thread holding the lock
+    int64_t         holdStart;
+    tgMutexSite*    holdSite;
+    uint64_t        holdSiteStart;
 };
 
 #endif /* __TG_MUTEX_H__ */
@@ -283,6 +283,9 @@ void TGNodes::DeleteUnused( void ) {
 }
 
 void TGNodes::CalcElevations( tgNodeType type ) {
+    std::vector<unsigned int> interpolated;
+    std::vector<double>       lon, lat, elev;
+
     for(unsigned int i = 0; i < tg_node_list.size(); i++) {
         if ( tg_node_list[i].GetType() == type ) {
             SGGeod pos = tg_node_list[i].GetPosition();
@@ -294,8 +297,10 @@ void TGNodes::CalcElevations( tgNodeType type ) {
                     break;
 
                 case TG_NODE_INTERPOLATED:
-                    // get elevation from array
-                    SetElevation( i, array->altitude_from_grid(pos.getLongitudeDeg() * 3600.0, pos.getLatitudeDeg() * 3600.0) );
+                    // get elevation from array - all nodes are queried at once, below
+                    interpolated.push_back( i );
+                    lon.push_back( pos.getLongitudeDeg() * 3600.0 );
+                    lat.push_back( pos.getLatitudeDeg() * 3600.0 );
                     break;
 
                 case TG_NODE_SMOOTHED:
@@ -310,6 +315,15 @@ void TGNodes::CalcElevations( tgNodeType type ) {
             SG_LOG(SG_GENERAL, SG_ALERT, "CalcElevations (interpolated) Ignore pos " << tg_node_list[i].GetPosition() << " with type " << tg_node_list[i].GetType() );
         }
     }
+
+    if ( !interpolated.empty() ) {
+        elev.resize( interpolated.size() );
+        array->altitudes_from_grid( interpolated.size(), &lon[0], &lat[0], &elev[0] );
+
+        for(unsigned int i = 0; i < interpolated.size(); i++) {
+            SetElevation( interpolated[i], elev[i] );
+        }
+    }
 }
     
 void TGNodes::CalcElevations( tgNodeType type, const tgSurface& surf ) {
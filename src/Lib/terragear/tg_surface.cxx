@@ -30,6 +30,7 @@
 #include <simgear/debug/logstream.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_cache.hxx>
 
 #include "TNT/jama_qr.h"
 #include "tg_surface.hxx"
@@ -94,7 +95,7 @@ static void tgCalcElevations( const std::string &root, const string_list elev_sr
 {
     bool done = false;
     int i, j;
-    tgArray array;
+    tgArrayRef array;
 
     // just bail if no work to do
     if ( Pts.rows() == 0 || Pts.cols() == 0 ) {
@@ -129,46 +130,54 @@ static void tgCalcElevations( const std::string &root, const string_list elev_sr
             std::string base = b.gen_base_path();
 
             // try the various elevation sources
+            array.reset();
             j = 0;
             bool found_file = false;
             while ( !found_file && j < (int)elev_src.size() ) {
                 std::string array_path = root + "/" + elev_src[j] + "/" + base + "/" + b.gen_index_str();
 
-                if ( array.open(array_path) ) {
+                if ( tgArrayCache::instance().get( array_path, b, array ) ) {
                     found_file = true;
                     SG_LOG( SG_GENERAL, SG_INFO, "Using array_path = " << array_path );
                 }
                 j++;
             }
 
-            // this will fill in a zero structure if no array data
-            // found/opened
-            array.parse( b );
-
-            // this will do a hasty job of removing voids by inserting
-            // data from the nearest neighbor (sort of)
-            array.remove_voids();
+            // a missing array is zero'd data for the bucket.  With no
+            // elevation sources at all, we still need one
+            if ( !array ) {
+                tgArrayCache::instance().get( root + "/" + base + "/" + b.gen_index_str(), b, array );
+            }
 
             // update all the non-updated elevations that are inside
             // this array file
-            double elev;
+            std::vector<double> lon, lat, elev;
+            std::vector< std::pair<int, int> > idx;
             done = true;
             for ( j = 0; j < Pts.rows(); ++j ) {
                 for ( i = 0; i < Pts.cols(); ++i ) {
                     SGGeod p = Pts.element(i,j);
                     if ( p.getElevationM() < -9000.0 ) {
                         done = false;
-                        elev = array.altitude_from_grid( p.getLongitudeDeg() * 3600.0,
-                                                         p.getLatitudeDeg() * 3600.0 );
-                        if ( elev > -9000 ) {
-                            p.setElevationM( elev );
-                            Pts.set(i, j, p);
-                        }
+                        idx.push_back( std::make_pair( i, j ) );
+                        lon.push_back( p.getLongitudeDeg() * 3600.0 );
+                        lat.push_back( p.getLatitudeDeg() * 3600.0 );
                     }
                 }
             }
 
-            array.close();
+            if ( !idx.empty() ) {
+                elev.resize( idx.size() );
+                array->altitudes_from_grid( idx.size(), &lon[0], &lat[0], &elev[0] );
+
+                for ( unsigned int k = 0; k < idx.size(); ++k ) {
+                    if ( elev[k] > -9000 ) {
+                        SGGeod p = Pts.element( idx[k].first, idx[k].second );
+                        p.setElevationM( elev[k] );
+                        Pts.set( idx[k].first, idx[k].second, p );
+                    }
+                }
+            }
 
         } else {
             done = true;
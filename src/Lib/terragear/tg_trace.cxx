@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <simgear/debug/logstream.hxx>
+
+#include "tg_trace.hxx"
+
+static thread_local int tlsTile = -1;
+
+tgTrace& tgTrace::instance( void )
+{
+    static tgTrace trace;
+    return trace;
+}
+
+tgTrace::tgTrace() : enabled(false)
+{
+    epoch = std::chrono::steady_clock::now();
+}
+
+void tgTrace::setTile( const std::string& tile )
+{
+    tlsTile = tile.empty() ? -1 : instance().getTileIndex( tile );
+}
+
+int tgTrace::getTileIndex( const std::string& tile )
+{
+    std::lock_guard<std::mutex> guard( mutex );
+
+    std::map<std::string, int>::const_iterator it = tileIndex.find( tile );
+    if ( it != tileIndex.end() ) {
+        return it->second;
+    }
+
+    int index = tiles.size();
+    tiles.push_back( tile );
+    tileIndex[tile] = index;
+
+    return index;
+}
+
+// the buffer is owned by the trace, so events outlive the thread
+tgTrace::threadBuffer* tgTrace::getBuffer( void )
+{
+    static thread_local threadBuffer* tlsBuffer = NULL;
+
+    if ( !tlsBuffer ) {
+        std::lock_guard<std::mutex> guard( mutex );
+
+        std::shared_ptr<threadBuffer> buffer( new threadBuffer );
+        buffer->tid = buffers.size() + 1;
+        buffers.push_back( buffer );
+
+        tlsBuffer = buffer.get();
+    }
+
+    return tlsBuffer;
+}
+
+void tgTrace::addEvent( const char* name, int64_t start, int64_t duration )
+{
+    threadBuffer* buffer = getBuffer();
+    traceEvent    event  = { name, start, duration, tlsTile };
+
+    std::lock_guard<std::mutex> guard( buffer->mutex );
+    buffer->events.push_back( event );
+}
+
+void tgTrace::addCounter( const char* name, double value )
+{
+    threadBuffer* buffer  = getBuffer();
+    traceCounter  counter = { name, now(), value, tlsTile };
+
+    std::lock_guard<std::mutex> guard( buffer->mutex );
+    buffer->counters.push_back( counter );
+}
+
+static std::string jsonString( const std::string& s )
+{
+    std::string out = "\"";
+
+    for ( unsigned int i=0; i<s.size(); i++ ) {
+        char c = s[i];
+
+        if ( c == '"' || c == '\\' ) {
+            out += '\\';
+            out += c;
+        } else if ( (unsigned char)c < 0x20 ) {
+            char esc[8];
+            sprintf( esc, "\\u%04x", c );
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+
+    return out + "\"";
+}
+
+struct tgTracePhase {
+    tgTracePhase() : count(0), total(0), min(0), max(0) {}
+
+    void add( int64_t d ) {
+        min = count ? std::min( min, d ) : d;
+        max = count ? std::max( max, d ) : d;
+        total += d;
+        count++;
+    }
+
+    unsigned long   count;
+    int64_t         total;
+    int64_t         min;
+    int64_t         max;
+};
+
+struct tgTraceTotal {
+    tgTraceTotal() : count(0), sum(0) {}
+
+    void add( double v ) {
+        sum += v;
+        count++;
+    }
+
+    unsigned long   count;
+    double          sum;
+};
+
+bool tgTrace::writeJson( const std::string& filename ) const
+{
+    typedef std::map<std::string, tgTracePhase> phaseMap;
+    typedef std::map<std::string, tgTraceTotal> totalMap;
+
+    phaseMap                phases;
+    totalMap                counters;
+    std::vector<phaseMap>   tilePhases;
+    std::vector<totalMap>   tileCounters;
+
+    {
+        std::lock_guard<std::mutex> guard( mutex );
+
+        tilePhases.resize( tiles.size() );
+        tileCounters.resize( tiles.size() );
+
+        for ( unsigned int b=0; b<buffers.size(); b++ ) {
+            std::lock_guard<std::mutex> bufferGuard( buffers[b]->mutex );
+
+            const std::vector<traceEvent>& events = buffers[b]->events;
+            for ( unsigned int i=0; i<events.size(); i++ ) {
+                phases[events[i].name].add( events[i].duration );
+                if ( events[i].tile >= 0 ) {
+                    tilePhases[events[i].tile][events[i].name].add( events[i].duration );
+                }
+            }
+
+            const std::vector<traceCounter>& values = buffers[b]->counters;
+            for ( unsigned int i=0; i<values.size(); i++ ) {
+                counters[values[i].name].add( values[i].value );
+                if ( values[i].tile >= 0 ) {
+                    tileCounters[values[i].tile][values[i].name].add( values[i].value );
+                }
+            }
+        }
+    }
+
+    FILE* fp = fopen( filename.c_str(), "w" );
+    if ( !fp ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgTrace: can't open " << filename << " for writing" );
+        return false;
+    }
+
+    // times in milliseconds
+    fprintf( fp, "{\n  \"phases\": {" );
+    for ( phaseMap::const_iterator it = phases.begin(); it != phases.end(); it++ ) {
+        fprintf( fp, "%s\n    %s: { \"count\": %lu, \"total_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f }",
+                 it == phases.begin() ? "" : ",", jsonString( it->first ).c_str(), it->second.count,
+                 it->second.total / 1000.0, it->second.min / 1000.0, it->second.max / 1000.0 );
+    }
+
+    fprintf( fp, "\n  },\n  \"counters\": {" );
+    for ( totalMap::const_iterator it = counters.begin(); it != counters.end(); it++ ) {
+        fprintf( fp, "%s\n    %s: { \"count\": %lu, \"total\": %.17g }",
+                 it == counters.begin() ? "" : ",", jsonString( it->first ).c_str(), it->second.count, it->second.sum );
+    }
+
+    fprintf( fp, "\n  },\n  \"tiles\": {" );
+    for ( unsigned int t=0; t<tilePhases.size(); t++ ) {
+        fprintf( fp, "%s\n    %s: {", t ? "," : "", jsonString( tiles[t] ).c_str() );
+
+        bool first = true;
+        for ( phaseMap::const_iterator it = tilePhases[t].begin(); it != tilePhases[t].end(); it++, first = false ) {
+            fprintf( fp, "%s\n      %s: { \"count\": %lu, \"total_ms\": %.3f }",
+                     first ? "" : ",", jsonString( it->first ).c_str(), it->second.count, it->second.total / 1000.0 );
+        }
+        for ( totalMap::const_iterator it = tileCounters[t].begin(); it != tileCounters[t].end(); it++, first = false ) {
+            fprintf( fp, "%s\n      %s: { \"count\": %lu, \"total\": %.17g }",
+                     first ? "" : ",", jsonString( it->first ).c_str(), it->second.count, it->second.sum );
+        }
+
+        fprintf( fp, "\n    }" );
+    }
+    fprintf( fp, "\n  }\n}\n" );
+
+    if ( fclose( fp ) != 0 ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgTrace: error writing " << filename );
+        return false;
+    }
+
+    return true;
+}
+
+bool tgTrace::writeChromeTrace( const std::string& filename ) const
+{
+    FILE* fp = fopen( filename.c_str(), "w" );
+    if ( !fp ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgTrace: can't open " << filename << " for writing" );
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard( mutex );
+    bool first = true;
+
+    fprintf( fp, "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [" );
+
+    for ( unsigned int b=0; b<buffers.size(); b++ ) {
+        std::lock_guard<std::mutex> bufferGuard( buffers[b]->mutex );
+        unsigned int tid = buffers[b]->tid;
+
+        const std::vector<traceEvent>& events = buffers[b]->events;
+        for ( unsigned int i=0; i<events.size(); i++, first = false ) {
+            fprintf( fp, "%s\n  { \"name\": %s, \"cat\": \"tg\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %lld, \"dur\": %lld",
+                     first ? "" : ",", jsonString( events[i].name ).c_str(), tid, (long long)events[i].start, (long long)events[i].duration );
+            if ( events[i].tile >= 0 ) {
+                fprintf( fp, ", \"args\": { \"tile\": %s }", jsonString( tiles[events[i].tile] ).c_str() );
+            }
+            fprintf( fp, " }" );
+        }
+
+        const std::vector<traceCounter>& values = buffers[b]->counters;
+        for ( unsigned int i=0; i<values.size(); i++, first = false ) {
+            fprintf( fp, "%s\n  { \"name\": %s, \"cat\": \"tg\", \"ph\": \"C\", \"pid\": 1, \"tid\": %u, \"ts\": %lld, \"args\": { \"value\": %.17g } }",
+                     first ? "" : ",", jsonString( values[i].name ).c_str(), tid, (long long)values[i].time, values[i].value );
+        }
+    }
+
+    fprintf( fp, "\n] }\n" );
+
+    if ( fclose( fp ) != 0 ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "tgTrace: error writing " << filename );
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef __TG_TRACE_HXX__
+#define __TG_TRACE_HXX__
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+// Thread safe timing instrumentation.
+//
+// Code marks a phase with TG_TRACE_SCOPE( "name" ) - the time from there to
+// the end of the enclosing block is recorded as one event, along with the
+// thread, and the tile the thread is working on ( tgTrace::setTile ).
+// Counters accumulate a value per name, and per tile.
+//
+// Tracing is off until enable() is called.  A disabled scope costs one
+// atomic load.  Each thread appends to its own buffer, so threads never
+// wait on each other to record an event.
+//
+// writeJson saves a summary per phase, per counter, and per tile.
+// writeChromeTrace saves every event in the chrome trace event format,
+// which chrome://tracing and perfetto can display as a timeline.
+//
+// names must be string literals ( or otherwise live until the trace is
+// written ) - only the pointer is kept.
+
+class tgTrace
+{
+public:
+    static tgTrace& instance( void );
+
+    void enable( bool e ) { enabled.store( e, std::memory_order_relaxed ); }
+    bool isEnabled( void ) const { return enabled.load( std::memory_order_relaxed ); }
+
+    // tile the calling thread is working on - events and counters are
+    // tagged with it until the next call.  empty for none
+    static void setTile( const std::string& tile );
+
+    // microseconds since the trace was created
+    int64_t now( void ) const {
+        return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - epoch ).count();
+    }
+
+    void addEvent( const char* name, int64_t start, int64_t duration );
+    void addCounter( const char* name, double value );
+
+    bool writeJson( const std::string& filename ) const;
+    bool writeChromeTrace( const std::string& filename ) const;
+
+private:
+    tgTrace();
+
+    struct traceEvent {
+        const char* name;
+        int64_t     start;
+        int64_t     duration;
+        int         tile;           // index into tiles, -1 for none
+    };
+
+    struct traceCounter {
+        const char* name;
+        int64_t     time;
+        double      value;
+        int         tile;
+    };
+
+    // per thread event buffer - only locked against a concurrent write*()
+    struct threadBuffer {
+        std::mutex                  mutex;
+        unsigned int                tid;
+        std::vector<traceEvent>     events;
+        std::vector<traceCounter>   counters;
+    };
+
+    threadBuffer* getBuffer( void );
+    int           getTileIndex( const std::string& tile );
+
+    std::atomic<bool>                           enabled;
+    std::chrono::steady_clock::time_point       epoch;
+
+    mutable std::mutex                          mutex;          // guards buffers and tiles
+    std::vector< std::shared_ptr<threadBuffer> > buffers;
+    std::vector<std::string>                    tiles;
+    std::map<std::string, int>                  tileIndex;
+};
+
+// records the lifetime of the scope as an event
+class tgTraceScope
+{
+public:
+    tgTraceScope( const char* n ) : name(n), start(-1) {
+        if ( tgTrace::instance().isEnabled() ) {
+            start = tgTrace::instance().now();
+        }
+    }
+
+    ~tgTraceScope() {
+        if ( start >= 0 ) {
+            tgTrace::instance().addEvent( name, start, tgTrace::instance().now() - start );
+        }
+    }
+
+private:
+    const char* name;
+    int64_t     start;
+};
+
+#define TG_TRACE_CONCAT2(a, b)  a##b
+#define TG_TRACE_CONCAT(a, b)   TG_TRACE_CONCAT2(a, b)
+
+#define TG_TRACE_SCOPE(name)            tgTraceScope TG_TRACE_CONCAT(tgTraceScope_, __LINE__)( name )
+#define TG_TRACE_COUNTER(name, value)   do { if ( tgTrace::instance().isEnabled() ) tgTrace::instance().addCounter( name, value ); } while (0)
+
+#endif /* __TG_TRACE_HXX__ */
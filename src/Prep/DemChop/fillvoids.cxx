@@ -1,4 +1,5 @@
-// fillvoids.cxx -- fill voids in one array from data points of another array.
+// fillvoids.cxx -- fill voids in one array from data points of another array,
+//                  or interpolate the voids of all arrays in a work directory.
 //
 // Written by Curtis Olson, started November 2005.
 //
@@ -26,14 +27,25 @@
 
 #include <simgear/compiler.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <iostream>
 
+#include <simgear/constants.h>
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/debug/logstream.hxx>
+#include <simgear/misc/sg_dir.hxx>
 #include <simgear/misc/sg_path.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_raw.hxx>
 
 #include <stdlib.h>
 
@@ -41,18 +53,481 @@ using std::cout;
 using std::endl;
 using std::string;
 
+// void cells are anything below this
+#define VOID_ELEV           (-9000)
+#define VOID_VALUE          (-32768)
+
+// laplacian relaxation stops once no cell moves more than this (meters)
+#define LAPLACE_TOLERANCE   (0.05)
+#define LAPLACE_MAX_ITER    (500)
+
+typedef std::shared_ptr<const tgArray> ArrayRef;
+
+// Bounded cache of the arrays of a work directory.  Filling a tile reads
+// its 8 neighbors, so every array is wanted by up to 9 tiles.  Unlike
+// tgArrayCache, voids are kept - they are what we are here for.
+class NeighbourCache {
+public:
+    NeighbourCache( const string& dir, unsigned int max ) :
+        work_dir( dir ), max_arrays( max ) {}
+
+    // the array of bucket b, or an empty ref if there is none
+    ArrayRef get( const SGBucket& b ) {
+        long int index = b.gen_index();
+
+        {
+            std::lock_guard<std::mutex> guard( mutex );
+
+            std::map<long int, Entry>::iterator it = entries.find( index );
+            if ( it != entries.end() ) {
+                lru.splice( lru.begin(), lru, it->second.lru );
+                return it->second.array;
+            }
+        }
+
+        // load without holding the lock - two threads may load the same
+        // array, the second one just throws its copy away
+        string base = work_dir + "/" + b.gen_base_path() + "/" + b.gen_index_str();
+
+        tgArray* loading = new tgArray();
+        ArrayRef array;
+
+        if ( loading->open( base ) ) {
+            loading->parse( b );
+            loading->close();
+            array = ArrayRef( loading );
+        } else {
+            delete loading;
+        }
+
+        std::lock_guard<std::mutex> guard( mutex );
+
+        std::map<long int, Entry>::iterator it = entries.find( index );
+        if ( it != entries.end() ) {
+            return it->second.array;
+        }
+
+        lru.push_front( index );
+        entries[index].array = array;
+        entries[index].lru   = lru.begin();
+
+        while ( entries.size() > max_arrays ) {
+            entries.erase( lru.back() );
+            lru.pop_back();
+        }
+
+        return array;
+    }
+
+private:
+    struct Entry {
+        ArrayRef                        array;
+        std::list<long int>::iterator   lru;
+    };
+
+    string                              work_dir;
+    unsigned int                        max_arrays;
+
+    std::mutex                          mutex;
+    std::map<long int, Entry>           entries;
+    std::list<long int>                 lru;
+};
+
+// The array of one bucket, grown by margin cells on each side with data
+// sampled from the neighbor arrays.  Cells are column major, like tgArray
+class FillGrid {
+public:
+    FillGrid( const tgArray& array, const SGBucket& b, int m, NeighbourCache& cache );
+
+    // fill every void from the nearest data in 8 directions, weighted by
+    // the inverse square distance.  Returns the number of voids filled
+    int fillIDW( void );
+
+    // relax the filled voids towards a smooth ( laplacian ) surface
+    void relax( void );
+
+    int countVoids( void ) const;
+    void getArray( std::vector<short>& data ) const;
+
+private:
+    double& elev( int i, int j ) { return grid[i * rows + j]; }
+    double  elev( int i, int j ) const { return grid[i * rows + j]; }
+
+    int     cols, rows;         // including the margin
+    int     margin;
+    double  col_dist, row_dist; // cell size in meters
+
+    std::vector<double> grid;
+    std::vector<bool>   known;  // cell had data before filling
+};
+
+FillGrid::FillGrid( const tgArray& array, const SGBucket& b, int m, NeighbourCache& cache )
+{
+    margin = m;
+    cols = array.get_cols() + 2 * margin;
+    rows = array.get_rows() + 2 * margin;
+
+    double clat = b.get_center_lat() * SGD_DEGREES_TO_RADIANS;
+    col_dist = array.get_col_step() / 3600.0 * SGD_DEGREES_TO_RADIANS * SG_EQUATORIAL_RADIUS_M * cos( clat );
+    row_dist = array.get_row_step() / 3600.0 * SGD_DEGREES_TO_RADIANS * SG_EQUATORIAL_RADIUS_M;
+
+    grid.resize( cols * rows, VOID_VALUE );
+    known.resize( cols * rows, false );
+
+    long int last_index = -1;
+    ArrayRef last;
+
+    for ( int i = 0; i < cols; i++ ) {
+        for ( int j = 0; j < rows; j++ ) {
+            int ai = i - margin;
+            int aj = j - margin;
+            int e  = VOID_VALUE;
+
+            if ( ai >= 0 && ai < array.get_cols() && aj >= 0 && aj < array.get_rows() ) {
+                e = array.get_array_elev( ai, aj );
+            } else {
+                // outside our array - look it up in the neighbor it falls in
+                double lon = array.get_originx() + ai * array.get_col_step();
+                double lat = array.get_originy() + aj * array.get_row_step();
+
+                if ( lat <= -90 * 3600 || lat >= 90 * 3600 ) {
+                    continue;
+                }
+                if ( lon < -180 * 3600 ) {
+                    lon += 360 * 3600;
+                } else if ( lon >= 180 * 3600 ) {
+                    lon -= 360 * 3600;
+                }
+
+                SGBucket nb( SGGeod::fromDeg( lon / 3600.0, lat / 3600.0 ) );
+                if ( nb.gen_index() != last_index ) {
+                    last_index = nb.gen_index();
+                    last = cache.get( nb );
+                }
+
+                if ( last ) {
+                    int ni = (int)floor( ( lon - last->get_originx() ) / last->get_col_step() + 0.5 );
+                    int nj = (int)floor( ( lat - last->get_originy() ) / last->get_row_step() + 0.5 );
+
+                    if ( ni >= 0 && ni < last->get_cols() && nj >= 0 && nj < last->get_rows() ) {
+                        e = last->get_array_elev( ni, nj );
+                    }
+                }
+            }
+
+            if ( e > VOID_ELEV ) {
+                elev( i, j ) = e;
+                known[i * rows + j] = true;
+            }
+        }
+    }
+}
+
+int FillGrid::fillIDW( void )
+{
+    static const int dirs[8][2] = {
+        { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, -1 }
+    };
+
+    std::vector<double> filled( grid );
+    int count = 0;
+
+    for ( int i = 0; i < cols; i++ ) {
+        for ( int j = 0; j < rows; j++ ) {
+            if ( known[i * rows + j] ) {
+                continue;
+            }
+
+            double sum = 0.0, weights = 0.0;
+
+            for ( int d = 0; d < 8; d++ ) {
+                int ci = i + dirs[d][0];
+                int cj = j + dirs[d][1];
+                int k  = 1;
+
+                while ( ci >= 0 && ci < cols && cj >= 0 && cj < rows ) {
+                    if ( known[ci * rows + cj] ) {
+                        double dx = k * dirs[d][0] * col_dist;
+                        double dy = k * dirs[d][1] * row_dist;
+                        double w  = 1.0 / ( dx * dx + dy * dy );
+
+                        sum     += w * elev( ci, cj );
+                        weights += w;
+                        break;
+                    }
+
+                    ci += dirs[d][0];
+                    cj += dirs[d][1];
+                    k++;
+                }
+            }
+
+            if ( weights > 0.0 ) {
+                filled[i * rows + j] = sum / weights;
+                count++;
+            }
+        }
+    }
+
+    grid.swap( filled );
+
+    return count;
+}
+
+void FillGrid::relax( void )
+{
+    // gauss seidel on the filled cells only - data cells are the boundary
+    double wx = 1.0 / ( col_dist * col_dist );
+    double wy = 1.0 / ( row_dist * row_dist );
+
+    for ( int iter = 0; iter < LAPLACE_MAX_ITER; iter++ ) {
+        double max_change = 0.0;
+
+        for ( int i = 0; i < cols; i++ ) {
+            for ( int j = 0; j < rows; j++ ) {
+                if ( known[i * rows + j] || elev( i, j ) <= VOID_ELEV ) {
+                    continue;
+                }
+
+                double sum = 0.0, weights = 0.0;
+
+                if ( i > 0 && elev( i - 1, j ) > VOID_ELEV ) {
+                    sum += wx * elev( i - 1, j ); weights += wx;
+                }
+                if ( i < cols - 1 && elev( i + 1, j ) > VOID_ELEV ) {
+                    sum += wx * elev( i + 1, j ); weights += wx;
+                }
+                if ( j > 0 && elev( i, j - 1 ) > VOID_ELEV ) {
+                    sum += wy * elev( i, j - 1 ); weights += wy;
+                }
+                if ( j < rows - 1 && elev( i, j + 1 ) > VOID_ELEV ) {
+                    sum += wy * elev( i, j + 1 ); weights += wy;
+                }
+
+                if ( weights > 0.0 ) {
+                    double e = sum / weights;
+                    max_change = std::max( max_change, fabs( e - elev( i, j ) ) );
+                    elev( i, j ) = e;
+                }
+            }
+        }
+
+        if ( max_change < LAPLACE_TOLERANCE ) {
+            break;
+        }
+    }
+}
+
+int FillGrid::countVoids( void ) const
+{
+    int count = 0;
+
+    for ( int i = margin; i < cols - margin; i++ ) {
+        for ( int j = margin; j < rows - margin; j++ ) {
+            if ( elev( i, j ) <= VOID_ELEV ) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+void FillGrid::getArray( std::vector<short>& data ) const
+{
+    data.clear();
+
+    for ( int i = margin; i < cols - margin; i++ ) {
+        for ( int j = margin; j < rows - margin; j++ ) {
+            double e = elev( i, j );
+            data.push_back( e <= VOID_ELEV ? VOID_VALUE : (short)floor( e + 0.5 ) );
+        }
+    }
+}
+
+// array files are <work_dir>/<base path>/<index>.arr.raw or .arr.gz
+static void find_arrays( const SGPath& dir, std::vector<long int>& indices ) {
+    simgear::Dir d( dir );
+
+    simgear::PathList files = d.children( simgear::Dir::TYPE_FILE | simgear::Dir::NO_DOT_OR_DOTDOT );
+    for ( unsigned int i = 0; i < files.size(); i++ ) {
+        string ext = files[i].complete_lower_extension();
+        if ( ext == "arr.raw" || ext == "arr.gz" ) {
+            indices.push_back( atol( files[i].file_base().c_str() ) );
+        }
+    }
+
+    simgear::PathList subdirs = d.children( simgear::Dir::TYPE_DIR | simgear::Dir::NO_DOT_OR_DOTDOT );
+    for ( unsigned int i = 0; i < subdirs.size(); i++ ) {
+        find_arrays( subdirs[i], indices );
+    }
+}
+
+// fill the voids of one bucket, and write the result next to the array.
+// Returns true if a new array was written
+static bool fill_bucket( const string& work_dir, const SGBucket& b, NeighbourCache& cache,
+                         bool laplace, int margin, int compress_level ) {
+    ArrayRef array = cache.get( b );
+    if ( !array ) {
+        cout << "Unable to open array " << b.gen_index_str() << endl;
+        return false;
+    }
+
+    bool has_void = false;
+    for ( int i = 0; i < array->get_cols() && !has_void; ++i ) {
+        for ( int j = 0; j < array->get_rows() && !has_void; ++j ) {
+            has_void = ( array->get_array_elev(i, j) <= VOID_ELEV );
+        }
+    }
+
+    if ( !has_void ) {
+        return false;
+    }
+
+    FillGrid grid( *array, b, margin, cache );
+    grid.fillIDW();
+    if ( laplace ) {
+        grid.relax();
+    }
+
+    int remaining = grid.countVoids();
+    if ( remaining ) {
+        cout << b.gen_index_str() << " : " << remaining << " voids without data nearby" << endl;
+    }
+
+    std::vector<short> data;
+    grid.getArray( data );
+
+    // written as .new, and renamed once all buckets are done - so all
+    // buckets see their neighbors unfilled, whatever the thread order
+    string file = work_dir + "/" + b.gen_base_path() + "/" + b.gen_index_str() + TG_ARRAY_RAW_EXT + ".new";
+
+    return tgArrayRawWrite( file,
+                            (int)array->get_originx(), (int)array->get_originy(),
+                            array->get_cols(), (int)array->get_col_step(),
+                            array->get_rows(), (int)array->get_row_step(),
+                            &data[0], compress_level );
+}
+
+static int fill_directory( const string& work_dir, int num_threads, bool laplace,
+                           int margin, unsigned int cache_size, int compress_level ) {
+    std::vector<long int> indices;
+    find_arrays( SGPath( work_dir ), indices );
+
+    // bucket indices sort west to east, south to north - so threads working
+    // on consecutive buckets share most of their neighbors in the cache
+    std::sort( indices.begin(), indices.end() );
+    indices.erase( std::unique( indices.begin(), indices.end() ), indices.end() );
+
+    if ( num_threads < 1 ) {
+        num_threads = 1;
+    }
+
+    cout << "Filling voids of " << indices.size() << " arrays with " << num_threads << " threads" << endl;
+
+    NeighbourCache cache( work_dir, cache_size );
+
+    std::atomic<unsigned int> next( 0 );
+    std::vector<char>         written( indices.size(), 0 );
+    std::vector<std::thread>  threads;
+
+    for ( int t = 0; t < num_threads; t++ ) {
+        threads.push_back( std::thread( [&]() {
+            unsigned int i;
+            while ( ( i = next++ ) < indices.size() ) {
+                written[i] = fill_bucket( work_dir, SGBucket( indices[i] ), cache, laplace, margin, compress_level );
+            }
+        } ) );
+    }
+
+    for ( unsigned int t = 0; t < threads.size(); t++ ) {
+        threads[t].join();
+    }
+
+    // tgArray prefers the raw array, so an .arr.gz next to it is ignored
+    int count = 0;
+    for ( unsigned int i = 0; i < indices.size(); i++ ) {
+        if ( written[i] ) {
+            SGBucket b( indices[i] );
+            string file = work_dir + "/" + b.gen_base_path() + "/" + b.gen_index_str() + TG_ARRAY_RAW_EXT;
+
+            SGPath new_file( file + ".new" );
+            new_file.rename( SGPath( file ) );
+            count++;
+        }
+    }
+
+    cout << "Filled voids in " << count << " arrays" << endl;
+
+    return 0;
+}
+
+static void usage( const char* progname ) {
+    cout << "Usage " << progname << " [--compress=n] <src_array> <fill_array_base>" << endl;
+    cout << "      " << progname << " --dir [--threads[=n]] [--method=idw|laplace] [--margin=n] [--cache=n] [--compress=n] <work_dir>" << endl;
+    cout << endl;
+    cout << "	--dir fills the voids of all arrays in work_dir by interpolation," << endl;
+    cout << "	      reading across bucket borders up to margin cells ( default 64 )" << endl;
+    cout << "	--method idw, or idw smoothed by laplacian relaxation ( default )" << endl;
+    cout << "	--cache number of neighbor arrays kept in memory ( default 64 )" << endl;
+    cout << "	--compress zlib level 1-9 of the written arrays - 0 ( default ) writes them uncompressed" << endl;
+    exit(-1);
+}
 
 int main(int argc, char **argv) {
     sglog().setLogLevels( SG_ALL, SG_WARN );
 
-    if ( argc != 3 ) {
-	cout << "Usage " << argv[0] << " <src_array> <fill_array_base>"
-             << endl;
-	exit(-1);
+    int compress_level = 0;
+
+    if ( argc > 1 && string( argv[1] ) == "--dir" ) {
+        int num_threads = 1;
+        bool laplace = true;
+        int margin = 64;
+        unsigned int cache_size = 64;
+        int arg_pos = 2;
+
+        while ( arg_pos < argc && string( argv[arg_pos] ).find( "--" ) == 0 ) {
+            string arg = argv[arg_pos];
+
+            if ( arg.find( "--threads=" ) == 0 ) {
+                num_threads = atoi( arg.substr(10).c_str() );
+            } else if ( arg == "--threads" ) {
+                num_threads = std::thread::hardware_concurrency();
+            } else if ( arg == "--method=idw" ) {
+                laplace = false;
+            } else if ( arg == "--method=laplace" ) {
+                laplace = true;
+            } else if ( arg.find( "--margin=" ) == 0 ) {
+                margin = std::max( 0, atoi( arg.substr(9).c_str() ) );
+            } else if ( arg.find( "--cache=" ) == 0 ) {
+                cache_size = std::max( 9, atoi( arg.substr(8).c_str() ) );
+            } else if ( arg.find( "--compress=" ) == 0 ) {
+                compress_level = std::min( 9, std::max( 0, atoi( arg.substr(11).c_str() ) ) );
+            } else {
+                usage( argv[0] );
+            }
+            arg_pos++;
+        }
+
+        if ( argc - arg_pos != 1 ) {
+            usage( argv[0] );
+        }
+
+        return fill_directory( argv[arg_pos], num_threads, laplace, margin, cache_size, compress_level );
+    }
+
+    int arg_pos = 1;
+    if ( argc > 1 && string( argv[1] ).find( "--compress=" ) == 0 ) {
+        compress_level = std::min( 9, std::max( 0, atoi( string( argv[1] ).substr(11).c_str() ) ) );
+        arg_pos++;
+    }
+
+    if ( argc - arg_pos != 2 ) {
+        usage( argv[0] );
     }
 
-    string src_array_path = argv[1];
-    string fill_base_path = argv[2];
+    string src_array_path = argv[arg_pos];
+    string fill_base_path = argv[arg_pos + 1];
 
     // compute the fill array path
     SGPath tmp1( src_array_path );
@@ -111,14 +586,10 @@ int main(int argc, char **argv) {
     // write out the new data file if we filled any voids
     if ( has_void ) {
       cout << "Has voids, writing file ..." << endl;
-      bool result = src_array.write( tmp7, bucket );
-      if ( result ) {
-	// filled data written to new file name, now replace old file
-	SGPath tmp_file(tmp3);
-	tmp_file.concat(".arr.new.gz");
-	SGPath orig_file(tmp3);
-	orig_file.concat(".arr.gz");
-        orig_file.rename(tmp_file);
+      // written as a raw array, which is read in preference to the
+      // source - whether that was a .arr.gz or a stale .arr.raw
+      if ( !src_array.write( tmp7, bucket, compress_level ) ) {
+        return -1;
       }
     } else {
       cout << "no voids" << endl;
@@ -26,8 +26,12 @@
 
 #include <simgear/compiler.h>
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include <simgear/bucket/newbucket.hxx>
 #include <simgear/debug/logstream.hxx>
@@ -44,37 +48,21 @@ using std::endl;
 using std::string;
 
 
-int main(int argc, char **argv) {
-    sglog().setLogLevels( SG_ALL, SG_WARN );
-    SG_LOG( SG_GENERAL, SG_ALERT, "hgtchop version " << getTGVersion() << "\n" );
-
-    if ( argc != 4 ) {
-	cout << "Usage " << argv[0] << " <resolution> <hgt_file> <work_dir>"
-             << endl;
-        cout << endl;
- 	cout << "\tresolution must be either 1 or 3 for 1arcsec or 3arcsec"
-             << endl;       
-	exit(-1);
+// chop one hgt file into buckets
+static bool chop_file( int resolution, const string& hgt_name, const string& work_dir, int compress_level ) {
+    TGHgt hgt(resolution);
+    hgt.set_compress_level( compress_level );
+    if ( !hgt.open( hgt_name ) ) {
+        return false;
     }
+    bool loaded = hgt.load();
+    hgt.close();
 
-    int resolution = atoi( argv[1] );
-    string hgt_name = argv[2];
-    string work_dir = argv[3];
-
-    // determine if file is 1arcsec or 3arcsec variety
-    if ( resolution != 1 && resolution != 3 ) {
-        cout << "ERROR: resolution must be 1 or 3." << endl;
-        exit( -1 );
+    if ( !loaded ) {
+        cout << "ERROR: failed to load " << hgt_name << endl;
+        return false;
     }
 
-    SGPath sgp( work_dir );
-    simgear::Dir workDir(sgp);
-    workDir.create(0755);
-
-    TGHgt hgt(resolution, hgt_name);
-    hgt.load();
-    hgt.close();
-
     SGGeod min = SGGeod::fromDeg( hgt.get_originx() / 3600.0 + SG_HALF_BUCKET_SPAN,
                                   hgt.get_originy() / 3600.0 + SG_HALF_BUCKET_SPAN );
     SGGeod max = SGGeod::fromDeg( (hgt.get_originx() + hgt.get_cols() * hgt.get_col_step()) / 3600.0 - SG_HALF_BUCKET_SPAN,
@@ -94,7 +82,7 @@ int main(int argc, char **argv) {
 
         if ( (dx > 20) || (dy > 20) ) {
             cout << "somethings really wrong!!!!" << endl;
-            exit(-1);
+            return false;
         }
 
         for ( j = 0; j <= dy; j++ ) {
@@ -105,5 +93,127 @@ int main(int argc, char **argv) {
         }
     }
 
+    return true;
+}
+
+// hgt files are named after their sw corner - .hgt, .hgt.gz or .zip
+static bool is_hgt_file( const SGPath& p ) {
+    string ext = p.complete_lower_extension();
+    return ( ext == "hgt" || ext == "hgt.gz" || ext == "zip" || ext == "hgt.zip" );
+}
+
+static void usage( const char* progname ) {
+    cout << "Usage " << progname << " [--threads[=n]] [--compress=n] <resolution> <hgt_file|directory>... <work_dir>"
+         << endl;
+    cout << endl;
+    cout << "\tresolution must be either 1 or 3 for 1arcsec or 3arcsec"
+         << endl;
+    cout << "\tdirectories are searched for .hgt, .hgt.gz and .zip files"
+         << endl;
+    cout << "\t--threads chops files in parallel - on all cores if n isn't given"
+         << endl;
+    cout << "\t--compress zlib level 1-9 of the written arrays - 0 ( default ) writes"
+         << endl;
+    cout << "\t           uncompressed arrays, which tgconstruct maps rather than reads"
+         << endl;
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    sglog().setLogLevels( SG_ALL, SG_WARN );
+    SG_LOG( SG_GENERAL, SG_ALERT, "hgtchop version " << getTGVersion() << "\n" );
+
+    int num_threads = 1;
+    int compress_level = 0;
+    int arg_pos = 1;
+
+    while ( arg_pos < argc && string( argv[arg_pos] ).find( "--" ) == 0 ) {
+        string arg = argv[arg_pos];
+
+        if ( arg.find( "--threads=" ) == 0 ) {
+            num_threads = atoi( arg.substr(10).c_str() );
+        } else if ( arg == "--threads" ) {
+            num_threads = std::thread::hardware_concurrency();
+        } else if ( arg.find( "--compress=" ) == 0 ) {
+            compress_level = std::min( 9, std::max( 0, atoi( arg.substr(11).c_str() ) ) );
+        } else {
+            usage( argv[0] );
+        }
+        arg_pos++;
+    }
+
+    if ( argc - arg_pos < 3 ) {
+        usage( argv[0] );
+    }
+
+    int resolution = atoi( argv[arg_pos] );
+    string work_dir = argv[argc - 1];
+
+    // determine if file is 1arcsec or 3arcsec variety
+    if ( resolution != 1 && resolution != 3 ) {
+        cout << "ERROR: resolution must be 1 or 3." << endl;
+        exit( -1 );
+    }
+
+    // gather the files to chop
+    std::vector<string> hgt_files;
+    for ( int i = arg_pos + 1; i < argc - 1; i++ ) {
+        SGPath p( argv[i] );
+
+        if ( p.isDir() ) {
+            simgear::Dir dir( p );
+            simgear::PathList files = dir.children( simgear::Dir::TYPE_FILE | simgear::Dir::NO_DOT_OR_DOTDOT );
+            std::sort( files.begin(), files.end() );
+
+            for ( unsigned int j = 0; j < files.size(); j++ ) {
+                if ( is_hgt_file( files[j] ) ) {
+                    hgt_files.push_back( files[j].str() );
+                }
+            }
+        } else {
+            hgt_files.push_back( p.str() );
+        }
+    }
+
+    SGPath sgp( work_dir );
+    simgear::Dir workDir(sgp);
+    workDir.create(0755);
+
+    if ( num_threads < 1 ) {
+        num_threads = 1;
+    }
+    if ( num_threads > (int)hgt_files.size() ) {
+        num_threads = hgt_files.size();
+    }
+
+    cout << "Chopping " << hgt_files.size() << " files with " << num_threads << " threads" << endl;
+
+    // each thread takes the next file until there are none left.  Near
+    // the poles several files share a bucket - write_area serializes
+    // writers of the same bucket
+    std::atomic<unsigned int> next( 0 );
+    std::atomic<unsigned int> failed( 0 );
+    std::vector<std::thread>  threads;
+
+    for ( int t = 0; t < num_threads; t++ ) {
+        threads.push_back( std::thread( [&]() {
+            unsigned int i;
+            while ( ( i = next++ ) < hgt_files.size() ) {
+                if ( !chop_file( resolution, hgt_files[i], work_dir, compress_level ) ) {
+                    failed++;
+                }
+            }
+        } ) );
+    }
+
+    for ( unsigned int t = 0; t < threads.size(); t++ ) {
+        threads[t].join();
+    }
+
+    if ( failed ) {
+        cout << failed << " of " << hgt_files.size() << " files failed" << endl;
+        return 1;
+    }
+
     return 0;
 }
@@ -27,6 +27,13 @@
 //#endif
 
 #include <algorithm>
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <simgear/compiler.h>
 #include <simgear/bucket/newbucket.hxx>
@@ -34,6 +41,7 @@
 #include <simgear/io/lowlevel.hxx>
 #include <simgear/misc/sg_path.hxx>
 
+#include <Lib/terragear/tg_array_raw.hxx>
 #include <Lib/terragear/tg_rectangle.hxx>
 
 #include <ogrsf_frmts.h> 
@@ -134,11 +142,8 @@ public:
         return pxSizeY * 3600;
     }
 
-    void GetDataChunk(int *buffer,
-                      double x, double y,
-                      double colstep, double rowstep,
-                      int w, int h,
-                      int srcband = 1, int nodata = -32768);
+    double GetPixelSizeX() const { return pxSizeX; }
+    double GetPixelSizeY() const { return pxSizeY; }
 
 protected:
     /* The dataset */
@@ -229,12 +234,47 @@ ImageInfo::ImageInfo(GDALDataset *dataset) :
            " e=" << east << " w=" << west);
 }
 
-void ImageInfo::GetDataChunk(int *buffer,
-                             double x, double y,
-                             double colstep, double rowstep,
-                             int w, int h,
-                             int srcband, int nodata)
+/*
+ * GDAL datasets can't be shared between threads, so each worker thread
+ * reads an image through its own ImageWarper - with its own dataset
+ * handle.  The transformer and warp operation only depend on the image,
+ * so they are set up once, and only the destination origin changes from
+ * bucket to bucket.
+ */
+class ImageWarper {
+public:
+    ImageWarper(const char* name, double pxSizeX, double pxSizeY,
+                GDALResampleAlg resample = GRA_NearestNeighbour, int srcband = 1);
+    ~ImageWarper();
+
+    void GetDataChunk(int *buffer,
+                      double x, double y,
+                      double colstep, double rowstep,
+                      int w, int h);
+
+private:
+    GDALDataset *dataset;
+
+    double pxSizeX, pxSizeY;
+
+    /* the destination part of the transformation is updated per chunk */
+    SimpleRasterTransformerInfo xformData;
+
+    GDALWarpOperation oOperation;
+};
+
+ImageWarper::ImageWarper(const char* name, double pxX, double pxY,
+                         GDALResampleAlg resample, int srcband) :
+    pxSizeX(pxX), pxSizeY(pxY)
 {
+    dataset = (GDALDataset*)GDALOpenEx(name, GDAL_OF_RASTER | GDAL_OF_READONLY, NULL, NULL, NULL);
+    if (dataset == NULL) {
+        SG_LOG(SG_GENERAL, SG_ALERT,
+               "Could not open dataset '" << name << "'"
+               ":" << CPLGetLastErrorMsg());
+        exit(1);
+    }
+
     OGRSpatialReference wgs84SRS;
 
     wgs84SRS.SetWellKnownGeogCS( "EPSG:4326" );
@@ -243,30 +283,24 @@ void ImageInfo::GetDataChunk(int *buffer,
     wgs84SRS.exportToWkt(&wgs84WKT);
 
     /* Setup a raster transformation from WGS84 to raster coordinates of the array files */
-    SimpleRasterTransformerInfo xformData;
     xformData.pTransformerArg = GDALCreateGenImgProjTransformer(
         dataset, NULL,
         NULL, wgs84WKT,
         FALSE,
         0.0,
         1);
+    CPLFree(wgs84WKT);
 
     xformData.pfnTransformer = GDALGenImgProjTransform;
-    xformData.x0 = x - pxSizeX * 0.5;
-    xformData.y0 = y - pxSizeY * 0.5;
-    xformData.col_step = colstep;
-    xformData.row_step = rowstep;
-
-    // TODO: check if this image can actually cover part of the chunk
+    xformData.x0 = 0.0;
+    xformData.y0 = 0.0;
+    xformData.col_step = 1.0;
+    xformData.row_step = 1.0;
 
     /* establish the full source to target transformation */
     GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
 
-    int srcBandNumbers[] = { srcband };
-    int dstBandNumbers[] = { 1 };
-
     double srcNodataReal;
-    double srcNodataImag   =  0.0;
     int    srcHasNodataValue;
 
     srcNodataReal = dataset->GetRasterBand(srcband)->GetNoDataValue(&srcHasNodataValue);
@@ -274,78 +308,177 @@ void ImageInfo::GetDataChunk(int *buffer,
     psWarpOptions->hSrcDS = dataset;
     psWarpOptions->hDstDS = NULL;
     psWarpOptions->nBandCount = 1;
-    psWarpOptions->panSrcBands = srcBandNumbers;
-    psWarpOptions->panDstBands = dstBandNumbers;
+    psWarpOptions->panSrcBands = (int *)CPLMalloc(sizeof(int));
+    psWarpOptions->panSrcBands[0] = srcband;
+    psWarpOptions->panDstBands = (int *)CPLMalloc(sizeof(int));
+    psWarpOptions->panDstBands[0] = 1;
     psWarpOptions->nSrcAlphaBand = 0;
     psWarpOptions->nDstAlphaBand = 0;
-    psWarpOptions->padfSrcNoDataReal = (srcHasNodataValue ? &srcNodataReal : NULL);
-    psWarpOptions->padfSrcNoDataImag = (srcHasNodataValue ? &srcNodataImag : NULL);
+    if (srcHasNodataValue) {
+        psWarpOptions->padfSrcNoDataReal = (double *)CPLMalloc(sizeof(double));
+        psWarpOptions->padfSrcNoDataReal[0] = srcNodataReal;
+        psWarpOptions->padfSrcNoDataImag = (double *)CPLMalloc(sizeof(double));
+        psWarpOptions->padfSrcNoDataImag[0] = 0.0;
+    }
     psWarpOptions->padfDstNoDataReal = NULL;
-    psWarpOptions->eResampleAlg = GRA_NearestNeighbour;
+    psWarpOptions->eResampleAlg = resample;
     psWarpOptions->eWorkingDataType = GDT_Int32;
 
     psWarpOptions->pfnTransformer = SimpleRasterTransformer;
     psWarpOptions->pTransformerArg = &xformData;
 
-    GDALWarpOperation oOperation;
+    /* the operation keeps a copy of the options */
     oOperation.Initialize( psWarpOptions );
+    GDALDestroyWarpOptions( psWarpOptions );
+}
+
+ImageWarper::~ImageWarper()
+{
+    GDALDestroyGenImgProjTransformer( xformData.pTransformerArg );
+    GDALClose( dataset );
+}
+
+void ImageWarper::GetDataChunk(int *buffer,
+                               double x, double y,
+                               double colstep, double rowstep,
+                               int w, int h)
+{
+    xformData.x0 = x - pxSizeX * 0.5;
+    xformData.y0 = y - pxSizeY * 0.5;
+    xformData.col_step = colstep;
+    xformData.row_step = rowstep;
 
     /* do the warp */
     if (oOperation.WarpRegionToBuffer(0, 0, w, h, buffer, GDT_Int32) != CE_None) {
         SG_LOG(SG_GENERAL, SG_ALERT,
-               "Could not warp to buffer on dataset '" << GetDescription() << "'"
+               "Could not warp to buffer on dataset '" << dataset->GetDescription() << "'"
                ":" << CPLGetLastErrorMsg());
     }
+}
 
-    /* clean up */
-    psWarpOptions->panSrcBands = NULL;
-    psWarpOptions->panDstBands = NULL;
-    psWarpOptions->padfSrcNoDataReal = NULL;
-    psWarpOptions->padfSrcNoDataImag = NULL;
-    psWarpOptions->padfDstNoDataReal = NULL;
+/*
+ * Images binned by the 1x1 degree cells their bounds touch, so a bucket
+ * only checks the images near it.
+ */
+class ImageGrid {
+public:
+    void Add(int index, const ImageInfo* image) {
+        double n, s, e, w;
+        image->GetBounds(n, s, e, w);
 
-    GDALDestroyGenImgProjTransformer( xformData.pTransformerArg );
-    GDALDestroyWarpOptions( psWarpOptions );
-}
+        for (int x = (int)floor(w); x <= (int)floor(e); x++) {
+            for (int y = (int)floor(s); y <= (int)floor(n); y++) {
+                cells[std::make_pair(x, y)].push_back(index);
+            }
+        }
+    }
+
+    /* images whose cells touch the bounds, in the order they were added */
+    void Query(double n, double s, double e, double w, std::vector<int>& result) const {
+        result.clear();
+
+        for (int x = (int)floor(w); x <= (int)floor(e); x++) {
+            for (int y = (int)floor(s); y <= (int)floor(n); y++) {
+                std::map<std::pair<int, int>, std::vector<int> >::const_iterator it = cells.find(std::make_pair(x, y));
+                if (it != cells.end()) {
+                    result.insert(result.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+
+private:
+    std::map<std::pair<int, int>, std::vector<int> > cells;
+};
 
 void write_bucket(const std::string& work_dir, SGBucket bucket,
                   int* buffer,
                   int min_x, int min_y,
                   int span_x, int span_y,
-                  int col_step, int row_step)
+                  int col_step, int row_step,
+                  int compress_level)
 {
     // generate output file name
     std::string base = bucket.gen_base_path();
     std::string path = work_dir + "/" + base;
     SGPath sgp( path );
     sgp.append( "dummy" );
-    sgp.create_dir( 0755 );
-
-    std::string array_file = path + "/" + bucket.gen_index_str() + ".arr.gz";
-
-    gzFile fp;
-    if ( (fp = gzopen(array_file.c_str(), "wb9")) == NULL ) {
-        SG_LOG(SG_GENERAL, SG_ALERT, "cannot open " << array_file << " for writing!");
-        exit(-1);
+    {
+        // worker threads share the parent directories
+        static std::mutex dirLock;
+        std::lock_guard<std::mutex> guard( dirLock );
+        sgp.create_dir( 0755 );
     }
 
-    int32_t header = 0x54474152; // 'TGAR'
-    sgWriteLong(fp, header);
-    sgWriteInt(fp, min_x); sgWriteInt(fp, min_y);
-    sgWriteInt(fp, span_x); sgWriteInt(fp, col_step);
-    sgWriteInt(fp, span_y); sgWriteInt(fp, row_step);
+    std::string array_file = path + "/" + bucket.gen_index_str() + TG_ARRAY_RAW_EXT;
 
+    // raw arrays are column major
+    std::vector<short> data( span_x * span_y );
     for ( int x = 0; x < span_x; ++x ) {
         for ( int y = 0; y < span_y; ++y ) {
-            sgWriteShort(fp, buffer[ y * span_x + x ]);
+            data[ x * span_y + y ] = buffer[ y * span_x + x ];
         }
     }
 
-    gzclose(fp);
+    if ( !tgArrayRawWrite( array_file, min_x, min_y, span_x, col_step, span_y, row_step, &data[0], compress_level ) ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "cannot write " << array_file << "!");
+        exit(-1);
+    }
 }
 
+/*
+ * datasets each worker keeps open - the least recently used are closed
+ * beyond this, so a large mosaic doesn't need threads * images file handles
+ */
+#define MAX_OPEN_WARPERS    (8)
+
+/* the images as seen by one worker thread */
+struct ImageSet {
+    ImageInfo**                 images;
+    const char**                names;
+    const ImageGrid*            grid;
+    int                         col_step, row_step;
+    GDALResampleAlg             resample;
+
+    /*
+     * mosaic mode: datasets listed first take priority, and later ones only
+     * fill the cells still void - instead of simply overwriting them
+     */
+    bool                        mosaic;
+
+    /* zlib level of the written arrays - 0 writes them uncompressed */
+    int                         compress_level;
+
+    /* opened when this thread needs them, most recently used first */
+    std::vector<ImageWarper*>   warpers;
+    std::list<int>              open;
+
+    ImageWarper* GetWarper(int i) {
+        if ( warpers[i] ) {
+            open.remove(i);
+        } else {
+            if ( open.size() >= MAX_OPEN_WARPERS ) {
+                delete warpers[open.back()];
+                warpers[open.back()] = NULL;
+                open.pop_back();
+            }
+
+            warpers[i] = new ImageWarper(names[i],
+                                         images[i]->GetPixelSizeX(),
+                                         images[i]->GetPixelSizeY(),
+                                         resample);
+        }
+
+        open.push_front(i);
+        return warpers[i];
+    }
+};
+
 void process_bucket(const SGPath& work_dir, SGBucket bucket,
-                    ImageInfo* images[], int imagecount,
+                    ImageSet& imageset,
                     bool forceWrite = false)
 {
     double bnorth, bsouth, beast, bwest;
@@ -366,16 +499,7 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
     min_x = (int)(bwest * 3600.0);
     min_y = (int)(bsouth * 3600.0);
 
-    // Determine minimum common arcsec steps across images
-    int col_step = -1, row_step = -1;
-    for (int i = 0; i < imagecount; i++) {
-        if ( images[i]->GetColStepArcsec() > col_step ) {
-            col_step = images[i]->GetColStepArcsec();
-        }
-        if ( images[i]->GetRowStepArcsec() > row_step ) {
-            row_step = images[i]->GetRowStepArcsec();
-        }
-    }
+    int col_step = imageset.col_step, row_step = imageset.row_step;
 
     span_x = (bucket.get_width() * 3600 / col_step) + 1;
     span_y = (bucket.get_height() * 3600 / row_step) + 1;
@@ -383,15 +507,54 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
     int cellcount = span_x * span_y;
     boost::scoped_array<int> buffer(new int[cellcount]);
 
-    ::memset(buffer.get(), 0, cellcount * sizeof(int));
+    boost::scoped_array<int> chunk;
+    int voidCellCount = cellcount;
+
+    if ( imageset.mosaic ) {
+        std::fill(buffer.get(), buffer.get() + cellcount, -32768);
+        chunk.reset(new int[cellcount]);
+    } else {
+        ::memset(buffer.get(), 0, cellcount * sizeof(int));
+    }
+
+    std::vector<int> candidates;
+    imageset.grid->Query(bnorth, bsouth, beast, bwest, candidates);
+
+    for (unsigned int c = 0; c < candidates.size() && voidCellCount > 0; c++) {
+        int i = candidates[c];
+
+        if ( !imageset.images[i]->GetBoundingBox().intersects(BucketBounds) ) {
+            continue;
+        }
+
+        ImageWarper* warper = imageset.GetWarper(i);
+
+        if ( !imageset.mosaic ) {
+            warper->GetDataChunk(buffer.get(),
+                                 bwest, bsouth,
+                                 col_step / 3600.0, row_step / 3600.0,
+                                 span_x, span_y );
+            continue;
+        }
+
+        /* warp into a scratch chunk, and only take what is still void */
+        std::fill(chunk.get(), chunk.get() + cellcount, -32768);
 
-    for (int i = 0; i < imagecount; i++) {
-        if ( images[i]->GetBoundingBox().intersects(BucketBounds) ) {
-            images[i]->GetDataChunk(buffer.get(),
-                                    bwest, bsouth,
-                                    col_step / 3600.0, row_step / 3600.0,
-                                    span_x, span_y );
+        warper->GetDataChunk(chunk.get(),
+                             bwest, bsouth,
+                             col_step / 3600.0, row_step / 3600.0,
+                             span_x, span_y );
+
+        int filled = 0;
+        for (int j = 0; j < cellcount; j++) {
+            if ( buffer[j] == -32768 && chunk[j] != -32768 ) {
+                buffer[j] = chunk[j];
+                filled++;
+            }
         }
+        voidCellCount -= filled;
+
+        SG_LOG(SG_GENERAL, SG_DEBUG, "    " << imageset.images[i]->GetDescription() << " filled " << filled << " cells");
     }
 
     /* ...check the amount of undefined cells... */
@@ -420,16 +583,52 @@ void process_bucket(const SGPath& work_dir, SGBucket bucket,
                  buffer.get(),
                  min_x, min_y,
                  span_x, span_y,
-                 col_step, row_step);
+                 col_step, row_step,
+                 imageset.compress_level);
 }
 
 int main(int argc, const char **argv)
 {
     sglog().setLogLevels( SG_ALL, SG_INFO );
 
+    int num_threads = 1;
+    GDALResampleAlg resample = GRA_NearestNeighbour;
+    bool mosaic = false;
+    int compress_level = 0;
+
+    while ( argc > 1 && !strncmp(argv[1], "--", 2) && strcmp(argv[1], "--") ) {
+        std::string arg = argv[1];
+
+        if ( arg == "--threads" ) {
+            num_threads = std::thread::hardware_concurrency();
+        } else if ( arg.find("--threads=") == 0 ) {
+            num_threads = atoi(arg.substr(10).c_str());
+        } else if ( arg == "--resample=near" ) {
+            resample = GRA_NearestNeighbour;
+        } else if ( arg == "--resample=bilinear" ) {
+            resample = GRA_Bilinear;
+        } else if ( arg == "--resample=cubic" ) {
+            resample = GRA_Cubic;
+        } else if ( arg == "--mosaic" ) {
+            mosaic = true;
+        } else if ( arg.find("--compress=") == 0 ) {
+            compress_level = std::min(9, std::max(0, atoi(arg.substr(11).c_str())));
+        } else {
+            SG_LOG(SG_GENERAL, SG_ALERT, "Unknown option " << arg);
+            exit(-1);
+        }
+
+        argv++;
+        argc--;
+    }
+
     if ( argc < 3 ) {
         SG_LOG(SG_GENERAL, SG_ALERT,
-               "Usage " << argv[0] << " <work_dir> <datasetname...> [-- <bucket-idx> ...]");
+               "Usage " << argv[0] << " [--threads[=n]] [--resample=near|bilinear|cubic] [--mosaic] [--compress=n] <work_dir> <datasetname...> [-- <bucket-idx> ...]");
+        SG_LOG(SG_GENERAL, SG_ALERT,
+               "  --mosaic : datasets listed first take priority, later ones only fill their voids");
+        SG_LOG(SG_GENERAL, SG_ALERT,
+               "  --compress : zlib level 1-9 of the written arrays - 0 ( default ) writes them uncompressed");
         exit(-1);
     }
 
@@ -458,6 +657,7 @@ int main(int argc, const char **argv)
     const char** datasetnames = argv + 2;
 
     boost::scoped_array<ImageInfo *> images( new ImageInfo *[datasetcount] );
+    ImageGrid grid;
 
     double north = -1000, south = 1000, east = -1000, west = 1000;
 
@@ -479,6 +679,7 @@ int main(int argc, const char **argv)
         }
 
         images[i] = new ImageInfo(dataset);
+        grid.Add(i, images[i]);
 
         double inorth, isouth, ieast, iwest;
         images[i]->GetBounds(inorth, isouth, ieast, iwest);
@@ -491,6 +692,17 @@ int main(int argc, const char **argv)
 
     SG_LOG(SG_GENERAL, SG_INFO, "Bounds of all datasets: n=" << north << " s=" << south << " e=" << east << " w=" << west);
 
+    // Determine minimum common arcsec steps across images
+    int col_step = -1, row_step = -1;
+    for (int i = 0; i < datasetcount; i++) {
+        if ( images[i]->GetColStepArcsec() > col_step ) {
+            col_step = images[i]->GetColStepArcsec();
+        }
+        if ( images[i]->GetRowStepArcsec() > row_step ) {
+            row_step = images[i]->GetRowStepArcsec();
+        }
+    }
+
     /*
      * Step 2: If no tiles were specified, go through all tiles contained in
      *         the common bounds of all datasets and find those which have
@@ -499,6 +711,9 @@ int main(int argc, const char **argv)
      *         all of them. Warn if no sufficient coverage (non-null pixels) is
      *         available.
      */
+    std::vector<SGBucket> buckets;
+    bool forceWrite;
+
     if (tilecount == 0) {
         /*
          * No tiles were specified, so we determine the common bounds of all
@@ -515,21 +730,60 @@ int main(int argc, const char **argv)
 
         for (int x = 0; x <= dx; x++) {
             for (int y = 0; y <= dy; y++) {
-                SGBucket bucket = start.sibling(x, y);
-
-                process_bucket(work_dir, bucket, images.get(), datasetcount);
+                buckets.push_back(start.sibling(x, y));
             }
         }
+        forceWrite = false;
     } else {
         /*
          * Tiles were specified, so process them and warn if not enough
          * data is available, but write them in any case.
          */
         for (int i = 0; i < tilecount; i++) {
-            SGBucket bucket(atol(tilenames[i]));
-
-            process_bucket(work_dir, bucket, images.get(), datasetcount, true);
+            buckets.push_back(SGBucket(atol(tilenames[i])));
         }
+        forceWrite = true;
+    }
+
+    /*
+     * Step 3: Distribute the buckets over the worker threads - each takes
+     *         the next bucket until there are none left.
+     */
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    SG_LOG(SG_GENERAL, SG_INFO, "Processing " << buckets.size() << " buckets with " << num_threads << " threads");
+
+    std::atomic<unsigned int> next( 0 );
+    std::vector<std::thread>  threads;
+
+    for (int t = 0; t < num_threads; t++) {
+        threads.push_back( std::thread( [&]() {
+            ImageSet imageset;
+            imageset.images   = images.get();
+            imageset.names    = datasetnames;
+            imageset.grid     = &grid;
+            imageset.col_step = col_step;
+            imageset.row_step = row_step;
+            imageset.resample = resample;
+            imageset.mosaic   = mosaic;
+            imageset.compress_level = compress_level;
+            imageset.warpers.resize(datasetcount, NULL);
+
+            unsigned int i;
+            while ( ( i = next++ ) < buckets.size() ) {
+                process_bucket(work_dir, buckets[i], imageset, forceWrite);
+            }
+
+            for (unsigned int w = 0; w < imageset.warpers.size(); w++) {
+                delete imageset.warpers[w];
+            }
+        } ) );
+    }
+
+    for (unsigned int t = 0; t < threads.size(); t++) {
+        threads[t].join();
     }
 
     return 0;
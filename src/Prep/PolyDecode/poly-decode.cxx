@@ -22,8 +22,11 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
 //
 
+#include <condition_variable>
+#include <deque>
 #include <string>
 #include <map>
+#include <mutex>
 
 #include <boost/thread.hpp>
 #include <ogrsf_frmts.h>
@@ -40,6 +43,7 @@
 
 #include <terragear/polygon_set/tg_polygon_set.hxx>
 #include <terragear/polygon_set/tg_polygon_chop.hxx>
+#include <terragear/tg_trace.hxx>
 
 #define SUPPORT_MULTITHREADING 1
 
@@ -62,10 +66,12 @@ string attribute_query;
 bool use_spatial_query=false;
 double spat_min_x, spat_min_y, spat_max_x, spat_max_y;
 int num_threads = 16;
+int num_readers = 1;
+int queue_size  = 64;   // batches of features waiting to be decoded
 bool save_shapefiles=false;
 std::string ds_name=".";
 
-SGLockedQueue<OGRFeature *> global_workQueue;
+#define FEATURE_BATCH_SIZE  (64)     // features passed from a reader to the decoders at a time
 
 /* very GDAL specific here... */
 inline static bool is_ocean_area( const std::string &area ) {
@@ -82,10 +88,144 @@ inline static bool is_null_area( const std::string& area ) {
 
 #if SUPPORT_MULTITHREADING    
 
+// Features are streamed from the reader(s) to the decoders in batches
+// through a bounded queue.  Readers block while the queue is full, so only
+// queue_size batches are in memory at a time - not the whole layer.
+class FeatureQueue
+{
+public:
+    FeatureQueue( unsigned int max ) : maxBatches(max), closed(false) {}
+
+    // blocks while the queue is full
+    void push( std::vector<OGRFeature *>& batch ) {
+        std::unique_lock<std::mutex> guard( mutex );
+
+        while ( batches.size() >= maxBatches ) {
+            notFull.wait( guard );
+        }
+
+        batches.push_back( std::vector<OGRFeature *>() );
+        batches.back().swap( batch );
+        notEmpty.notify_one();
+    }
+
+    // blocks while the queue is empty.
+    // returns false once the queue is empty, and closed
+    bool pop( std::vector<OGRFeature *>& batch ) {
+        std::unique_lock<std::mutex> guard( mutex );
+
+        while ( batches.empty() && !closed ) {
+            notEmpty.wait( guard );
+        }
+
+        if ( batches.empty() ) {
+            return false;
+        }
+
+        batch.swap( batches.front() );
+        batches.pop_front();
+        notFull.notify_one();
+
+        return true;
+    }
+
+    // all readers are done
+    void close( void ) {
+        std::lock_guard<std::mutex> guard( mutex );
+
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    std::mutex                              mutex;
+    std::condition_variable                 notFull;
+    std::condition_variable                 notEmpty;
+    std::deque< std::vector<OGRFeature *> > batches;
+    unsigned int                            maxBatches;
+    bool                                    closed;
+};
+
+// read count features starting at start ( all remaining if count < 0 ) into the queue
+void readFeatures( OGRLayer* poLayer, GIntBig start, GIntBig count, FeatureQueue& queue )
+{
+    std::vector<OGRFeature *> batch;
+    OGRFeature*               poFeature;
+    GIntBig                   numRead = 0;
+
+    poLayer->SetNextByIndex( start );
+    while ( ( count < 0 || numRead < count ) && ( poFeature = poLayer->GetNextFeature() ) != NULL )
+    {
+        batch.push_back( poFeature );
+        numRead++;
+
+        if ( batch.size() >= FEATURE_BATCH_SIZE ) {
+            queue.push( batch );
+            batch.clear();
+        }
+    }
+
+    if ( !batch.empty() ) {
+        queue.push( batch );
+    }
+}
+
+void setupQueries( OGRLayer* poLayer, OGRSpatialReference* oSourceSRS, OGRSpatialReference* oTargetSRS );
+
+// additional reader for a range of features - with it's own datasource handle,
+// as GDAL datasources can't be shared between threads
+class Reader : public SGThread
+{
+public:
+    Reader( const string& ds, const string& ln, GIntBig s, GIntBig c, FeatureQueue& q ) : datasource(ds), layername(ln), start(s), count(c), queue(q) {
+        poDS = NULL;
+    }
+
+    // features reference the layer definition - so close after they are decoded
+    void close( void ) {
+        if ( poDS ) {
+            GDALClose( poDS );
+            poDS = NULL;
+        }
+    }
+
+private:
+    virtual void run();
+
+    string          datasource;
+    string          layername;
+    GIntBig         start;
+    GIntBig         count;
+    FeatureQueue&   queue;
+    GDALDataset*    poDS;
+};
+
+void Reader::run()
+{
+    poDS = (GDALDataset*)GDALOpenEx( datasource.c_str(), GDAL_OF_VECTOR | GDAL_OF_READONLY, NULL, NULL, NULL );
+    if ( poDS == NULL ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "Reader failed opening datasource " << datasource );
+        exit( 1 );
+    }
+
+    OGRLayer* poLayer = poDS->GetLayerByName( layername.c_str() );
+    if ( poLayer == NULL ) {
+        SG_LOG( SG_GENERAL, SG_ALERT, "Reader failed opening layer " << layername << " from datasource " << datasource );
+        exit( 1 );
+    }
+
+    OGRSpatialReference oTargetSRS;
+    oTargetSRS.SetWellKnownGeogCS( "WGS84" );
+    setupQueries( poLayer, poLayer->GetSpatialRef(), &oTargetSRS );
+
+    SG_LOG( SG_GENERAL, SG_INFO, "Reader " << current() << " reading " << count << " features from " << start );
+    readFeatures( poLayer, start, count, queue );
+}
+
 class Decoder : public SGThread
 {
 public:
-    Decoder( OGRCoordinateTransformation *poct, int atf, tgChopper& c, std::mutex& l ) : chopper(c), lock(l) {
+    Decoder( OGRCoordinateTransformation *poct, int atf, tgChopper& c, FeatureQueue& q ) : chopper(c), queue(q) {
         poCT = poct;
         area_type_field = atf;
     }
@@ -93,6 +233,7 @@ public:
 private:
     virtual void run();
 
+    void processFeature(OGRFeature *poFeature );
     void processPolygon(OGRFeature *poFeature, OGRPolygon* poGeometry, const string& area_type );
 
 private:
@@ -100,9 +241,9 @@ private:
     OGRCoordinateTransformation *poCT;
 
     // Store the reults per tile
-    tgChopper& chopper;
-    std::mutex&   lock;
-    int        area_type_field;
+    tgChopper&    chopper;
+    FeatureQueue& queue;
+    int           area_type_field;
 };
 
 void Decoder::processPolygon(OGRFeature *poFeature, OGRPolygon* poGeometry, const string& area_type )
@@ -125,85 +266,92 @@ void Decoder::processPolygon(OGRFeature *poFeature, OGRPolygon* poGeometry, cons
     //lock.unlock();
 }
 
-void Decoder::run()
+void Decoder::processFeature( OGRFeature *poFeature )
 {
-    // as long as we have geometry to parse, do so
-    while (!global_workQueue.empty()) {
-        OGRFeature *poFeature = global_workQueue.pop();
-        // SG_LOG( SG_GENERAL, SG_INFO, " chopping feature with thread " << current() << " remaining features is " << global_workQueue.size() );
-
-        if ( poFeature ) {
-            OGRGeometry *poGeometry = poFeature->GetGeometryRef();
-
-            if (poGeometry==NULL) {
-                SG_LOG( SG_GENERAL, SG_INFO, "Found feature without geometry!" );
-                if (!continue_on_errors) {
-                    SG_LOG( SG_GENERAL, SG_ALERT, "Aborting!" );
-                    exit( 1 );
-                } else {
-                    continue;
-                }
-            }
+    OGRGeometry *poGeometry = poFeature->GetGeometryRef();
 
-            OGRwkbGeometryType geoType=wkbFlatten(poGeometry->getGeometryType());
-            if (geoType!=wkbPolygon && geoType!=wkbMultiPolygon) {
-                SG_LOG( SG_GENERAL, SG_INFO, "Unknown feature" );
-                 OGRFeature::DestroyFeature( poFeature );
+    if (poGeometry==NULL) {
+        SG_LOG( SG_GENERAL, SG_INFO, "Found feature without geometry!" );
+        if (!continue_on_errors) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "Aborting!" );
+            exit( 1 );
+        } else {
+            OGRFeature::DestroyFeature( poFeature );
+            return;
+        }
+    }
 
-                continue;
-            }
+    OGRwkbGeometryType geoType=wkbFlatten(poGeometry->getGeometryType());
+    if (geoType!=wkbPolygon && geoType!=wkbMultiPolygon) {
+        SG_LOG( SG_GENERAL, SG_INFO, "Unknown feature" );
+        OGRFeature::DestroyFeature( poFeature );
 
-            string area_type_name=area_type;
-            if (area_type_field!=-1) {
-                area_type_name=poFeature->GetFieldAsString(area_type_field);
-            }
+        return;
+    }
 
-            if ( is_ocean_area(area_type_name) ) {
-                // interior of polygon is ocean, holes are islands
+    string area_type_name=area_type;
+    if (area_type_field!=-1) {
+        area_type_name=poFeature->GetFieldAsString(area_type_field);
+    }
 
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Ocean area ... SKIPPING!" );
-                OGRFeature::DestroyFeature( poFeature );
-                // Ocean data now comes from GSHHS so we want to ignore
-                // all other ocean data
-                continue;
-            } else if ( is_void_area(area_type_name) ) {
-                // interior is ????
+    if ( is_ocean_area(area_type_name) ) {
+        // interior of polygon is ocean, holes are islands
 
-                // skip for now
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Void area ... SKIPPING!" );
-                OGRFeature::DestroyFeature( poFeature );
-                continue;
-            } else if ( is_null_area(area_type_name) ) {
-                // interior is ????
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Ocean area ... SKIPPING!" );
+        OGRFeature::DestroyFeature( poFeature );
+        // Ocean data now comes from GSHHS so we want to ignore
+        // all other ocean data
+        return;
+    } else if ( is_void_area(area_type_name) ) {
+        // interior is ????
+
+        // skip for now
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Void area ... SKIPPING!" );
+        OGRFeature::DestroyFeature( poFeature );
+        return;
+    } else if ( is_null_area(area_type_name) ) {
+        // interior is ????
 
-                // skip for now
-                SG_LOG(  SG_GENERAL, SG_ALERT, "Null area ... SKIPPING!" );
-                OGRFeature::DestroyFeature( poFeature );
-                continue;
-            }
+        // skip for now
+        SG_LOG(  SG_GENERAL, SG_ALERT, "Null area ... SKIPPING!" );
+        OGRFeature::DestroyFeature( poFeature );
+        return;
+    }
 
-            poGeometry->transform( poCT );
+    poGeometry->transform( poCT );
 
-            switch (geoType) {
-            case wkbPolygon: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "Polygon feature" );
-                processPolygon(poFeature, (OGRPolygon*)poGeometry, area_type_name);
-                break;
-            }
-            case wkbMultiPolygon: {
-                SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPolygon feature" );
-                OGRMultiPolygon* multipoly=(OGRMultiPolygon*)poGeometry;
-                for (int i=0;i<multipoly->getNumGeometries();i++) {
-                    processPolygon(poFeature, (OGRPolygon*)(multipoly->getGeometryRef(i)), area_type_name);
-                }
-                break;
-            }
-            default:
-                /* Ignore unhandled objects */
-                break;
-            }
+    switch (geoType) {
+    case wkbPolygon: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "Polygon feature" );
+        processPolygon(poFeature, (OGRPolygon*)poGeometry, area_type_name);
+        break;
+    }
+    case wkbMultiPolygon: {
+        SG_LOG( SG_GENERAL, SG_DEBUG, "MultiPolygon feature" );
+        OGRMultiPolygon* multipoly=(OGRMultiPolygon*)poGeometry;
+        for (int i=0;i<multipoly->getNumGeometries();i++) {
+            processPolygon(poFeature, (OGRPolygon*)(multipoly->getGeometryRef(i)), area_type_name);
+        }
+        break;
+    }
+    default:
+        /* Ignore unhandled objects */
+        break;
+    }
 
-            OGRFeature::DestroyFeature( poFeature );
+    OGRFeature::DestroyFeature( poFeature );
+}
+
+void Decoder::run()
+{
+    std::vector<OGRFeature *> batch;
+
+    // as long as we have geometry to parse, do so
+    while ( queue.pop( batch ) ) {
+        for ( unsigned int i=0; i<batch.size(); i++ ) {
+            if ( batch[i] ) {
+                processFeature( batch[i] );
+            }
         }
     }
 
@@ -227,8 +375,38 @@ void processPolygon(OGRFeature *poFeature, OGRPolygon* poGeometry, const string&
 
 #endif
 
+/* setup attribute and spatial queries */
+void setupQueries( OGRLayer* poLayer, OGRSpatialReference* oSourceSRS, OGRSpatialReference* oTargetSRS )
+{
+    if (use_spatial_query) {
+        double trans_min_x,trans_min_y,trans_max_x,trans_max_y;
+        /* do a simple reprojection of the source SRS */
+        OGRCoordinateTransformation *poCTinverse;
+
+        poCTinverse = OGRCreateCoordinateTransformation(oTargetSRS, oSourceSRS);
+
+        trans_min_x=spat_min_x;
+        trans_min_y=spat_min_y;
+        trans_max_x=spat_max_x;
+        trans_max_y=spat_max_y;
+
+        poCTinverse->Transform(1,&trans_min_x,&trans_min_y);
+        poCTinverse->Transform(1,&trans_max_x,&trans_max_y);
+
+        poLayer->SetSpatialFilterRect(trans_min_x, trans_min_y,
+                                      trans_max_x, trans_max_y);
+    }
+
+    if (use_attribute_query) {
+        if (poLayer->SetAttributeFilter(attribute_query.c_str()) != OGRERR_NONE) {
+            SG_LOG( SG_GENERAL, SG_ALERT, "Error in query expression '" << attribute_query << "'" );
+            exit( 1 );
+        }
+    }
+}
+
 // Main Thread
-void processLayer(OGRLayer* poLayer, tgChopper& results, std::mutex& l )
+void processLayer(const string& datasource, OGRLayer* poLayer, tgChopper& results )
 {
     int feature_count=poLayer->GetFeatureCount();
 
@@ -269,57 +447,66 @@ void processLayer(OGRLayer* poLayer, tgChopper& results, std::mutex& l )
     OGRCoordinateTransformation *poCT = OGRCreateCoordinateTransformation(oSourceSRS, &oTargetSRS);
 
     /* setup attribute and spatial queries */
-    if (use_spatial_query) {
-        double trans_min_x,trans_min_y,trans_max_x,trans_max_y;
-        /* do a simple reprojection of the source SRS */
-        OGRCoordinateTransformation *poCTinverse;
-
-        poCTinverse = OGRCreateCoordinateTransformation(&oTargetSRS, oSourceSRS);
+    setupQueries( poLayer, oSourceSRS, &oTargetSRS );
 
-        trans_min_x=spat_min_x;
-        trans_min_y=spat_min_y;
-        trans_max_x=spat_max_x;
-        trans_max_y=spat_max_y;
+#if SUPPORT_MULTITHREADING    
 
-        poCTinverse->Transform(1,&trans_min_x,&trans_min_y);
-        poCTinverse->Transform(1,&trans_max_x,&trans_max_y);
+    FeatureQueue queue( queue_size );
 
-        poLayer->SetSpatialFilterRect(trans_min_x, trans_min_y,
-                                      trans_max_x, trans_max_y);
+    // Start the decoders - they process the features as they are read
+    // this just generates all the tgPolygons
+    std::vector<Decoder *> decoders;
+    for (int i=0; i<num_threads; i++) {
+        Decoder* decoder = new Decoder( poCT, area_type_field, results, queue );
+        decoder->start();
+        decoders.push_back( decoder );
     }
 
-    if (use_attribute_query) {
-        if (poLayer->SetAttributeFilter(attribute_query.c_str()) != OGRERR_NONE) {
-            SG_LOG( SG_GENERAL, SG_ALERT, "Error in query expression '" << attribute_query << "'" );
-            exit( 1 );
-        }
+    // split the layer into ranges of features for multiple readers - only
+    // if the driver can seek to a feature without reading all before it
+    GIntBig numFeatures = -1;
+    GIntBig perReader   = -1;
+    std::vector<Reader *> readers;
+
+    if ( num_readers > 1 && poLayer->TestCapability( OLCFastSetNextByIndex ) ) {
+        numFeatures = poLayer->GetFeatureCount();
     }
 
-    OGRFeature *poFeature;
-    poLayer->SetNextByIndex(start_record);
+    if ( numFeatures > start_record ) {
+        perReader = ( numFeatures - start_record + num_readers - 1 ) / num_readers;
 
-#if SUPPORT_MULTITHREADING    
+        for (int i=1; i<num_readers; i++) {
+            GIntBig start = start_record + i * perReader;
 
-    // Generate the work queue for this layer
-    while ( ( poFeature = poLayer->GetNextFeature()) != NULL )
-    {
-        global_workQueue.push( poFeature );
+            if ( start < numFeatures ) {
+                Reader* reader = new Reader( datasource, layername, start, perReader, queue );
+                reader->start();
+                readers.push_back( reader );
+            }
+        }
     }
 
-    // Now process the workqueue with threads
-    // this just generates all the tgPolygons
-    std::vector<Decoder *> decoders;
-    for (int i=0; i<num_threads; i++) {
-        Decoder* decoder = new Decoder( poCT, area_type_field, results, l );
-        decoder->start();
-        decoders.push_back( decoder );
+    // the main thread reads the first range ( or everything )
+    readFeatures( poLayer, start_record, perReader, queue );
+
+    for (unsigned int i=0; i<readers.size(); i++) {
+        readers[i]->join();
     }
+    queue.close();
 
-    // Then wait until they are finished
+    // Then wait until the decoders are finished
     for (unsigned int i=0; i<decoders.size(); i++) {
         decoders[i]->join();
+        delete decoders[i];
+    }
+
+    for (unsigned int i=0; i<readers.size(); i++) {
+        readers[i]->close();
+        delete readers[i];
     }
 #else
+    OGRFeature *poFeature;
+    poLayer->SetNextByIndex(start_record);
 
     // process each feature in the main thread
     while ( ( poFeature = poLayer->GetNextFeature()) != NULL )
@@ -429,6 +616,12 @@ void usage(char* progname) {
     SG_LOG( SG_GENERAL, SG_ALERT, "        Enable multithreading with user specified number of threads" );
     SG_LOG( SG_GENERAL, SG_ALERT, "--all-threads" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Enable multithreading with all available cpu cores" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "--num-readers n" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        Read each layer with n threads, if the driver supports fast seeking" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "--queue-size n" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        Maximum number of feature batches read ahead of the decoders" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "--trace basename" );
+    SG_LOG( SG_GENERAL, SG_ALERT, "        Time the chopper, and write basename.json and basename.trace.json" );
     SG_LOG( SG_GENERAL, SG_ALERT, "" );
     SG_LOG( SG_GENERAL, SG_ALERT, "<work_dir>" );
     SG_LOG( SG_GENERAL, SG_ALERT, "        Directory to put the polygon files in" );
@@ -443,7 +636,7 @@ void usage(char* progname) {
 int main( int argc, char **argv ) {
     char*   progname=argv[0];
     string  datasource,work_dir;
-    std::mutex lock;
+    string  trace_base;
     
     sglog().setLogLevels( SG_ALL, SG_INFO );
 
@@ -478,6 +671,35 @@ int main( int argc, char **argv ) {
                 usage(progname);
             }
             num_threads=atoi(argv[2]);
+            if (num_threads<1) {
+                usage(progname);
+            }
+            argv+=2;
+            argc-=2;
+        } else if (!strcmp(argv[1],"--num-readers")) {
+            if (argc<3) {
+                usage(progname);
+            }
+            num_readers=atoi(argv[2]);
+            argv+=2;
+            argc-=2;
+        } else if (!strcmp(argv[1],"--queue-size")) {
+            if (argc<3) {
+                usage(progname);
+            }
+            queue_size=atoi(argv[2]);
+            if (queue_size<1) {
+                // a queue holding no batches is always full - the readers would block forever
+                usage(progname);
+            }
+            argv+=2;
+            argc-=2;
+        } else if (!strcmp(argv[1],"--trace")) {
+            if (argc<3) {
+                usage(progname);
+            }
+            trace_base=argv[2];
+            tgTrace::instance().enable( true );
             argv+=2;
             argc-=2;
         } else if (!strcmp(argv[1],"--start-record")) {
@@ -525,7 +747,10 @@ int main( int argc, char **argv ) {
     sgp.append( "dummy" );
     sgp.create_dir( 0755 );
 
+    // the decoders share the chopper's clip helpers, so features
+    // prechopped into many chunks are clipped by up to num_threads threads
     tgChopper results( work_dir );
+    results.SetNumThreads( num_threads );
 
     SG_LOG( SG_GENERAL, SG_DEBUG, "Opening datasource " << datasource << " for reading." );
 
@@ -551,7 +776,7 @@ int main( int argc, char **argv ) {
                 SG_LOG( SG_GENERAL, SG_ALERT, "Failed opening layer " << argv[i] << " from datasource " << datasource );
                 exit( 1 );
             }
-            processLayer(poLayer, results, lock );
+            processLayer(datasource, poLayer, results );
         }
     } else {
         for (int i=0;i<poDS->GetLayerCount();i++) {
@@ -559,11 +784,19 @@ int main( int argc, char **argv ) {
 
             assert(poLayer != NULL);
 
-            processLayer(poLayer, results, lock );
+            processLayer(datasource, poLayer, results );
         }
     }
 
+    // write out any chopped polys still queued
+    results.Flush();
+
     GDALClose(poDS);
 
+    if ( !trace_base.empty() ) {
+        tgTrace::instance().writeJson( trace_base + ".json" );
+        tgTrace::instance().writeChromeTrace( trace_base + ".trace.json" );
+    }
+
     return 0;
 }
@@ -111,6 +111,7 @@ inline void array2<T>::free()
         delete[] data;
         data = NULL;
     }
+    w = h = 0;
 }
 
 template<class T>
@@ -23,14 +23,31 @@ void TrackedTriangle::update(Subdivision& s)
 
 GreedySubdivision::GreedySubdivision(Map *map)
 {
-    H = map;
     heap = new Heap(128);
+    init(map);
+}
+
+void GreedySubdivision::reset(Map *map)
+{
+    heap->clear();
+    Subdivision::reset();
+
+    if( is_used.width() != map->width || is_used.height() != map->height )
+	is_used.free();
+
+    init(map);
+}
+
+void GreedySubdivision::init(Map *map)
+{
+    H = map;
 
     int w = H->width;
     int h = H->height;
     real range = H->max - H->min;
 
-    is_used.init(w, h);
+    if( !is_used.width() )
+	is_used.init(w, h);
     int x,y;
     for(x=0;x<w;x++)
 	for(y=0;y<h;y++) {
@@ -58,6 +58,8 @@ protected:
 
     Map *H;
 
+    void init(Map *map);
+
     Triangle *allocFace(Edge *e);
 
     void compute_plane(Plane&, Triangle&, Map&);
@@ -70,6 +72,10 @@ public:
     GreedySubdivision(Map *map);
     virtual ~GreedySubdivision();
 
+    //
+    // start over on a new map, reusing the allocations of the last one
+    void reset(Map *map);
+
     array2<char> is_used;
 
     Edge *select(int sx, int sy, Triangle *t=NULL);
@@ -54,6 +54,9 @@ public:
     heap_node *extract();
     heap_node *top() { return size<1 ? (heap_node *)NULL : &ref(0); }
     heap_node *kill(int i);
+
+    // empty the heap, keeping the allocated space
+    void clear() { size=0; }
 };
 
 }; // namespace Terra
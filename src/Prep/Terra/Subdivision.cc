@@ -17,6 +17,11 @@ Subdivision::Subdivision()
 }
 
 Subdivision::~Subdivision() 
+{
+    reset();
+}
+
+void Subdivision::reset()
 {
     //delete [] startingEdge;
     //delete [] first_face;
@@ -26,6 +31,25 @@ Subdivision::~Subdivision()
     for (EdgeVecIterator e = edges.begin(); e != edges.end(); e++) {
         delete (*e);
     }
+    for (std::vector<Vec2*>::iterator p = points.begin(); p != points.end(); p++) {
+        delete (*p);
+    }
+
+    // clear() keeps the capacity
+    triangles.clear();
+    edges.clear();
+    points.clear();
+
+    startingEdge = 0;
+    first_face   = 0;
+}
+
+Vec2& Subdivision::makePoint(const Vec2& p)
+{
+    Vec2 *v = new Vec2(p);
+    points.push_back(v);
+
+    return *v;
 }
 
 Edge *Subdivision::makeEdge(Vec2& org, Vec2& dest)
@@ -54,10 +78,10 @@ Edge *Subdivision::makeEdge()
 void Subdivision::initMesh(const Vec2& A,const Vec2& B,
 			   const Vec2& C,const Vec2& D)
 {
-    Vec2& a = A.clone();
-    Vec2& b = B.clone();
-    Vec2& c = C.clone();
-    Vec2& d = D.clone();
+    Vec2& a = makePoint(A);
+    Vec2& b = makePoint(B);
+    Vec2& c = makePoint(C);
+    Vec2& d = makePoint(D);
 
     Edge *ea = makeEdge();
     ea->EndPoints(a, b);
@@ -334,7 +358,7 @@ Edge *Subdivision::spoke(Vec2& x, Edge *e)
 	// x lies within the Lface of e
     }
 
-    Edge *base = makeEdge(e->Org(), x.clone());
+    Edge *base = makeEdge(e->Org(), makePoint(x));
 
     splice(base, e);
 
@@ -58,6 +58,9 @@ private:
 
     EdgeVec     edges;
 
+    // vertex positions - edges only point at them
+    std::vector<Vec2*> points;
+
 protected:
 
     TriangleVec triangles;
@@ -65,6 +68,12 @@ protected:
     Subdivision();
     ~Subdivision();
 
+    //
+    // free the mesh, but keep the allocated vectors for the next one
+    void reset();
+
+    Vec2& makePoint(const Vec2&);
+
     Edge *makeEdge();
     Edge *makeEdge(Vec2& org, Vec2& dest);
 
@@ -23,10 +23,15 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 #include <stdio.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef _MSC_VER
 #  include <unistd.h>
@@ -54,6 +59,7 @@
 #include <simgear/threads/SGThread.hxx>
 
 #include <terragear/tg_array.hxx>
+#include <terragear/tg_array_fit.hxx>
 #include <Include/version.h>
 #include <Prep/Terra/GreedyInsert.h>
 #include <Prep/Terra/Map.h>
@@ -75,9 +81,51 @@ SGLockedQueue<SGPath> global_workQueue;
  */
 class ArrayMap: public Terra::Map {
 public:
-        ArrayMap(tgArray& array): array(array) {
+        ArrayMap() {
+                width=0;
+                height=0;
+                depth=32;
+        }
+        virtual ~ArrayMap() {}
+
+        /* copy the elevations - the buffer is kept for the next array */
+        void load(const tgArray& array) {
                 width=array.get_cols();
                 height=array.get_rows();
+                data.resize(width*height);
+                min=30000;
+                max=-30000;
+                for (int i=0;i<width;i++) {
+                        for (int j=0;j<height;j++) {
+                                Terra::real v=(Terra::real)array.get_array_elev(i,j);
+                                data[i*height+j]=v;
+                                if (v<min)
+                                        min=v;
+                                if (v>max)
+                                        max=v;
+                        }
+                }
+        }
+
+        virtual Terra::real eval(int i, int j) {
+                return data[i*height+j];
+        }
+
+        /* No direct reading of .arr.gz files */
+        virtual void rawRead(istream&) {
+        }
+        virtual void textRead(istream&) {
+        }
+protected:
+        std::vector<Terra::real> data;
+};
+
+/* a rectangle of another map */
+class SubMap: public Terra::Map {
+public:
+        SubMap(Terra::Map& parent, int x0, int y0, int w, int h): parent(parent), x0(x0), y0(y0) {
+                width=w;
+                height=h;
                 min=30000;
                 max=-30000;
                 for (int i=0;i<width;i++) {
@@ -91,19 +139,19 @@ public:
                 }
                 depth=32;
         }
-        virtual ~ArrayMap() {}
-        
+        virtual ~SubMap() {}
+
         virtual Terra::real eval(int i, int j) {
-                return (Terra::real)array.get_array_elev(i,j);
+                return parent.eval(x0+i,y0+j);
         }
 
-        /* No direct reading of .arr.gz files */
         virtual void rawRead(istream&) {
         }
         virtual void textRead(istream&) {
         }
 protected:
-        tgArray& array;
+        Terra::Map& parent;
+        int x0, y0;
 };
 
 static Terra::ImportMask default_mask;
@@ -119,14 +167,23 @@ Terra::real error_threshold=40.0;
 unsigned int min_points=50;
 unsigned int point_limit=1000;
 bool force=false;
+bool resume=false;
+bool text_output=false;
 unsigned int num_threads = 1;
+int block_size = 0;
+unsigned int block_threads = 0;
+
+/* overlap of the blocks of a partitioned fit, and half the width of the
+ * strips refitted along their seams */
+#define BLOCK_OVERLAP   (32)
 
-inline int goal_not_met(Terra::GreedySubdivision* mesh)
+inline int goal_not_met(Terra::GreedySubdivision* mesh,
+                        unsigned int min_pts, unsigned int max_pts)
 {
     return
         ( mesh->maxError() > error_threshold &&
-          mesh->pointCount() < point_limit ) ||
-          mesh->pointCount() < min_points;
+          mesh->pointCount() < max_pts ) ||
+          mesh->pointCount() < min_pts;
 
 }
 
@@ -137,18 +194,202 @@ static void announce_goal(Terra::GreedySubdivision* mesh)
     SG_LOG(SG_GENERAL, SG_INFO, "     points=" << mesh->pointCount() << " [limit=" << point_limit << "]");
 }
 
-void greedy_insertion(Terra::GreedySubdivision* mesh)
+void greedy_insertion(Terra::GreedySubdivision* mesh,
+                      unsigned int min_pts, unsigned int max_pts)
 {
-
-    while( goal_not_met(mesh) )
+    while( goal_not_met(mesh, min_pts, max_pts) )
     {
         if( !mesh->greedyInsert() )
             break;
     }
+}
+
+void greedy_insertion(Terra::GreedySubdivision* mesh)
+{
+    greedy_insertion(mesh, min_points, point_limit);
 
     announce_goal(mesh);
 }
 
+/* share of a point count for an area of a map - rounded down, so the
+ * shares never add up to more than the count */
+static unsigned int point_share(unsigned int points, double area, double total)
+{
+    return total > 0 ? (unsigned int)((double)points * area / total) : 0;
+}
+
+/*
+ * Fit a rectangle of the map, seeded with the points already set in used
+ * ( column major, like the map ), adding up to max_pts new points.  The
+ * points of the fit are returned in found - without the corners of the
+ * rectangle, unless they were seeds.
+ */
+static void fit_region(Terra::Map& DEM, const std::vector<char>& used,
+                       int x0, int y0, int w, int h,
+                       unsigned int min_pts, unsigned int max_pts,
+                       std::vector<int>& found)
+{
+    SubMap map(DEM, x0, y0, w, h);
+    Terra::GreedySubdivision mesh(&map);
+
+    unsigned int seeds = 0;
+    for (int x=0;x<w;x++) {
+        for (int y=0;y<h;y++) {
+            if (used[(x0+x)*DEM.height+y0+y] && mesh.is_used(x,y) == DATA_POINT_UNUSED) {
+                mesh.select(x,y);
+                seeds++;
+            }
+        }
+    }
+
+    greedy_insertion(&mesh, seeds + min_pts, seeds + max_pts);
+
+    found.clear();
+    for (int x=0;x<w;x++) {
+        for (int y=0;y<h;y++) {
+            if (mesh.is_used(x,y) != DATA_POINT_USED)
+                continue;
+
+            int index = (x0+x)*DEM.height+y0+y;
+            bool corner = (x==0 || x==w-1) && (y==0 || y==h-1);
+            if (corner && !used[index])
+                continue;
+
+            found.push_back(index);
+        }
+    }
+}
+
+/* run job(0) ... job(count-1) on up to block_threads threads */
+template <typename Job>
+static void run_jobs(unsigned int count, Job job)
+{
+    std::atomic<unsigned int> next(0);
+    std::vector<std::thread> threads;
+
+    unsigned int nthreads = std::min(std::max(block_threads, 1u), count);
+    for (unsigned int t=0; t<nthreads; ++t) {
+        threads.push_back(std::thread([&]() {
+            unsigned int i;
+            while ((i = next++) < count) {
+                job(i);
+            }
+        }));
+    }
+
+    for (unsigned int t=0; t<threads.size(); ++t) {
+        threads[t].join();
+    }
+}
+
+/*
+ * Fit a large map as blocks of block_size cells on several threads.
+ *
+ * Each block is fitted with an overlap of BLOCK_OVERLAP cells, and keeps
+ * the points of its core only.  The blocks don't see each others points,
+ * so strips across the seams are then refitted - seeded with the points
+ * the blocks chose - until they meet the error threshold too.  The
+ * vertical seams are done first, then the horizontal ones, which see the
+ * points added by the vertical ones.
+ *
+ * point_limit covers everything: the blocks share what the seams don't
+ * need by their core area, and the seams share what the blocks left by
+ * strip area.
+ */
+static void fit_partitioned(Terra::Map& DEM, std::vector<char>& used)
+{
+    int W = DEM.width;
+    int H = DEM.height;
+    int nx = std::max(1, (W - 1 + block_size - 1) / block_size);
+    int ny = std::max(1, (H - 1 + block_size - 1) / block_size);
+
+    used.assign(W*H, 0);
+
+    std::vector< std::vector<int> > found(nx*ny);
+    std::vector<char> none(W*H, 0);
+
+    // strips refitted across the seams
+    double vstrips = 0.0, hstrips = 0.0;
+    for (int k=1; k<nx; ++k) {
+        int c = k*block_size;
+        vstrips += (double)(std::min(W-1, c + BLOCK_OVERLAP) - std::max(0, c - BLOCK_OVERLAP) + 1) * H;
+    }
+    for (int k=1; k<ny; ++k) {
+        int c = k*block_size;
+        hstrips += (double)(std::min(H-1, c + BLOCK_OVERLAP) - std::max(0, c - BLOCK_OVERLAP) + 1) * W;
+    }
+
+    double total = (double)W*H;
+    unsigned int block_points = point_limit - point_share(point_limit, std::min(vstrips + hstrips, total / 2), total);
+
+    run_jobs(nx*ny, [&](unsigned int b) {
+        int bx = b / ny, by = b % ny;
+
+        // core of the block, and the block with its overlap
+        int cx0 = bx*block_size, cx1 = (bx == nx-1) ? W-1 : (bx+1)*block_size - 1;
+        int cy0 = by*block_size, cy1 = (by == ny-1) ? H-1 : (by+1)*block_size - 1;
+        int x0 = std::max(0, cx0 - BLOCK_OVERLAP), x1 = std::min(W-1, cx1 + BLOCK_OVERLAP);
+        int y0 = std::max(0, cy0 - BLOCK_OVERLAP), y1 = std::min(H-1, cy1 + BLOCK_OVERLAP);
+
+        // the overlap is fitted too, but only the core points are kept
+        double core = (double)(cx1-cx0+1) * (cy1-cy0+1);
+        unsigned int max_pts = point_share(block_points, core, total);
+        unsigned int min_pts = std::min(max_pts, point_share(min_points, core, total));
+
+        std::vector<int> points;
+        fit_region(DEM, none, x0, y0, x1-x0+1, y1-y0+1, min_pts, max_pts, points);
+
+        for (unsigned int i=0; i<points.size(); ++i) {
+            int x = points[i] / H, y = points[i] % H;
+            if (x >= cx0 && x <= cx1 && y >= cy0 && y <= cy1) {
+                found[b].push_back(points[i]);
+            }
+        }
+    });
+
+    for (unsigned int b=0; b<found.size(); ++b) {
+        for (unsigned int i=0; i<found[b].size(); ++i) {
+            used[found[b][i]] = 1;
+        }
+    }
+
+    // the tile corners are always in the fit
+    used[0] = used[H-1] = used[(W-1)*H] = used[(W-1)*H+H-1] = 1;
+
+    for (int pass=0; pass<2; ++pass) {
+        bool vertical = (pass == 0);
+        int seams = vertical ? nx-1 : ny-1;
+
+        // what's left of point_limit - the vertical seams get their share
+        // of it, the horizontal ones whatever the vertical ones leave
+        unsigned int placed = std::count(used.begin(), used.end(), 1);
+        unsigned int left = placed < point_limit ? point_limit - placed : 0;
+        unsigned int pass_points = vertical ? point_share(left, vstrips, vstrips + hstrips) : left;
+        double pass_area = vertical ? vstrips : hstrips;
+
+        found.assign(seams, std::vector<int>());
+
+        run_jobs(seams, [&](unsigned int k) {
+            int c = (k+1)*block_size;
+            if (vertical) {
+                int x0 = std::max(0, c - BLOCK_OVERLAP), x1 = std::min(W-1, c + BLOCK_OVERLAP);
+                unsigned int max_pts = point_share(pass_points, (double)(x1-x0+1)*H, pass_area);
+                fit_region(DEM, used, x0, 0, x1-x0+1, H, 0, max_pts, found[k]);
+            } else {
+                int y0 = std::max(0, c - BLOCK_OVERLAP), y1 = std::min(H-1, c + BLOCK_OVERLAP);
+                unsigned int max_pts = point_share(pass_points, (double)(y1-y0+1)*W, pass_area);
+                fit_region(DEM, used, 0, y0, W, y1-y0+1, 0, max_pts, found[k]);
+            }
+        });
+
+        for (unsigned int k=0; k<found.size(); ++k) {
+            for (unsigned int i=0; i<found[k].size(); ++i) {
+                used[found[k][i]] = 1;
+            }
+        }
+    }
+}
+
 bool endswith(const std::string& s1, const std::string& suffix) {
     size_t s1len=s1.size();
     size_t sufflen=suffix.size();
@@ -160,13 +401,84 @@ bool endswith(const std::string& s1, const std::string& suffix) {
     return s1.compare(s1len-sufflen,sufflen,suffix)==0;
 }
 
-void fit_file(const SGPath& path) {
+SGPath fit_path(const SGPath& path, bool text) {
+    SGPath outPath(path.dir());
+    outPath.append(path.file_base() + (text ? ".fit.gz" : TG_ARRAY_FIT_EXT));
+    return outPath;
+}
+
+/*
+ * Hash of the source array and the fit parameters - if neither changed,
+ * neither will the fit.
+ */
+uint64_t source_hash(const SGPath& path) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (fp) {
+        std::vector<unsigned char> buf(65536);
+        size_t len;
+        while ((len = fread(&buf[0], 1, buf.size(), fp)) > 0) {
+            crc = crc32(crc, &buf[0], len);
+        }
+        fclose(fp);
+    }
+
+    char params[128];
+    snprintf(params, sizeof(params), "%f %u %u %d", (double)error_threshold, min_points, point_limit, block_size);
+    uLong pcrc = crc32(0L, (const Bytef*)params, strlen(params));
+
+    return ((uint64_t)crc << 32) | pcrc;
+}
+
+class FitThread : public SGThread
+{
+public:
+    FitThread() : mesh(NULL) {}
+    virtual ~FitThread() { delete mesh; }
+
+    virtual void run()
+    {
+        while (!global_workQueue.empty()) {
+            SGPath path = global_workQueue.pop();
+            if (path.exists()) {
+                fit_file(path);
+            }
+        }
+    }
+
+private:
+    void fit_file(const SGPath& path);
+
+    /* reused from file to file */
+    ArrayMap DEM;
+    Terra::GreedySubdivision* mesh;
+};
+
+void FitThread::fit_file(const SGPath& path) {
+    SGPath outPath = fit_path(path, text_output);
+    uint64_t hash = 0;
+
+    if (resume) {
+        tgArrayFitHeader header;
+        hash = source_hash(path);
+
+        if (!force && tgArrayFitOpen(outPath.str(), header) && header.sourceHash == hash) {
+            SG_LOG(SG_GENERAL, SG_INFO, "Skipping " << outPath << ", source " << path << " is unchanged");
+            return;
+        }
+    }
+
     SG_LOG(SG_GENERAL, SG_INFO,"Working on file '" << path << "'");
 
-    SGPath outPath(path.dir());
-    outPath.append(path.file_base() + ".fit.gz");
-    if ( outPath.exists() ) {
-        unlink( outPath.c_str() );
+    // remove fits in either format, so a stale one never wins over the new one
+    SGPath textPath = fit_path(path, true);
+    SGPath binPath = fit_path(path, false);
+    if ( textPath.exists() ) {
+        unlink( textPath.c_str() );
+    }
+    if ( binPath.exists() ) {
+        unlink( binPath.c_str() );
     }
 
     SGBucket bucket; // dummy bucket
@@ -174,41 +486,76 @@ void fit_file(const SGPath& path) {
     inarray.parse(bucket);
     inarray.close();
 
-    ArrayMap DEM(inarray);
+    DEM.load(inarray);
 
-    Terra::GreedySubdivision mesh(&DEM);
+    std::vector<char> used;
 
-    greedy_insertion(&mesh);
+    if (block_size > 0 && (DEM.width > block_size || DEM.height > block_size)) {
+        fit_partitioned(DEM, used);
+    } else {
+        if (mesh) {
+            mesh->reset(&DEM);
+        } else {
+            mesh = new Terra::GreedySubdivision(&DEM);
+        }
 
-    gzFile fp;
-    if ( (fp = gzopen( outPath.c_str(), "wb9" )) == NULL ) {
-        SG_LOG(SG_GENERAL, SG_ALERT, "ERROR: opening " << outPath << " for writing!");
-        return;
+        greedy_insertion(mesh);
+
+        used.resize(DEM.width*DEM.height);
+        for (int x=0;x<DEM.width;x++) {
+            for (int y=0;y<DEM.height;y++) {
+                used[x*DEM.height+y] = (mesh->is_used(x,y) == DATA_POINT_USED);
+            }
+        }
     }
 
-    gzprintf(fp,"%d\n",mesh.pointCount());
+    std::vector<SGGeod> points;
 
     for (int x=0;x<DEM.width;x++) {
         for (int y=0;y<DEM.height;y++) {
-            if (mesh.is_used(x,y) != DATA_POINT_USED)
+            if (!used[x*DEM.height+y])
                 continue;
             double vx,vy,vz;
             vx=(inarray.get_originx()+x*inarray.get_col_step())/3600.0;
             vy=(inarray.get_originy()+y*inarray.get_row_step())/3600.0;
             vz=DEM.eval(x,y);
-            gzprintf(fp,"%+03.8f %+02.8f %0.2f\n",vx,vy,vz);
+            points.push_back(SGGeod::fromDegM(vx,vy,vz));
         }
     }
 
+    if (block_size > 0 && (DEM.width > block_size || DEM.height > block_size)) {
+        SG_LOG(SG_GENERAL, SG_INFO, "Partitioned fit: points=" << points.size());
+    }
+
+    if (!text_output) {
+        if (!resume) {
+            hash = source_hash(path);
+        }
+        tgArrayFitWrite(outPath.str(), hash, points);
+        return;
+    }
+
+    gzFile fp;
+    if ( (fp = gzopen( outPath.c_str(), "wb9" )) == NULL ) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "ERROR: opening " << outPath << " for writing!");
+        return;
+    }
+
+    gzprintf(fp,"%d\n",(int)points.size());
+
+    for (unsigned int i=0;i<points.size();i++) {
+        gzprintf(fp,"%+03.8f %+02.8f %0.2f\n",points[i].getLongitudeDeg(),points[i].getLatitudeDeg(),points[i].getElevationM());
+    }
+
     gzclose(fp);
 }
 
 void queue_fit_file(const SGPath& path)
 {
-    SGPath outPath(path.dir());
-    outPath.append(path.file_base() + ".fit.gz");
+    SGPath outPath = fit_path(path, text_output);
 
-    if (!force) {
+    // with --resume, the fit threads compare source hashes instead
+    if (!force && !resume) {
         if (outPath.exists() && (path.modTime() < outPath.modTime())) {
             SG_LOG(SG_GENERAL, SG_INFO ,"Skipping " << outPath << ", source " << path << " is older");
             return;
@@ -218,20 +565,6 @@ void queue_fit_file(const SGPath& path)
     global_workQueue.push(path);
 }
 
-class FitThread : public SGThread
-{
-public:
-    virtual void run()
-    {
-        while (!global_workQueue.empty()) {
-            SGPath path = global_workQueue.pop();
-            if (path.exists()) {
-                fit_file(path);
-            }
-        }
-    }
-};
-
 void walk_path(const SGPath& path) {
 
     if (!path.exists()) {
@@ -239,7 +572,17 @@ void walk_path(const SGPath& path) {
         return;
     }
 
-    if ((path.lower_extension() == "arr") || (path.complete_lower_extension() == "arr.gz")) {
+    if (path.complete_lower_extension() == "arr.raw") {
+        SG_LOG(SG_GENERAL, SG_DEBUG, "will queue " << path);
+        queue_fit_file(path);
+    } else if ((path.lower_extension() == "arr") || (path.complete_lower_extension() == "arr.gz")) {
+        // tgArray reads the raw array if there is one - so do we
+        SGPath rawPath(path.dir());
+        rawPath.append(path.file_base() + TG_ARRAY_RAW_EXT);
+        if (rawPath.exists()) {
+            return;
+        }
+
         SG_LOG(SG_GENERAL, SG_DEBUG, "will queue " << path);
         queue_fit_file(path);
     } else if (path.isDir()) {
@@ -262,7 +605,11 @@ void usage(char* progname, const std::string& msg) {
     SG_LOG(SG_GENERAL,SG_INFO, "\t -x | --maxnodes 1000");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -e | --maxerror 40");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -f | --force");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -r | --resume");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -t | --text");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -j | --threads <number>");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -b | --block-size <cells>");
+    SG_LOG(SG_GENERAL,SG_INFO, "\t -p | --block-threads <number>");
     SG_LOG(SG_GENERAL,SG_INFO, "\t -v | --version");
     SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "Algorithm will produce at least <minnodes> fitted nodes, but no");
@@ -273,18 +620,26 @@ void usage(char* progname, const std::string& msg) {
     SG_LOG(SG_GENERAL,SG_INFO, "Increasing the maxnodes value and/or decreasing maxerror");
     SG_LOG(SG_GENERAL,SG_INFO, "will produce a better surface approximation.");
     SG_LOG(SG_GENERAL,SG_INFO, "");
-    SG_LOG(SG_GENERAL,SG_INFO, "The input file must be a .arr.gz file such as that produced");
-    SG_LOG(SG_GENERAL,SG_INFO, "by demchop or hgtchop utils.");
+    SG_LOG(SG_GENERAL,SG_INFO, "The input file must be a .arr.raw or .arr.gz file such as that");
+    SG_LOG(SG_GENERAL,SG_INFO, "produced by demchop or hgtchop utils.");
     SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "Force will overwrite existing .arr.gz files, even if the input is older");
     SG_LOG(SG_GENERAL,SG_INFO, "");
+    SG_LOG(SG_GENERAL,SG_INFO, "Arrays larger than <block-size> cells in either direction are split");
+    SG_LOG(SG_GENERAL,SG_INFO, "into overlapping blocks fitted on <block-threads> threads ( the cores");
+    SG_LOG(SG_GENERAL,SG_INFO, "not used by <threads> by default ), then the seams between them are");
+    SG_LOG(SG_GENERAL,SG_INFO, "refitted.  <maxnodes> is shared out between the blocks and seams by area.");
+    SG_LOG(SG_GENERAL,SG_INFO, "");
+    SG_LOG(SG_GENERAL,SG_INFO, "Resume skips arrays whose contents and fit parameters are the same");
+    SG_LOG(SG_GENERAL,SG_INFO, "as when their .fit.raw file was written, whatever the file times.");
+    SG_LOG(SG_GENERAL,SG_INFO, "");
     SG_LOG(SG_GENERAL,SG_INFO, "**** NOTE ****:");
-    SG_LOG(SG_GENERAL,SG_INFO, "If a directory is input all .arr.gz files in directory will be");
+    SG_LOG(SG_GENERAL,SG_INFO, "If a directory is input all .arr.raw and .arr.gz files in directory will be");
     SG_LOG(SG_GENERAL,SG_INFO, "processed recursively.");
     SG_LOG(SG_GENERAL,SG_INFO, "");
-    SG_LOG(SG_GENERAL,SG_INFO, "The output file(s) is/are called .fit.gz and is simply a list of");
-    SG_LOG(SG_GENERAL,SG_INFO, "from the resulting fitted surface nodes.  The user of the");
-    SG_LOG(SG_GENERAL,SG_INFO, ".fit.gz file will need to retriangulate the surface.");
+    SG_LOG(SG_GENERAL,SG_INFO, "The output file(s) is/are called .fit.raw and is simply a binary list");
+    SG_LOG(SG_GENERAL,SG_INFO, "of the resulting fitted surface nodes ( .fit.gz text with --text ).");
+    SG_LOG(SG_GENERAL,SG_INFO, "The user of the file will need to retriangulate the surface.");
 }
 
 struct option options[]={
@@ -293,8 +648,12 @@ struct option options[]={
     {"maxnodes",required_argument,NULL,'x'},
     {"maxerror",required_argument,NULL,'e'},
     {"force",no_argument,NULL,'f'},
+    {"resume",no_argument,NULL,'r'},
+    {"text",no_argument,NULL,'t'},
     {"version",no_argument,NULL,'v'},
     {"threads",required_argument,NULL,'j'},
+    {"block-size",required_argument,NULL,'b'},
+    {"block-threads",required_argument,NULL,'p'},
     {NULL,0,NULL,0}
 };
 
@@ -302,7 +661,7 @@ int main(int argc, char** argv) {
     sglog().setLogLevels( SG_ALL, SG_INFO );
     int option;
 
-    while ((option=getopt_long(argc,argv,"hm:x:e:fvj:",options,NULL))!=-1) {
+    while ((option=getopt_long(argc,argv,"hm:x:e:frtvj:b:p:",options,NULL))!=-1) {
         switch (option) {
             case 'h':
                 usage(argv[0],"");
@@ -319,6 +678,12 @@ int main(int argc, char** argv) {
             case 'f':
                 force=true;
                 break;
+            case 'r':
+                resume=true;
+                break;
+            case 't':
+                text_output=true;
+                break;
             case 'v':
                 SG_LOG(SG_GENERAL,SG_INFO,argv[0] << " version " << getTGVersion());
                 exit(0);
@@ -326,12 +691,32 @@ int main(int argc, char** argv) {
             case 'j':
                 num_threads = atoi(optarg);
                 break;
+            case 'b':
+                block_size = atoi(optarg);
+                break;
+            case 'p':
+                block_threads = atoi(optarg);
+                break;
             case '?':
                 usage(argv[0],std::string("Unknown option:")+(char)optopt);
                 exit(1);
         }
     }
 
+    if (block_size > 0 && block_size < 4 * BLOCK_OVERLAP) {
+        block_size = 4 * BLOCK_OVERLAP;
+        SG_LOG(SG_GENERAL, SG_ALERT, "Block size raised to " << block_size << " cells");
+    }
+    if (block_threads == 0) {
+        // the -j file threads each run their own block threads
+        block_threads = std::max(1u, std::thread::hardware_concurrency() / std::max(1u, num_threads));
+    }
+
+    if (resume && text_output) {
+        SG_LOG(SG_GENERAL, SG_ALERT, "--resume needs the source hash of .fit.raw files - ignored with --text");
+        resume=false;
+    }
+
     SG_LOG(SG_GENERAL, SG_INFO, "TerraFit version " << getTGVersion() << " using " << num_threads << " threads");
     SG_LOG(SG_GENERAL, SG_INFO, "Min points = " << min_points);
     SG_LOG(SG_GENERAL, SG_INFO, "Max points = " << point_limit);
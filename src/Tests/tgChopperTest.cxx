@@ -290,6 +290,9 @@ int main( int argc, char **argv ) {
         }
     }
 
+    // make sure the chopped polys are on disk before reading them back
+    results.Flush();
+
     GDALClose(poDS);
 
     char resDatasource[64];